@@ -1,14 +1,32 @@
 #include "soia.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define SOIA_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <limits>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <variant>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "absl/log/die_if_null.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
@@ -38,6 +56,217 @@ static constexpr char kHexDigits[] = "0123456789ABCDEF";
 
 enum class NullTerminated { kFalse = false, kTrue = true };
 
+// =============================================================================
+// BEGIN vectorized scanning
+// =============================================================================
+
+// Each Skip* function below returns a pointer to the first char in [pos, end)
+// which does not belong to a given class, or end. The input is scanned 16 bytes
+// at a time with SSE2 or NEON when available, or 8 bytes at a time otherwise,
+// and the last few bytes one at a time.
+
+inline bool IsJsonWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Chars which can be copied as-is from a JSON string literal to the decoded
+// string: everything but '"', '\\' and non-ASCII-7 bytes.
+inline bool IsPlainJsonStringChar(char c) {
+  return c != '"' && c != '\\' && static_cast<uint8_t>(c) < 0x80;
+}
+
+// Chars which can be copied as-is to a JSON string literal or to a debug
+// string: printable ASCII-7 chars other than '"' and '\\'.
+inline bool IsUnescapedChar(char c) {
+  return c != '"' && c != '\\' && static_cast<uint8_t>(c) >= 0x20 &&
+         static_cast<uint8_t>(c) < 0x80;
+}
+
+inline bool IsAsciiChar(char c) { return static_cast<uint8_t>(c) < 0x80; }
+
+#if defined(__SSE2__)
+
+// Each *Mask function returns a 16-bit mask with one bit set for each byte
+// which is NOT in the class.
+
+inline uint32_t NonWhitespaceMask(__m128i chunk) {
+  const __m128i whitespace = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))),
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')),
+                   _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))));
+  return ~static_cast<uint32_t>(_mm_movemask_epi8(whitespace)) & 0xFFFF;
+}
+
+inline uint32_t NonPlainJsonStringCharMask(__m128i chunk) {
+  const __m128i special =
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')),
+                   _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+  // The high bit of non-ASCII-7 bytes is set.
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(special, chunk)));
+}
+
+inline uint32_t EscapedCharMask(__m128i chunk) {
+  // The comparison is signed: non-ASCII-7 bytes are less than 0x20.
+  const __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')),
+                   _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+      _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x20)));
+  return static_cast<uint32_t>(_mm_movemask_epi8(special));
+}
+
+inline uint32_t NonAsciiMask(__m128i chunk) {
+  return static_cast<uint32_t>(_mm_movemask_epi8(chunk));
+}
+
+template <uint32_t (*kMask)(__m128i), bool (*kInClass)(char)>
+inline const char* SkipChars(const char* pos, const char* end) {
+  while (end - pos >= 16) {
+    const uint32_t mask =
+        kMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  while (pos < end && kInClass(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+inline const char* SkipWhitespace(const char* pos, const char* end) {
+  return SkipChars<NonWhitespaceMask, IsJsonWhitespace>(pos, end);
+}
+
+#elif defined(__ARM_NEON)
+
+// Each *Mask function returns a 64-bit mask with 4 bits set for each byte
+// which is NOT in the class.
+
+inline uint64_t ToNibbleMask(uint8x16_t not_in_class) {
+  const uint8x8_t nibbles =
+      vshrn_n_u16(vreinterpretq_u16_u8(not_in_class), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+inline uint64_t NonWhitespaceMask(uint8x16_t chunk) {
+  const uint8x16_t whitespace =
+      vorrq_u8(vorrq_u8(vceqq_u8(chunk, vdupq_n_u8(' ')),
+                        vceqq_u8(chunk, vdupq_n_u8('\n'))),
+               vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('\r')),
+                        vceqq_u8(chunk, vdupq_n_u8('\t'))));
+  return ToNibbleMask(vmvnq_u8(whitespace));
+}
+
+inline uint64_t NonPlainJsonStringCharMask(uint8x16_t chunk) {
+  const uint8x16_t special =
+      vorrq_u8(vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('"')),
+                        vceqq_u8(chunk, vdupq_n_u8('\\'))),
+               vcgeq_u8(chunk, vdupq_n_u8(0x80)));
+  return ToNibbleMask(special);
+}
+
+inline uint64_t EscapedCharMask(uint8x16_t chunk) {
+  const uint8x16_t special = vorrq_u8(
+      vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('"')),
+               vceqq_u8(chunk, vdupq_n_u8('\\'))),
+      vorrq_u8(vcltq_u8(chunk, vdupq_n_u8(0x20)),
+               vcgeq_u8(chunk, vdupq_n_u8(0x80))));
+  return ToNibbleMask(special);
+}
+
+inline uint64_t NonAsciiMask(uint8x16_t chunk) {
+  return ToNibbleMask(vcgeq_u8(chunk, vdupq_n_u8(0x80)));
+}
+
+template <uint64_t (*kMask)(uint8x16_t), bool (*kInClass)(char)>
+inline const char* SkipChars(const char* pos, const char* end) {
+  while (end - pos >= 16) {
+    const uint64_t mask =
+        kMask(vld1q_u8(reinterpret_cast<const uint8_t*>(pos)));
+    if (mask != 0) {
+      return pos + (__builtin_ctzll(mask) >> 2);
+    }
+    pos += 16;
+  }
+  while (pos < end && kInClass(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+inline const char* SkipWhitespace(const char* pos, const char* end) {
+  return SkipChars<NonWhitespaceMask, IsJsonWhitespace>(pos, end);
+}
+
+#else
+
+// Each *Mask function returns true if any byte of the 8-byte word is NOT in
+// the class.
+
+constexpr uint64_t kOnes = 0x0101010101010101;
+constexpr uint64_t kHighBits = 0x8080808080808080;
+
+// Returns true if any byte of the given word is less than n, where n <= 128.
+inline bool HasByteLessThan(uint64_t word, uint8_t n) {
+  return ((word - kOnes * n) & ~word & kHighBits) != 0;
+}
+
+inline bool HasByte(uint64_t word, char c) {
+  return HasByteLessThan(word ^ (kOnes * static_cast<uint8_t>(c)), 1);
+}
+
+inline bool NonPlainJsonStringCharMask(uint64_t word) {
+  return HasByte(word, '"') || HasByte(word, '\\') || (word & kHighBits) != 0;
+}
+
+inline bool EscapedCharMask(uint64_t word) {
+  return HasByte(word, '"') || HasByte(word, '\\') ||
+         HasByteLessThan(word, 0x20) || (word & kHighBits) != 0;
+}
+
+inline bool NonAsciiMask(uint64_t word) { return (word & kHighBits) != 0; }
+
+template <bool (*kMask)(uint64_t), bool (*kInClass)(char)>
+inline const char* SkipChars(const char* pos, const char* end) {
+  while (end - pos >= 8) {
+    uint64_t word = 0;
+    std::memcpy(&word, pos, 8);
+    if (kMask(word)) break;
+    pos += 8;
+  }
+  while (pos < end && kInClass(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+inline const char* SkipWhitespace(const char* pos, const char* end) {
+  while (pos < end && IsJsonWhitespace(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+#endif
+
+inline const char* SkipPlainJsonStringChars(const char* pos, const char* end) {
+  return SkipChars<NonPlainJsonStringCharMask, IsPlainJsonStringChar>(pos, end);
+}
+
+inline const char* SkipUnescapedChars(const char* pos, const char* end) {
+  return SkipChars<EscapedCharMask, IsUnescapedChar>(pos, end);
+}
+
+inline const char* SkipAsciiChars(const char* pos, const char* end) {
+  return SkipChars<NonAsciiMask, IsAsciiChar>(pos, end);
+}
+
+// =============================================================================
+// END vectorized scanning
+// =============================================================================
+
 namespace copy_utf8_codepoint {
 struct ToString {
   template <typename Char>
@@ -90,6 +319,29 @@ struct ToByteSink {
     out.PushUnsafe(0xBD);
   }
 };
+
+// Only counts the bytes which ToByteSink would push.
+struct ToLength {
+  template <typename Char>
+  inline static void Push(Char, size_t& out) {
+    ++out;
+  }
+  inline static void PopN(size_t n, size_t& out) { out -= n; }
+  inline static void OnError(const char*, const char*, size_t, size_t& out) {
+    // The replacement character: � (u+FFFD)
+    out += 3;
+  }
+};
+
+// Pushes nothing, only records whether the codepoint was valid.
+struct ToValidity {
+  template <typename Char>
+  inline static void Push(Char, bool&) {}
+  inline static void PopN(size_t, bool&) {}
+  inline static void OnError(const char*, const char*, size_t, bool& valid) {
+    valid = false;
+  }
+};
 }  // namespace copy_utf8_codepoint
 
 // Copy the non-ASCII-7 codepoint at pos - 1 to out.
@@ -158,10 +410,30 @@ utf8_error:
   Sink::OnError(pos, end, continuation_bytes, out);
 }
 
+// Returns a pointer to the first byte of the first invalid UTF-8 sequence in
+// [pos, end), or end if the whole input is valid UTF-8. Runs of ASCII-7 chars
+// are skipped in bulk.
+inline const char* SkipValidUtf8(const char* pos, const char* end) {
+  for (;;) {
+    pos = SkipAsciiChars(pos, end);
+    if (pos == end) return end;
+    const char* const codepoint_begin = pos;
+    bool valid = true;
+    CopyUtf8Codepoint<copy_utf8_codepoint::ToValidity, NullTerminated::kFalse>(
+        static_cast<uint8_t>(*pos++), pos, end, valid);
+    if (!valid) return codepoint_begin;
+  }
+}
+
 template <NullTerminated kNullTerminated>
 inline void EscapeJsonString(const char* pos, const char* end,
                              std::string& out) {
   while (kNullTerminated == NullTerminated::kTrue || pos < end) {
+    // Copy the longest sequence of chars which need no escaping.
+    const char* const unescaped_end = SkipUnescapedChars(pos, end);
+    out.append(pos, unescaped_end);
+    pos = unescaped_end;
+    if (kNullTerminated == NullTerminated::kFalse && pos == end) return;
     const uint8_t byte = static_cast<uint8_t>(*pos++);
     if (byte < 0x80) {
       if (byte < 0x20) {
@@ -220,54 +492,77 @@ inline void EscapeJsonString(const char* pos, const char* end,
   }
 }
 
-inline void EscapeJsonString(const std::string& input, std::string& out) {
+// String is std::string or soia::arena_string.
+template <typename String>
+inline void EscapeJsonString(const String& input, std::string& out) {
   const char* c_str = input.c_str();
   EscapeJsonString<NullTerminated::kTrue>(c_str, c_str + input.length(), out);
 }
 
-inline void CopyUtf8String(const std::string& input, ByteSink& out) {
-  const char* input_pos = input.c_str();
-  const char* input_end = input_pos + input.length();
-  uint8_t* out_pos = out.pos();
-  for (;;) {
-    const int8_t c = static_cast<int8_t>(*(input_pos++));
-    if (c <= 0) {
-      if (c == 0) {
-        // The input string is guaranteed to end with \0, but \0 can also be
-        // found within the string.
-        if (input_pos > input_end) {
-          // The end of the input string was reached.
-          out.set_pos(out_pos);
-          return;
-        } else {
-          *(out_pos++) = 0;
-          out.PushUnsafe(0);
-        }
-      } else {
-        out.set_pos(out_pos);
-        CopyUtf8Codepoint<copy_utf8_codepoint::ToByteSink,
-                          NullTerminated::kTrue>(c, input_pos, input_end, out);
-        out_pos = out.pos();
-      }
+// Copies a string which may contain invalid UTF-8 sequences, replacing each
+// invalid sequence with u+FFFD. The capacity must have been prepared.
+inline void CopyUtf8String(const char* pos, const char* end, ByteSink& out) {
+  while (pos < end) {
+    const uint8_t byte = static_cast<uint8_t>(*pos++);
+    if (byte < 0x80) {
+      out.PushUnsafe(byte);
     } else {
-      *(out_pos++) = c;
+      CopyUtf8Codepoint<copy_utf8_codepoint::ToByteSink,
+                        NullTerminated::kFalse>(byte, pos, end, out);
     }
   }
 }
 
-inline void EscapeDebugString(const std::string& input, std::string& out) {
-  const char* pos = input.c_str();
-  const char* input_end = pos + input.length() + 1;
-  for (;;) {
+// Returns the number of bytes which CopyUtf8String would push.
+inline size_t GetCopiedUtf8Length(absl::string_view input) {
+  const char* pos = input.data();
+  const char* end = pos + input.length();
+  // The valid prefix is copied as-is.
+  const char* valid_end = SkipValidUtf8(pos, end);
+  size_t result = valid_end - pos;
+  pos = valid_end;
+  while (pos < end) {
+    const uint8_t byte = static_cast<uint8_t>(*pos++);
+    if (byte < 0x80) {
+      ++result;
+    } else {
+      CopyUtf8Codepoint<copy_utf8_codepoint::ToLength, NullTerminated::kFalse>(
+          byte, pos, end, result);
+    }
+  }
+  return result;
+}
+
+inline void AppendString(absl::string_view input, ByteCounter& out) {
+  if (input.empty()) {
+    out.Push(242);
+  } else {
+    const size_t length = GetCopiedUtf8Length(input);
+    out.Add((length < 232 ? 2 : length < 65536 ? 4 : 6) + length);
+  }
+}
+
+template <NullTerminated kNullTerminated>
+inline void EscapeDebugString(const char* pos, const char* end,
+                              std::string& out) {
+  // If the input is null-terminated, the terminating \0 is never skipped.
+  const char* const skip_end =
+      kNullTerminated == NullTerminated::kTrue ? end + 1 : end;
+  while (kNullTerminated == NullTerminated::kTrue || pos < end) {
+    // Copy the longest sequence of chars which need no escaping.
+    const char* const unescaped_end = SkipUnescapedChars(pos, skip_end);
+    out.append(pos, unescaped_end);
+    pos = unescaped_end;
+    if (kNullTerminated == NullTerminated::kFalse && pos == end) return;
     const uint8_t byte = static_cast<uint8_t>(*(pos++));
     if (byte < 0x80) {
       if (byte < 0x20) {
         // A non-printable character.
         switch (byte) {
           case '\0':
-            // The input string is guaranteed to end with \0, but \0 can also be
-            // found within the string.
-            if (pos == input_end) {
+            // \0 may indicate the end of the string, but it can also be part of
+            // the string's contents.
+            if (kNullTerminated == NullTerminated::kTrue && pos > end) {
               // The end of the input string was reached.
               return;
             } else {
@@ -313,12 +608,19 @@ inline void EscapeDebugString(const std::string& input, std::string& out) {
         }
       }
     } else {
-      CopyUtf8Codepoint<copy_utf8_codepoint::ToDebugString,
-                        NullTerminated::kTrue>(byte, pos, input_end, out);
+      CopyUtf8Codepoint<copy_utf8_codepoint::ToDebugString, kNullTerminated>(
+          byte, pos, end, out);
     }
   }
 }
 
+// String is std::string or soia::arena_string.
+template <typename String>
+inline void EscapeDebugString(const String& input, std::string& out) {
+  const char* c_str = input.c_str();
+  EscapeDebugString<NullTerminated::kTrue>(c_str, c_str + input.length(), out);
+}
+
 inline bool IsDigit(char c) { return '0' <= c && c <= '9'; }
 
 int HexDigitToInt(char c) {
@@ -505,9 +807,24 @@ inline bool ParseUnicodeEscapeSequence(JsonTokenizer::State& s,
 
 inline JsonTokenType ParseString(JsonTokenizer::State& s) {
   // pos[0] == '"'
-  ++s.pos;
-  std::string value;
+  const char* const value_begin = ++s.pos;
+  s.pos = SkipPlainJsonStringChars(s.pos, s.end);
+  if (s.pos < s.end && *s.pos == '"') {
+    // Most common case: the string needs no decoding and can be borrowed from
+    // the JSON code.
+    s.borrowed_string_value =
+        absl::string_view(value_begin, s.pos - value_begin);
+    s.string_value_in_buffer = false;
+    ++s.pos;
+    return JsonTokenType::kString;
+  }
+  std::string& value = s.string_buffer;
+  value.assign(value_begin, s.pos);
   for (;;) {
+    // Copy the longest sequence of chars which need no special handling.
+    const char* plain_end = SkipPlainJsonStringChars(s.pos, s.end);
+    value.append(s.pos, plain_end);
+    s.pos = plain_end;
     if (s.pos == s.end) {
       s.PushError("error while parsing JSON: unterminated string literal");
       return JsonTokenType::kError;
@@ -517,7 +834,7 @@ inline JsonTokenType ParseString(JsonTokenizer::State& s) {
       // ASCII-7 codepoint.
       switch (byte) {
         case '"': {
-          s.string_value = std::move(value);
+          s.string_value_in_buffer = true;
           return JsonTokenType::kString;
         }
         case '\\': {
@@ -588,16 +905,12 @@ inline JsonTokenType NextImpl(JsonTokenizer::State& state) {
       return JsonTokenType::kStrEnd;
     }
     switch (*state.pos) {
+      case ' ':
       case '\t':
       case '\n':
       case '\r': {
-        ++state.pos;
-        break;
-      }
-      case ' ': {
-        // Very common for whitespaces to come together.
-        while (*(++state.pos) == ' ') {
-        }
+        // Very common for whitespaces to come together, e.g. indentation.
+        state.pos = SkipWhitespace(state.pos + 1, state.end);
         break;
       }
       case '[':
@@ -714,7 +1027,7 @@ inline void ParseJsonNumber(JsonTokenizer& tokenizer, number& out) {
       tokenizer.Next();
       break;
     case JsonTokenType::kString: {
-      const std::string& string_value = tokenizer.state().string_value;
+      const std::string string_value(tokenizer.state().string_value());
       if (TryParseSpecialNumber(string_value, out)) {
         tokenizer.Next();
         break;
@@ -790,8 +1103,8 @@ inline void AppendWiredFloat64(double value, ByteSink& out) {
 
 template <int kWire>
 inline void AppendLengthPrefix(size_t length, ByteSink& out) {
-  static_assert(kWire == 245 || kWire == 250);
-  constexpr bool kPrepareLengthBytes = (kWire == 245);
+  static_assert(kWire == 243 || kWire == 245 || kWire == 250);
+  constexpr bool kPrepareLengthBytes = (kWire != 250);
   if (kWire == 250 && length < 4) {
     out.Prepare(1 + (kPrepareLengthBytes ? length : 0));
     out.PushUnsafe((kWire - 4) + length);
@@ -967,6 +1280,13 @@ JsonTokenType JsonTokenizer::Next() {
   return state_.token_type = NextImpl(state_);
 }
 
+std::string JsonTokenizer::State::TakeStringValue() {
+  if (string_value_in_buffer) {
+    return std::move(string_buffer);
+  }
+  return std::string(borrowed_string_value);
+}
+
 void JsonTokenizer::State::PushError(absl::string_view message) {
   // Only keep the first error pushed.
   if (status.ok()) {
@@ -1148,7 +1468,14 @@ bool JsonObjectReader::NextEntry() {
     tokenizer_.mutable_state().PushUnexpectedTokenError("string");
     return false;
   }
-  name_ = std::move(tokenizer_.mutable_state().string_value);
+  JsonTokenizer::State& state = tokenizer_.mutable_state();
+  if (state.string_value_in_buffer) {
+    // The buffer of the tokenizer is overwritten by the next string token.
+    name_buffer_.swap(state.string_buffer);
+    name_ = name_buffer_;
+  } else {
+    name_ = state.borrowed_string_value;
+  }
   if (tokenizer_.Next() != JsonTokenType::kColon) {
     tokenizer_.mutable_state().PushUnexpectedTokenError("':'");
     return false;
@@ -1192,6 +1519,14 @@ void SkipValue(ByteSource& source) {
       case 11:
       case 13: {
         // 243, 245
+        if (wire == 243 && source.string_refs_base != nullptr &&
+            source.pos < source.end && *source.pos == 255) {
+          // String reference.
+          ++source.pos;
+          uint32_t offset = 0;
+          ParseNumber(source, offset);
+          break;
+        }
         uint32_t length = 0;
         ParseNumber(source, length);
         if (!source.TryAdvance(length)) return;
@@ -1233,6 +1568,13 @@ void AppendArrayPrefix(size_t length, ByteSink& out) {
   }
 }
 
+void AppendArrayPrefix(size_t length, ByteCounter& out) {
+  out.Add(length < 4       ? 1
+          : length < 232   ? 2
+          : length < 65536 ? 4
+                           : 6);
+}
+
 void ParseArrayPrefix(ByteSource& source, uint32_t& length) {
   const uint8_t byte = source.ReadWire();
   switch (static_cast<uint8_t>(byte - 246)) {
@@ -1296,6 +1638,14 @@ void Int32Adapter::Append(int32_t input, ByteSink& out) {
   }
 }
 
+void Int32Adapter::Append(int32_t input, ByteCounter& out) {
+  if (input < 0) {
+    out.Add(input >= -256 ? 2 : input >= -65536 ? 3 : 5);
+  } else {
+    out.Add(input < 232 ? 1 : input < 65536 ? 3 : 5);
+  }
+}
+
 void Int32Adapter::Parse(JsonTokenizer& tokenizer, int32_t& out) {
   ParseJsonNumber(tokenizer, out);
 }
@@ -1326,6 +1676,20 @@ void Int64Adapter::Append(int64_t input, ByteSink& out) {
   }
 }
 
+void Int64Adapter::Append(int64_t input, ByteCounter& out) {
+  if (input < 0) {
+    out.Add(input >= -256           ? 2
+            : input >= -65536       ? 3
+            : input >= -2147483648  ? 5
+                                    : 9);
+  } else {
+    out.Add(input < 232          ? 1
+            : input < 65536      ? 3
+            : input < 4294967296 ? 5
+                                 : 9);
+  }
+}
+
 void Int64Adapter::Parse(JsonTokenizer& tokenizer, int64_t& out) {
   ParseJsonNumber(tokenizer, out);
 }
@@ -1348,6 +1712,13 @@ void Uint64Adapter::Append(uint64_t input, ByteSink& out) {
   }
 }
 
+void Uint64Adapter::Append(uint64_t input, ByteCounter& out) {
+  out.Add(input < 232          ? 1
+          : input < 65536      ? 3
+          : input < 4294967296 ? 5
+                               : 9);
+}
+
 void Uint64Adapter::Parse(JsonTokenizer& tokenizer, uint64_t& out) {
   ParseJsonNumber(tokenizer, out);
 }
@@ -1364,6 +1735,10 @@ void Float32Adapter::Append(float input, ByteSink& out) {
   }
 }
 
+void Float32Adapter::Append(float input, ByteCounter& out) {
+  out.Add(input == 0.0 ? 1 : 5);
+}
+
 void Float32Adapter::Parse(JsonTokenizer& tokenizer, float& out) {
   ParseJsonNumber(tokenizer, out);
 }
@@ -1380,6 +1755,10 @@ void Float64Adapter::Append(double input, ByteSink& out) {
   }
 }
 
+void Float64Adapter::Append(double input, ByteCounter& out) {
+  out.Add(input == 0.0 ? 1 : 9);
+}
+
 void Float64Adapter::Parse(JsonTokenizer& tokenizer, double& out) {
   ParseJsonNumber(tokenizer, out);
 }
@@ -1388,6 +1767,233 @@ void Float64Adapter::Parse(ByteSource& source, double& out) {
   ParseNumber(source, out);
 }
 
+namespace {
+template <int kNumBytes>
+inline uint8_t* WriteLittleEndian(uint64_t value, uint8_t* pos) {
+  for (int i = 0; i < kNumBytes; ++i) {
+    pos[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+  return pos + kNumBytes;
+}
+
+// Same bytes as Int64Adapter::Append, and as Int32Adapter::Append for values
+// which fit in 32 bits.
+inline uint8_t* EncodeNumber(int64_t input, uint8_t* pos) {
+  if (input < 0) {
+    if (input >= -256) {
+      *(pos++) = 235;
+      return WriteLittleEndian<1>(input + 256, pos);
+    } else if (input >= -65536) {
+      *(pos++) = 236;
+      return WriteLittleEndian<2>(input + 65536, pos);
+    } else if (input >= -2147483648) {
+      *(pos++) = 237;
+      return WriteLittleEndian<4>(static_cast<uint32_t>(input), pos);
+    } else {
+      *(pos++) = 238;
+      return WriteLittleEndian<8>(static_cast<uint64_t>(input), pos);
+    }
+  } else if (input < 232) {
+    *(pos++) = input;
+    return pos;
+  } else if (input < 65536) {
+    *(pos++) = 232;
+    return WriteLittleEndian<2>(input, pos);
+  } else if (input < 4294967296) {
+    *(pos++) = 233;
+    return WriteLittleEndian<4>(input, pos);
+  } else {
+    *(pos++) = 238;
+    return WriteLittleEndian<8>(input, pos);
+  }
+}
+
+inline uint8_t* EncodeNumber(int32_t input, uint8_t* pos) {
+  return EncodeNumber(static_cast<int64_t>(input), pos);
+}
+
+inline uint8_t* EncodeNumber(uint64_t input, uint8_t* pos) {
+  if (input < 232) {
+    *(pos++) = input;
+    return pos;
+  } else if (input < 65536) {
+    *(pos++) = 232;
+    return WriteLittleEndian<2>(input, pos);
+  } else if (input < 4294967296) {
+    *(pos++) = 233;
+    return WriteLittleEndian<4>(input, pos);
+  } else {
+    *(pos++) = 234;
+    return WriteLittleEndian<8>(input, pos);
+  }
+}
+
+inline uint8_t* EncodeNumber(float input, uint8_t* pos) {
+  if (input == 0.0) {
+    *(pos++) = 0;
+    return pos;
+  }
+  uint32_t bits = 0;
+  std::memcpy(&bits, &input, 4);
+  *(pos++) = 240;
+  return WriteLittleEndian<4>(bits, pos);
+}
+
+inline uint8_t* EncodeNumber(double input, uint8_t* pos) {
+  if (input == 0.0) {
+    *(pos++) = 0;
+    return pos;
+  }
+  uint64_t bits = 0;
+  std::memcpy(&bits, &input, 8);
+  *(pos++) = 241;
+  return WriteLittleEndian<8>(bits, pos);
+}
+
+template <typename number>
+void AppendNumbersImpl(const number* begin, size_t n, ByteSink& out) {
+  // A number is encoded with at most one wire byte and 8 bytes.
+  constexpr size_t kMaxEncodedLength = 1 + (sizeof(number) < 8 ? 4 : 8);
+  out.Prepare(n * kMaxEncodedLength);
+  uint8_t* pos = out.pos();
+  for (const number* it = begin; it < begin + n; ++it) {
+    pos = EncodeNumber(*it, pos);
+  }
+  out.set_pos(pos);
+}
+
+template <typename number>
+void ParseNumbersImpl(ByteSource& source, size_t n, number* out) {
+  constexpr bool kIsFloat = std::is_same<number, float>::value;
+  constexpr bool kIsDouble = std::is_same<number, double>::value;
+  for (number* it = out; it < out + n; ++it) {
+    if (source.error) return;
+    // Fast paths for the most common wires: small numbers, and non-zero
+    // floats of the type of the array.
+    const uint8_t* pos = source.pos;
+    const size_t num_bytes_left = source.num_bytes_left();
+    if (num_bytes_left == 0) {
+      return source.RaiseError();
+    }
+    const uint8_t wire = *pos;
+    if (wire < 232) {
+      *it = static_cast<number>(wire);
+      source.pos = pos + 1;
+    } else if (kIsFloat && wire == 240 && num_bytes_left >= 5) {
+      source.pos = pos + 1;
+      const uint32_t bits = ReadUint32(source);
+      std::memcpy(it, &bits, 4);
+    } else if (kIsDouble && wire == 241 && num_bytes_left >= 9) {
+      source.pos = pos + 1;
+      const uint64_t bits = ReadUint64(source);
+      std::memcpy(it, &bits, 8);
+    } else {
+      ParseNumber(source, *it);
+    }
+  }
+}
+}  // namespace
+
+void AppendNumbers(const int32_t* begin, size_t n, ByteSink& out) {
+  AppendNumbersImpl(begin, n, out);
+}
+
+void AppendNumbers(const int64_t* begin, size_t n, ByteSink& out) {
+  AppendNumbersImpl(begin, n, out);
+}
+
+void AppendNumbers(const uint64_t* begin, size_t n, ByteSink& out) {
+  AppendNumbersImpl(begin, n, out);
+}
+
+void AppendNumbers(const float* begin, size_t n, ByteSink& out) {
+  AppendNumbersImpl(begin, n, out);
+}
+
+void AppendNumbers(const double* begin, size_t n, ByteSink& out) {
+  AppendNumbersImpl(begin, n, out);
+}
+
+void AppendNumbers(const int32_t* begin, size_t n, ByteCounter& out) {
+  size_t length = 0;
+  for (const int32_t* it = begin; it < begin + n; ++it) {
+    const int32_t input = *it;
+    if (input < 0) {
+      length += input >= -256 ? 2 : input >= -65536 ? 3 : 5;
+    } else {
+      length += input < 232 ? 1 : input < 65536 ? 3 : 5;
+    }
+  }
+  out.Add(length);
+}
+
+void AppendNumbers(const int64_t* begin, size_t n, ByteCounter& out) {
+  size_t length = 0;
+  for (const int64_t* it = begin; it < begin + n; ++it) {
+    const int64_t input = *it;
+    if (input < 0) {
+      length += input >= -256           ? 2
+                : input >= -65536       ? 3
+                : input >= -2147483648  ? 5
+                                        : 9;
+    } else {
+      length += input < 232          ? 1
+                : input < 65536      ? 3
+                : input < 4294967296 ? 5
+                                     : 9;
+    }
+  }
+  out.Add(length);
+}
+
+void AppendNumbers(const uint64_t* begin, size_t n, ByteCounter& out) {
+  size_t length = 0;
+  for (const uint64_t* it = begin; it < begin + n; ++it) {
+    const uint64_t input = *it;
+    length += input < 232          ? 1
+              : input < 65536      ? 3
+              : input < 4294967296 ? 5
+                                   : 9;
+  }
+  out.Add(length);
+}
+
+void AppendNumbers(const float* begin, size_t n, ByteCounter& out) {
+  size_t num_zeros = 0;
+  for (const float* it = begin; it < begin + n; ++it) {
+    num_zeros += *it == 0.0;
+  }
+  out.Add(n * 5 - num_zeros * 4);
+}
+
+void AppendNumbers(const double* begin, size_t n, ByteCounter& out) {
+  size_t num_zeros = 0;
+  for (const double* it = begin; it < begin + n; ++it) {
+    num_zeros += *it == 0.0;
+  }
+  out.Add(n * 9 - num_zeros * 8);
+}
+
+void ParseNumbers(ByteSource& source, size_t n, int32_t* out) {
+  ParseNumbersImpl(source, n, out);
+}
+
+void ParseNumbers(ByteSource& source, size_t n, int64_t* out) {
+  ParseNumbersImpl(source, n, out);
+}
+
+void ParseNumbers(ByteSource& source, size_t n, uint64_t* out) {
+  ParseNumbersImpl(source, n, out);
+}
+
+void ParseNumbers(ByteSource& source, size_t n, float* out) {
+  ParseNumbersImpl(source, n, out);
+}
+
+void ParseNumbers(ByteSource& source, size_t n, double* out) {
+  ParseNumbersImpl(source, n, out);
+}
+
 void TimestampAdapter::Append(absl::Time input, DenseJson& out) {
   absl::StrAppend(&out.out, ClampUnixMillis(absl::ToUnixMillis(input)));
 }
@@ -1420,6 +2026,11 @@ void TimestampAdapter::Append(absl::Time input, ByteSink& out) {
   }
 }
 
+void TimestampAdapter::Append(absl::Time input, ByteCounter& out) {
+  const int64_t unix_millis = ClampUnixMillis(absl::ToUnixMillis(input));
+  out.Add(unix_millis != 0 ? 9 : 1);
+}
+
 void TimestampAdapter::Parse(JsonTokenizer& tokenizer, absl::Time& out) {
   if (tokenizer.state().token_type == JsonTokenType::kLeftCurlyBracket) {
     bool has_unix_millis = false;
@@ -1467,62 +2078,123 @@ void StringAdapter::Append(const std::string& input, DebugString& out) {
   out.out += '"';
 }
 
-void StringAdapter::Append(const std::string& input, ByteSink& out) {
+namespace {
+// Strings shorter than this are never written as string references.
+constexpr size_t kMinStringRefLength = 4;
+
+// Writes a reference to the string at the given offset if it is shorter than
+// writing a string of the given length. Returns true if it did.
+bool MaybeAppendStringRef(size_t offset, size_t length, ByteSink& out) {
+  // The reference is 243, 255 and the offset encoded as a soia number.
+  const size_t ref_length = offset < 232 ? 3 : offset < 65536 ? 5 : 7;
+  if (offset >= 4294967296 || 2 + length <= ref_length) return false;
+  out.Push(243);
+  if (offset < 232) {
+    out.Push(255, offset);
+  } else if (offset < 65536) {
+    out.Push(255, 232, offset & 0xFF, offset >> 8);
+  } else {
+    out.Push(255, 233, offset & 0xFF, offset >> 8, offset >> 16, offset >> 24);
+  }
+  return true;
+}
+
+template <typename String>
+void AppendUtf8String(const String& input, ByteSink& out) {
   if (input.empty()) {
     out.Push(242);
     return;
   }
-  // We don't know the length of the UTF-8 string until we actually encode the
-  // string. We just know that it's at most 3 times the length of the input
-  // string.
-  const uint64_t max_encoded_length = input.length() * static_cast<uint64_t>(3);
-
-  const int prefix_length = max_encoded_length < 232     ? 2
-                            : max_encoded_length < 65536 ? 4
-                                                         : 6;
-
-  // Prepare for the most-likely scenario: the input string does not contain
-  // invalid UTF-8 sequences. We will call Prepare again otherwise.
-  out.Prepare(prefix_length + input.length());
-
-  // Write zero in place of the UTF-8 sequence length. We will override this
-  // number later.
-  if (max_encoded_length < 232) {
-    out.Push(243, 0);
-  } else if (max_encoded_length < 65536) {
-    out.Push(243, 232, 0, 0);
+  if (StringRefs* const string_refs = out.string_refs();
+      string_refs != nullptr && input.length() >= kMinStringRefLength) {
+    const absl::string_view key(input.data(), input.length());
+    const auto it = string_refs->find(key);
+    if (it == string_refs->end()) {
+      string_refs->emplace(std::string(key), out.length());
+    } else if (MaybeAppendStringRef(it->second, input.length(), out)) {
+      return;
+    }
+  }
+  const char* begin = input.data();
+  const char* end = begin + input.length();
+  // Most-likely scenario: the input string is valid UTF-8 and can be copied
+  // as-is. Otherwise, invalid sequences are replaced and we need a second pass
+  // to know the length of the encoded string.
+  if (SkipValidUtf8(begin, end) == end) {
+    AppendLengthPrefix<243>(input.length(), out);
+    out.PushRangeUnsafe(cast(begin), cast(end));
   } else {
-    out.Push(243, 233, 0, 0, 0, 0);
+    AppendLengthPrefix<243>(GetCopiedUtf8Length(input), out);
+    CopyUtf8String(begin, end, out);
   }
+}
 
-  const size_t prefix_end_offset = out.length();
-  CopyUtf8String(input, out);
-  const size_t encoded_length = out.length() - prefix_end_offset;
-
-  // Now we can actually write the encoded length to the prefix.
-  uint8_t* data = out.data();
-  if (max_encoded_length < 232) {
-    data[prefix_end_offset - 1] = encoded_length;
-  } else if (max_encoded_length < 65536) {
-    data[prefix_end_offset - 2] = encoded_length & 0xFF;
-    data[prefix_end_offset - 1] = encoded_length >> 8;
-  } else {
-    if (encoded_length < 4294967296) {
-      data[prefix_end_offset - 4] = encoded_length & 0xFF;
-      data[prefix_end_offset - 3] = encoded_length >> 8;
-      data[prefix_end_offset - 2] = encoded_length >> 16;
-      data[prefix_end_offset - 1] = encoded_length >> 24;
-    } else {
-      LOG(FATAL) << "overflow error while encoding soia value; length: "
-                 << input.length();
+// Reads what follows wire 243: either the length and the bytes of a string,
+// or a string reference if the input was written by ToBytesWithStringRefs.
+void ReadStringPayload(ByteSource& source, absl::string_view& out) {
+  if (source.string_refs_base != nullptr && source.pos < source.end &&
+      *source.pos == 255) {
+    // The 243 byte of the reference.
+    const uint8_t* const ref_begin = source.pos - 1;
+    ++source.pos;
+    uint32_t offset = 0;
+    ParseNumber(source, offset);
+    if (source.error) return;
+    // The reference must point to a 243 byte before it, followed by a length
+    // and not by another reference. Check the offset before forming a pointer
+    // which could be outside of the input.
+    if (offset >= static_cast<size_t>(ref_begin - source.string_refs_base)) {
+      return source.RaiseError();
+    }
+    const uint8_t* const target = source.string_refs_base + offset;
+    if (*target != 243) {
+      return source.RaiseError();
+    }
+    ByteSource target_source(target + 1, ref_begin - (target + 1));
+    uint32_t length = 0;
+    ParseNumber(target_source, length);
+    if (target_source.error || target_source.num_bytes_left() < length) {
+      return source.RaiseError();
     }
+    out = absl::string_view(cast(target_source.pos), length);
+    return;
+  }
+  uint32_t length = 0;
+  ParseNumber(source, length);
+  if (source.num_bytes_left() < length) {
+    return source.RaiseError();
+  }
+  out = absl::string_view(cast(source.pos), length);
+  source.pos += length;
+}
+
+template <typename String>
+void ParseUtf8String(ByteSource& source, String& out) {
+  const uint8_t wire = source.ReadWire();
+  if (wire == 243) {
+    absl::string_view payload;
+    ReadStringPayload(source, payload);
+    if (source.error) return;
+    out.reserve(payload.length());
+    out.append(payload.data(), payload.length());
+  } else if (wire != 242 && wire != 0) {
+    source.RaiseError();
   }
 }
+}  // namespace
+
+void StringAdapter::Append(const std::string& input, ByteSink& out) {
+  AppendUtf8String(input, out);
+}
+
+void StringAdapter::Append(const std::string& input, ByteCounter& out) {
+  AppendString(input, out);
+}
 
 void StringAdapter::Parse(JsonTokenizer& tokenizer, std::string& out) {
   switch (tokenizer.state().token_type) {
     case JsonTokenType::kString:
-      out = std::move(tokenizer.mutable_state().string_value);
+      out = tokenizer.mutable_state().TakeStringValue();
       tokenizer.Next();
       break;
     case JsonTokenType::kZero:
@@ -1534,20 +2206,109 @@ void StringAdapter::Parse(JsonTokenizer& tokenizer, std::string& out) {
 }
 
 void StringAdapter::Parse(ByteSource& source, std::string& out) {
+  ParseUtf8String(source, out);
+}
+
+void ArenaStringAdapter::AppendJson(const soia::arena_string& input,
+                                    std::string& out) {
+  out += '"';
+  soia_internal::EscapeJsonString(input, out);
+  out += '"';
+}
+
+void ArenaStringAdapter::Append(const soia::arena_string& input,
+                                DebugString& out) {
+  out.out += '"';
+  EscapeDebugString(input, out.out);
+  out.out += '"';
+}
+
+void ArenaStringAdapter::Append(const soia::arena_string& input,
+                                ByteSink& out) {
+  AppendUtf8String(input, out);
+}
+
+void ArenaStringAdapter::Append(const soia::arena_string& input,
+                                ByteCounter& out) {
+  AppendString(input, out);
+}
+
+void ArenaStringAdapter::Parse(JsonTokenizer& tokenizer,
+                               soia::arena_string& out) {
+  switch (tokenizer.state().token_type) {
+    case JsonTokenType::kString: {
+      const absl::string_view string_value = tokenizer.state().string_value();
+      out.assign(string_value.data(), string_value.length());
+      tokenizer.Next();
+      break;
+    }
+    case JsonTokenType::kZero:
+      tokenizer.Next();
+      break;
+    default:
+      tokenizer.mutable_state().PushUnexpectedTokenError("string");
+  }
+}
+
+void ArenaStringAdapter::Parse(ByteSource& source, soia::arena_string& out) {
+  ParseUtf8String(source, out);
+}
+
+namespace {
+void AppendBytesDebugString(absl::string_view bytes, std::string& out) {
+  out += "soia::ByteString({";
+  for (size_t i = 0; i < bytes.length(); ++i) {
+    if (i != 0) {
+      out += {',', ' '};
+    }
+    const uint8_t byte = static_cast<uint8_t>(bytes[i]);
+    out += {'0', 'x', soia_internal::kHexDigits[byte >> 4],
+            soia_internal::kHexDigits[byte & 0xf]};
+  }
+  out += "})";
+}
+
+void AppendBytes(absl::string_view bytes, ByteSink& out) {
+  if (bytes.empty()) {
+    out.Push(244);
+  } else {
+    AppendLengthPrefix<245>(bytes.length(), out);
+    out.PushNUnsafe(cast(bytes.data()), bytes.length());
+  }
+}
+
+void AppendBytes(absl::string_view bytes, ByteCounter& out) {
+  const size_t length = bytes.length();
+  if (length == 0) {
+    out.Push(244);
+  } else {
+    out.Add((length < 232 ? 2 : length < 65536 ? 4 : 6) + length);
+  }
+}
+
+// Reads a bytes value and points `out` into the input.
+void ReadBytes(ByteSource& source, absl::string_view& out) {
   const uint8_t wire = source.ReadWire();
-  if (wire == 243) {
-    uint32_t length = 0;
-    ParseNumber(source, length);
-    if (source.num_bytes_left() < length) {
-      return source.RaiseError();
-    };
-    out.reserve(length);
-    out.append(cast(source.pos), length);
-    source.pos += length;
-  } else if (wire != 242 && wire != 0) {
-    source.RaiseError();
+  switch (wire) {
+    case 0:
+    case 244:
+      break;
+    case 245: {
+      uint32_t length = 0;
+      ParseNumber(source, length);
+      if (source.num_bytes_left() < length) {
+        return source.RaiseError();
+      }
+      out = absl::string_view(cast(source.pos), length);
+      source.pos += length;
+      break;
+    }
+    default: {
+      source.RaiseError();
+    }
   }
 }
+}  // namespace
 
 void BytesAdapter::Append(const soia::ByteString& input, DenseJson& out) {
   absl::StrAppend(&out.out, "\"", absl::Base64Escape(input.as_string()), "\"");
@@ -1559,36 +2320,24 @@ void BytesAdapter::Append(const soia::ByteString& input, ReadableJson& out) {
 }
 
 void BytesAdapter::Append(const soia::ByteString& input, DebugString& out) {
-  out.out += "soia::ByteString({";
-  const absl::string_view bytes = input.as_string();
-  for (size_t i = 0; i < bytes.length(); ++i) {
-    if (i != 0) {
-      out.out += {',', ' '};
-    }
-    const uint8_t byte = static_cast<uint8_t>(bytes[i]);
-    out.out += {'0', 'x', soia_internal::kHexDigits[byte >> 4],
-                soia_internal::kHexDigits[byte & 0xf]};
-  }
-  out.out += "})";
+  AppendBytesDebugString(input.as_string(), out.out);
 }
 
 void BytesAdapter::Append(const soia::ByteString& input, ByteSink& out) {
-  if (input.empty()) {
-    out.Push(244);
-  } else {
-    AppendLengthPrefix<245>(input.length(), out);
-    out.PushNUnsafe(cast(input.as_string().data()), input.length());
-  }
+  AppendBytes(input.as_string(), out);
+}
+
+void BytesAdapter::Append(const soia::ByteString& input, ByteCounter& out) {
+  AppendBytes(input.as_string(), out);
 }
 
 void BytesAdapter::Parse(JsonTokenizer& tokenizer, soia::ByteString& out) {
   switch (tokenizer.state().token_type) {
     case JsonTokenType::kString: {
-      const std::string& string_value = tokenizer.state().string_value;
+      const absl::string_view string_value = tokenizer.state().string_value();
       std::string bytes;
       if (absl::StartsWith(string_value, "hex:")) {
-        const absl::string_view hex_string =
-            absl::string_view(string_value).substr(4);
+        const absl::string_view hex_string = string_value.substr(4);
         if (!absl::HexStringToBytes(hex_string, &bytes)) {
           tokenizer.mutable_state().PushError(
               "error while parsing JSON: not a hex string");
@@ -1610,28 +2359,94 @@ void BytesAdapter::Parse(JsonTokenizer& tokenizer, soia::ByteString& out) {
 }
 
 void BytesAdapter::Parse(ByteSource& source, soia::ByteString& out) {
+  absl::string_view bytes;
+  ReadBytes(source, bytes);
+  if (!bytes.empty()) {
+    out = bytes;
+  }
+}
+
+void StringViewAdapter::AppendJson(absl::string_view input, std::string& out) {
+  out += '"';
+  EscapeJsonString<NullTerminated::kFalse>(input.data(),
+                                           input.data() + input.length(), out);
+  out += '"';
+}
+
+void StringViewAdapter::Append(absl::string_view input, DebugString& out) {
+  out.out += '"';
+  EscapeDebugString<NullTerminated::kFalse>(
+      input.data(), input.data() + input.length(), out.out);
+  out.out += '"';
+}
+
+void StringViewAdapter::Append(absl::string_view input, ByteSink& out) {
+  AppendUtf8String(input, out);
+}
+
+void StringViewAdapter::Append(absl::string_view input, ByteCounter& out) {
+  AppendString(input, out);
+}
+
+void StringViewAdapter::Parse(JsonTokenizer& tokenizer, absl::string_view&) {
+  // The tokenizer unescapes JSON strings into a buffer it owns, so there is
+  // nothing in the input for the view to point into.
+  tokenizer.mutable_state().PushError(
+      "error while parsing JSON: absl::string_view can only be parsed from "
+      "binary format");
+}
+
+void StringViewAdapter::Parse(ByteSource& source, absl::string_view& out) {
   const uint8_t wire = source.ReadWire();
-  switch (wire) {
-    case 0:
-    case 244:
-      break;
-    case 245: {
-      uint32_t length = 0;
-      ParseNumber(source, length);
-      if (source.num_bytes_left() < length) {
-        return source.RaiseError();
-      }
-      const char* begin = cast(source.pos);
-      out = absl::string_view(begin, length);
-      source.pos += length;
-      break;
-    }
-    default: {
-      source.RaiseError();
-    }
+  if (wire == 243) {
+    ReadStringPayload(source, out);
+  } else if (wire == 242 || wire == 0) {
+    out = absl::string_view();
+  } else {
+    source.RaiseError();
   }
 }
 
+void BytesViewAdapter::Append(const soia::ByteStringView& input,
+                              DenseJson& out) {
+  absl::StrAppend(&out.out, "\"", absl::Base64Escape(input.as_string()), "\"");
+}
+
+void BytesViewAdapter::Append(const soia::ByteStringView& input,
+                              ReadableJson& out) {
+  absl::StrAppend(&out.out, "\"hex:", absl::BytesToHexString(input.as_string()),
+                  "\"");
+}
+
+void BytesViewAdapter::Append(const soia::ByteStringView& input,
+                              DebugString& out) {
+  AppendBytesDebugString(input.as_string(), out.out);
+}
+
+void BytesViewAdapter::Append(const soia::ByteStringView& input,
+                              ByteSink& out) {
+  AppendBytes(input.as_string(), out);
+}
+
+void BytesViewAdapter::Append(const soia::ByteStringView& input,
+                              ByteCounter& out) {
+  AppendBytes(input.as_string(), out);
+}
+
+void BytesViewAdapter::Parse(JsonTokenizer& tokenizer, soia::ByteStringView&) {
+  // JSON bytes are Base64 or hex encoded, so there is nothing in the input for
+  // the view to point into.
+  tokenizer.mutable_state().PushError(
+      "error while parsing JSON: soia::ByteStringView can only be parsed from "
+      "binary format");
+}
+
+void BytesViewAdapter::Parse(ByteSource& source, soia::ByteStringView& out) {
+  absl::string_view bytes;
+  ReadBytes(source, bytes);
+  out = bytes;
+}
+
 // =============================================================================
 // BEGIN serialization of type descriptors
 // =============================================================================
@@ -1738,7 +2553,7 @@ void ReflectionPrimitiveTypeAdapter::Parse(
           {"bytes", soia::reflection::PrimitiveType::kBytes},
       });
   if (tokenizer.state().token_type == JsonTokenType::kString) {
-    const auto it = kMap->find(tokenizer.state().string_value);
+    const auto it = kMap->find(tokenizer.state().string_value());
     if (it != kMap->cend()) {
       out = it->second;
       tokenizer.Next();
@@ -1814,7 +2629,7 @@ void ReflectionRecordKindAdapter::Append(
 void ReflectionRecordKindAdapter::Parse(JsonTokenizer& tokenizer,
                                         soia::reflection::RecordKind& out) {
   if (tokenizer.state().token_type == JsonTokenType::kString) {
-    const std::string& string_value = tokenizer.state().string_value;
+    const absl::string_view string_value = tokenizer.state().string_value();
     if (string_value == "struct") {
       out = soia::reflection::RecordKind::kStruct;
       tokenizer.Next();
@@ -1914,25 +2729,30 @@ void StructJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
   }
 }
 
-void EnumJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
-                                     void* out) const {
+void ParseEnumJsonObject(JsonTokenizer& tokenizer,
+                         absl::FunctionRef<int(absl::string_view)> find_kind,
+                         absl::FunctionRef<void(int)> parse_value) {
   JsonObjectReader object_reader(&tokenizer);
   bool kind_seen = false;
   bool value_seen = false;
-  const Field* field = nullptr;
+  int number = 0;
   // In the unlikely event "value" is seen before "kind", we need to rewind the
   // tokenizer to parse the value.
   std::unique_ptr<JsonTokenizer::State> value_state;
   while (object_reader.NextEntry()) {
     if (!kind_seen && object_reader.name() == "kind") {
       kind_seen = true;
-      std::string kind;
-      ::soia_internal::Parse(tokenizer, kind);
-      const auto it = fields_.find(kind);
-      if (it == fields_.end()) {
+      if (tokenizer.state().token_type == JsonTokenType::kString) {
+        number = find_kind(tokenizer.state().string_value());
+        tokenizer.Next();
+      } else {
+        // Let the string parser accept 0 or report the error.
+        std::string kind;
+        ::soia_internal::Parse(tokenizer, kind);
+      }
+      if (number == 0) {
         continue;
       }
-      field = it->second.get();
       if (value_state != nullptr) {
         // In this unlikely case, we need to rewind the tokenizer to parse the
         // value.
@@ -1940,7 +2760,7 @@ void EnumJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
         JsonTokenizer::State tokenizer_state =
             std::move(tokenizer.mutable_state());
         tokenizer.mutable_state() = *std::move(value_state);
-        field->Parse(tokenizer, out);
+        parse_value(number);
         const absl::Status status = std::move(tokenizer.mutable_state().status);
         tokenizer.mutable_state() = std::move(tokenizer_state);
         if (!status.ok()) {
@@ -1949,8 +2769,8 @@ void EnumJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
       }
     } else if (!value_seen && object_reader.name() == "value") {
       value_seen = true;
-      if (field != nullptr) {
-        field->Parse(tokenizer, out);
+      if (number != 0) {
+        parse_value(number);
       } else {
         if (!kind_seen) {
           value_state =
@@ -1964,6 +2784,20 @@ void EnumJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
   }
 }
 
+void EnumJsonObjectParserImpl::Parse(JsonTokenizer& tokenizer,
+                                     void* out) const {
+  const Field* field = nullptr;
+  ParseEnumJsonObject(
+      tokenizer,
+      [&](absl::string_view kind) {
+        const auto it = fields_.find(kind);
+        if (it == fields_.end()) return 0;
+        field = it->second.get();
+        return 1;
+      },
+      [&](int) { field->Parse(tokenizer, out); });
+}
+
 EnumJsonArrayParser::EnumJsonArrayParser(JsonTokenizer* tokenizer)
     : tokenizer_(*ABSL_DIE_IF_NULL(tokenizer)) {}
 
@@ -2035,6 +2869,9 @@ std::pair<bool, int32_t> ParseEnumPrefix(ByteSource& source) {
 void UnrecognizedValues::ParseFrom(JsonTokenizer& tokenizer) {
   // Each element in this stack is the index of an element in array_lengths_.
   std::vector<size_t> index_of_array_stack;
+  if (!bytes_.has_value()) {
+    bytes_.emplace();
+  }
   while (true) {
     if (!index_of_array_stack.empty()) {
       uint32_t& array_length = array_lengths_[index_of_array_stack.back()];
@@ -2042,48 +2879,48 @@ void UnrecognizedValues::ParseFrom(JsonTokenizer& tokenizer) {
     }
     switch (tokenizer.state().token_type) {
       case JsonTokenType::kTrue: {
-        bytes_.Push(1);
+        bytes_->Push(1);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kZero:
       case JsonTokenType::kFalse: {
-        bytes_.Push(0);
+        bytes_->Push(0);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kNull: {
-        bytes_.Push(255);
+        bytes_->Push(255);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kUnsignedInteger: {
-        Uint64Adapter::Append(tokenizer.state().uint_value, bytes_);
+        Uint64Adapter::Append(tokenizer.state().uint_value, *bytes_);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kSignedInteger: {
-        Int64Adapter::Append(tokenizer.state().int_value, bytes_);
+        Int64Adapter::Append(tokenizer.state().int_value, *bytes_);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kFloat: {
-        Float64Adapter::Append(tokenizer.state().float_value, bytes_);
+        Float64Adapter::Append(tokenizer.state().float_value, *bytes_);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kString: {
-        StringAdapter::Append(tokenizer.state().string_value, bytes_);
+        StringViewAdapter::Append(tokenizer.state().string_value(), *bytes_);
         tokenizer.Next();
         break;
       }
       case JsonTokenType::kLeftSquareBracket: {
         if (tokenizer.Next() == JsonTokenType::kRightSquareBracket) {
-          bytes_.Push(246);
+          bytes_->Push(246);
           tokenizer.Next();
           break;
         }
-        bytes_.Push(250);
+        bytes_->Push(250);
         const size_t index = array_lengths_.size();
         array_lengths_.push_back(0);
         index_of_array_stack.push_back(index);
@@ -2091,7 +2928,7 @@ void UnrecognizedValues::ParseFrom(JsonTokenizer& tokenizer) {
       }
       case JsonTokenType::kLeftCurlyBracket: {
         // Not supported.
-        bytes_.Push(0);
+        bytes_->Push(0);
         SkipValue(tokenizer);
         continue;
       }
@@ -2115,94 +2952,23 @@ void UnrecognizedValues::ParseFrom(JsonTokenizer& tokenizer) {
   }
 }
 
-void UnrecognizedValues::ParseFrom(ByteSource& source) {
-  for (size_t num_values_left = 1; num_values_left > 0; --num_values_left) {
-    const uint8_t wire = source.ReadWire();
-    switch (static_cast<uint8_t>(wire - 232)) {
-      case 3: {
-        // 235
-        if (source.num_bytes_left() < 1) return source.RaiseError();
-        ++source.pos;
-        bytes_.PushRange(source.pos - 2, source.pos);
-        break;
-      }
-      case 0:
-      case 4: {
-        // 232, 236
-        if (source.num_bytes_left() < 2) return source.RaiseError();
-        source.pos += 2;
-        bytes_.PushRange(source.pos - 3, source.pos);
-        break;
-      }
-      case 1:
-      case 5:
-      case 8: {
-        // 233, 237, 240
-        if (source.num_bytes_left() < 4) return source.RaiseError();
-        source.pos += 4;
-        bytes_.PushRange(source.pos - 5, source.pos);
-        break;
-      }
-      case 2:
-      case 6:
-      case 7:
-      case 9: {
-        // 234, 238, 239, 241
-        if (source.num_bytes_left() < 8) return source.RaiseError();
-        source.pos += 8;
-        bytes_.PushRange(source.pos - 9, source.pos);
-        break;
-      }
-      case 11:
-      case 13: {
-        // 243, 245
-        const uint8_t* start = source.pos - 1;
-        uint32_t length = 0;
-        ParseNumber(source, length);
-        if (source.num_bytes_left() < length) return source.RaiseError();
-        bytes_.PushRange(start, source.pos += length);
-        break;
-      }
-      case 15:
-      case 16:
-      case 17: {
-        // 247-249
-        num_values_left += wire - 246;
-        bytes_.Push(wire);
-        break;
-      }
-      case 18: {
-        // 250
-        uint32_t array_len = 0;
-        ParseNumber(source, array_len);
-        num_values_left += array_len;
-        array_lengths_.push_back(array_len);
-        bytes_.Push(wire);
-        break;
-      }
-      case 19:
-      case 20:
-      case 21:
-      case 22: {
-        // 251-254
-        ++num_values_left;
-        bytes_.Push(wire);
-        break;
-      }
-      default: {
-        if (wire == 0) {
-          source.CheckEnd();
-          if (source.error) return;
-        }
-        bytes_.Push(wire);
-      }
-    }
-  }
+void UnrecognizedValues::ParseFrom(ByteSource& source, size_t num_values) {
+  // The values are kept as they are encoded in the input: copying them in one
+  // piece is much faster than copying them one by one.
+  const uint8_t* const begin = source.pos;
+  SkipValues(source, num_values);
+  if (source.error) return;
+  encoded_.append(cast(begin), source.pos - begin);
 }
 
 void UnrecognizedValues::AppendTo(DenseJson& out) const {
+  // If the values were parsed from binary format, the length of the arrays
+  // with wire 250 follows the wire.
+  const bool from_json = bytes_.has_value();
   size_t index_of_array = 0;
-  ByteSource source(bytes_.data(), bytes_.length());
+  ByteSource source = from_json
+                          ? ByteSource(bytes_->data(), bytes_->length())
+                          : ByteSource(encoded_.data(), encoded_.length());
   std::vector<uint32_t> num_left_stack;
   for (;;) {
     if (!num_left_stack.empty()) {
@@ -2280,7 +3046,12 @@ void UnrecognizedValues::AppendTo(DenseJson& out) const {
         case 15: {
           // 250
           ++source.pos;
-          const uint32_t length = array_lengths_[index_of_array++];
+          uint32_t length = 0;
+          if (from_json) {
+            length = array_lengths_[index_of_array++];
+          } else {
+            ParseNumber(source, length);
+          }
           num_left_stack.push_back(length);
           out.out += '[';
           break;
@@ -2314,19 +3085,30 @@ void UnrecognizedValues::AppendTo(DenseJson& out) const {
   }
 }
 
-void UnrecognizedValues::AppendTo(ByteSink& out) const {
-  {
-    size_t total_bytes = bytes_.length();
-    for (const uint32_t array_length : array_lengths_) {
-      total_bytes += array_length < 4       ? 0
-                     : array_length < 232   ? 1
-                     : array_length < 65536 ? 3
-                                            : 5;
-    }
-    out.Prepare(total_bytes);
+size_t UnrecognizedValues::GetEncodedLength() const {
+  if (!bytes_.has_value()) return encoded_.length();
+  size_t total_bytes = encoded_.length() + bytes_->length();
+  for (const uint32_t array_length : array_lengths_) {
+    total_bytes += array_length < 4       ? 0
+                   : array_length < 232   ? 1
+                   : array_length < 65536 ? 3
+                                          : 5;
   }
+  return total_bytes;
+}
+
+void UnrecognizedValues::AppendTo(ByteCounter& out) const {
+  out.Add(GetEncodedLength());
+}
+
+void UnrecognizedValues::AppendTo(ByteSink& out) const {
+  // The values come from either JSON or binary format, never both.
+  ABSL_DCHECK(encoded_.empty() || !bytes_.has_value());
+  out.Prepare(GetEncodedLength());
+  out.PushNUnsafe(cast(encoded_.data()), encoded_.length());
+  if (!bytes_.has_value()) return;
   size_t index_of_array = 0;
-  ByteSource source(bytes_.data(), bytes_.length());
+  ByteSource source(bytes_->data(), bytes_->length());
   while (true) {
     if (source.pos == source.end) break;
     const uint8_t byte = *source.pos;
@@ -2413,7 +3195,8 @@ void AppendUnrecognizedEnum(const UnrecognizedEnum* input, DenseJson& out) {
   }
 }
 
-void AppendUnrecognizedEnum(const UnrecognizedEnum* input, ByteSink& out) {
+template <typename Out>
+void AppendUnrecognizedEnumImpl(const UnrecognizedEnum* input, Out& out) {
   if (input == nullptr || input->format != UnrecognizedFormat::kBytes) {
     out.Push(0);
   } else {
@@ -2432,6 +3215,14 @@ void AppendUnrecognizedEnum(const UnrecognizedEnum* input, ByteSink& out) {
   }
 }
 
+void AppendUnrecognizedEnum(const UnrecognizedEnum* input, ByteSink& out) {
+  AppendUnrecognizedEnumImpl(input, out);
+}
+
+void AppendUnrecognizedEnum(const UnrecognizedEnum* input, ByteCounter& out) {
+  AppendUnrecognizedEnumImpl(input, out);
+}
+
 void ParseUnrecognizedFields(JsonArrayReader& array_reader, size_t num_slots,
                              size_t num_slots_incl_removed,
                              std::shared_ptr<UnrecognizedFieldsData>& out) {
@@ -2467,58 +3258,108 @@ void ParseUnrecognizedFields(ByteSource& source, size_t array_len,
     out = std::make_shared<UnrecognizedFieldsData>();
     out->format = UnrecognizedFormat::kBytes;
     out->array_len = array_len;
-    for (size_t i = num_slots_incl_removed; i < array_len; ++i) {
-      if (source.error) return;
-      out->values.ParseFrom(source);
-    }
+    out->values.ParseFrom(source, array_len - num_slots_incl_removed);
   } else {
     SkipValues(source, array_len - num_slots);
   }
 }
 
-absl::Status RequestBody::Parse(absl::string_view request_body) {
-  if (const char first_char = (request_body.empty() ? '\0' : request_body[0]);
-      first_char == '{' || first_char == ' ' || first_char == '\t' ||
-      first_char == '\r' || first_char == '\n') {
-    // A JSON object
-    JsonTokenizer tokenizer(request_body.begin(), request_body.end(),
-                            soia::UnrecognizedFieldsPolicy::kDrop);
-    if (tokenizer.Next() != JsonTokenType::kLeftCurlyBracket) {
-      return absl::InvalidArgumentError("expected: JSON object");
-    }
-    JsonObjectReader object_reader(&tokenizer);
-    while (object_reader.NextEntry()) {
-      if (object_reader.name() == "method") {
-        const JsonTokenType json_token_type = tokenizer.state().token_type;
-        if (json_token_type == JsonTokenType::kString) {
-          method_name = tokenizer.state().string_value;
-        } else if (json_token_type == JsonTokenType::kUnsignedInteger ||
-                   json_token_type == JsonTokenType::kSignedInteger) {
-          method_number =
-              tokenizer.state().token_type == JsonTokenType::kUnsignedInteger
-                  ? tokenizer.state().uint_value
-                  : tokenizer.state().int_value;
-        } else {
-          return absl::InvalidArgumentError(
-              "'method' field must be a string or an integer");
-        }
-        tokenizer.Next();
-      } else if (object_reader.name() == "request") {
-        const char* absl_nullable request_data_begin =
-            tokenizer.state().token_begin;
-        SkipValue(tokenizer);
-        const char* absl_nullable request_data_end =
-            tokenizer.state().token_begin;
-        request_data =
-            request_data_begin != nullptr && request_data_end != nullptr
-                ? absl::string_view(request_data_begin,
-                                    request_data_end - request_data_begin)
-                : absl::string_view();
-      } else {
-        SkipValue(tokenizer);
-      }
+namespace {
+// Returns the struct obtained by unwrapping arrays and optionals from the given
+// type, or nullptr if there is none.
+const soia::reflection::Record* absl_nullable GetStructRecord(
+    const soia::reflection::RecordRegistry& records,
+    const soia::reflection::Type& type) {
+  const soia::reflection::Type* unwrapped = &type;
+  while (true) {
+    if (const auto* optional =
+            std::get_if<soia::reflection::OptionalType>(unwrapped)) {
+      unwrapped = &*optional->other;
+    } else if (const auto* array =
+                   std::get_if<soia::reflection::ArrayType>(unwrapped)) {
+      unwrapped = &*array->item;
+    } else {
+      break;
+    }
+  }
+  const auto* record_type =
+      std::get_if<soia::reflection::RecordType>(unwrapped);
+  if (record_type == nullptr) return nullptr;
+  const soia::reflection::Record* record =
+      records.find_or_null(record_type->record_id);
+  return record != nullptr &&
+                 record->kind == soia::reflection::RecordKind::kStruct
+             ? record
+             : nullptr;
+}
+}  // namespace
+
+void FieldMaskNode::AddPath(const soia::reflection::RecordRegistry& records,
+                            const soia::reflection::Type& type,
+                            const std::vector<std::string>& path) {
+  const soia::reflection::Record* absl_nullable record =
+      GetStructRecord(records, type);
+  ABSL_CHECK(record != nullptr) << "field mask of a type which is not a struct";
+  FieldMaskNode* node = this;
+  for (size_t i = 0; i < path.size(); ++i) {
+    const soia::reflection::Field* field = record->fields.find_or_null(path[i]);
+    ABSL_CHECK(field != nullptr)
+        << "no field '" << path[i] << "' in " << record->id;
+    const size_t number = field->number;
+    if (node->fields_.size() <= number) {
+      node->fields_.resize(number + 1);
+    }
+    Entry& entry = node->fields_[number];
+    if (entry.included && entry.child == nullptr) {
+      // The whole field is already included.
+      return;
+    }
+    entry.included = true;
+    const bool is_last = i + 1 == path.size();
+    record = is_last ? nullptr : GetStructRecord(records, *field->type);
+    if (record == nullptr) {
+      entry.child = nullptr;
+      return;
     }
-    return tokenizer.state().status;
+    if (entry.child == nullptr) {
+      entry.child = std::make_unique<FieldMaskNode>();
+    }
+    node = entry.child.get();
+  }
+}
+
+std::vector<int> GetFieldNumbers(
+    const soia::reflection::TypeDescriptor& type_descriptor,
+    const std::vector<absl::string_view>& field_names) {
+  const soia::reflection::Record* absl_nullable record =
+      GetStructRecord(type_descriptor.records, type_descriptor.type);
+  ABSL_CHECK(record != nullptr);
+  std::vector<int> result;
+  result.reserve(field_names.size());
+  for (const absl::string_view field_name : field_names) {
+    const soia::reflection::Field* field =
+        record->fields.find_or_null(std::string(field_name));
+    ABSL_CHECK(field != nullptr) << field_name;
+    result.push_back(field->number);
+  }
+  return result;
+}
+
+absl::Status RequestBody::Parse(
+    absl::string_view request_body,
+    soia::UnrecognizedFieldsPolicy unrecognized_fields) {
+  if (const char first_char = (request_body.empty() ? '\0' : request_body[0]);
+      first_char == '{' || first_char == ' ' || first_char == '\t' ||
+      first_char == '\r' || first_char == '\n') {
+    // A JSON object
+    envelope_tokenizer_ = std::make_unique<JsonTokenizer>(
+        request_body.begin(), request_body.end(), unrecognized_fields);
+    if (envelope_tokenizer_->Next() != JsonTokenType::kLeftCurlyBracket) {
+      return absl::InvalidArgumentError("expected: JSON object");
+    }
+    envelope_reader_ =
+        std::make_unique<JsonObjectReader>(envelope_tokenizer_.get());
+    return ReadEnvelope();
   } else {
     const std::vector<absl::string_view> parts =
         absl::StrSplit(request_body, absl::MaxSplits(':', 3));
@@ -2530,11 +3371,169 @@ absl::Status RequestBody::Parse(absl::string_view request_body) {
       return absl::InvalidArgumentError("can't parse method number");
     }
     readable = parts[2] == "readable";
+    binary = parts[2] == "binary";
     request_data = parts[3];
     return absl::OkStatus();
   }
 }
 
+absl::Status RequestBody::ReadEnvelope() {
+  JsonTokenizer& tokenizer = *envelope_tokenizer_;
+  while (envelope_reader_->NextEntry()) {
+    if (envelope_reader_->name() == "method" && !request_data_pending_) {
+      const JsonTokenType json_token_type = tokenizer.state().token_type;
+      if (json_token_type == JsonTokenType::kString) {
+        method_name = std::string(tokenizer.state().string_value());
+      } else if (json_token_type == JsonTokenType::kUnsignedInteger ||
+                 json_token_type == JsonTokenType::kSignedInteger) {
+        method_number =
+            tokenizer.state().token_type == JsonTokenType::kUnsignedInteger
+                ? tokenizer.state().uint_value
+                : tokenizer.state().int_value;
+      } else {
+        return absl::InvalidArgumentError(
+            "'method' field must be a string or an integer");
+      }
+      tokenizer.Next();
+    } else if (envelope_reader_->name() == "request" &&
+               !request_data_pending_ && !request_data_parsed_) {
+      const char* absl_nullable request_data_begin =
+          tokenizer.state().token_begin;
+      if (!method_name.empty() || method_number.has_value()) {
+        // The method is known: stop here so the request can be parsed
+        // directly from the tokenizer, without scanning it twice.
+        request_data_pending_ = true;
+        request_data = request_data_begin != nullptr
+                           ? absl::string_view(request_data_begin,
+                                               tokenizer.state().end -
+                                                   request_data_begin)
+                           : absl::string_view();
+        return tokenizer.state().status;
+      }
+      SkipValue(tokenizer);
+      const char* absl_nullable request_data_end =
+          tokenizer.state().token_begin;
+      request_data =
+          request_data_begin != nullptr && request_data_end != nullptr
+              ? absl::string_view(request_data_begin,
+                                  request_data_end - request_data_begin)
+              : absl::string_view();
+    } else {
+      SkipValue(tokenizer);
+    }
+  }
+  return tokenizer.state().status;
+}
+
+absl::Status RequestBody::FinishEnvelope() {
+  request_data_pending_ = false;
+  request_data_parsed_ = true;
+  return ReadEnvelope();
+}
+
+bool IsBinaryRequest(absl::string_view request_body) {
+  const std::vector<absl::string_view> parts =
+      absl::StrSplit(request_body, absl::MaxSplits(':', 3));
+  return parts.size() == 4 && parts[2] == "binary";
+}
+
+namespace {
+// Reads "<number>:" from the front of the input.
+bool ConsumeNumberAndColon(absl::string_view& input, size_t& number) {
+  const size_t colon = input.find(':');
+  if (colon == absl::string_view::npos ||
+      !absl::SimpleAtoi(input.substr(0, colon), &number)) {
+    return false;
+  }
+  input.remove_prefix(colon + 1);
+  return true;
+}
+
+// Reads "<length>:<data>" from the front of the input.
+bool ConsumeFrame(absl::string_view& input, absl::string_view& data) {
+  size_t length = 0;
+  if (!ConsumeNumberAndColon(input, length) || length > input.length()) {
+    return false;
+  }
+  data = input.substr(0, length);
+  input.remove_prefix(length);
+  return true;
+}
+}  // namespace
+
+std::string EncodeBatchRequest(const std::vector<std::string>& request_bodies) {
+  std::string result = "batch:";
+  for (const std::string& request_body : request_bodies) {
+    absl::StrAppend(&result, request_body.length(), ":", request_body);
+  }
+  return result;
+}
+
+absl::StatusOr<std::vector<absl::string_view>> ParseBatchRequest(
+    absl::string_view request_body) {
+  if (!absl::ConsumePrefix(&request_body, "batch:")) {
+    return absl::InvalidArgumentError("expected: batch");
+  }
+  std::vector<absl::string_view> result;
+  while (!request_body.empty()) {
+    if (!ConsumeFrame(request_body, result.emplace_back())) {
+      return absl::InvalidArgumentError("invalid batch format");
+    }
+  }
+  return result;
+}
+
+std::string EncodeBatchResponse(
+    const std::vector<soia::service::RawResponse>& responses) {
+  std::string result;
+  for (const soia::service::RawResponse& response : responses) {
+    absl::StrAppend(&result, response.status_code(), ":",
+                    response.data.length(), ":", response.data);
+  }
+  return result;
+}
+
+absl::StatusOr<std::vector<BatchItemResponse>> ParseBatchResponse(
+    absl::string_view response_data) {
+  std::vector<BatchItemResponse> result;
+  while (!response_data.empty()) {
+    BatchItemResponse& item = result.emplace_back();
+    size_t status_code = 0;
+    if (!ConsumeNumberAndColon(response_data, status_code) ||
+        !ConsumeFrame(response_data, item.data)) {
+      return absl::InvalidArgumentError("invalid batch response format");
+    }
+    item.status_code = static_cast<int>(status_code);
+  }
+  return result;
+}
+
+soia::service::RawResponse ReportMethodCall(
+    soia::service::ServiceObserver* absl_nullable observer,
+    soia::service::MethodCallStats stats,
+    soia::service::RawResponse raw_response) {
+  if (observer == nullptr) return raw_response;
+  stats.response_type = raw_response.type;
+  if (!raw_response.stream) {
+    stats.response_size = raw_response.data.size();
+    observer->OnMethodCall(stats);
+    return raw_response;
+  }
+  raw_response.stream =
+      [stream = std::move(raw_response.stream), observer,
+       stats](absl::FunctionRef<void(absl::string_view)> write) mutable {
+        const absl::Time start = absl::Now();
+        stats.response_size = 0;
+        stream([&](absl::string_view chunk) {
+          stats.response_size += chunk.size();
+          write(chunk);
+        });
+        stats.serialize_time += absl::Now() - start;
+        observer->OnMethodCall(stats);
+      };
+  return raw_response;
+}
+
 std::string MethodListToJson(const std::vector<MethodDescriptor>& methods) {
   std::string result = "{\n  \"methods\": [";
   for (size_t i = 0; i < methods.size(); ++i) {
@@ -2553,9 +3552,201 @@ std::string MethodListToJson(const std::vector<MethodDescriptor>& methods) {
   return result += methods.empty() ? "]\n}" : "\n  ]\n}";
 }
 
+FrameStatus ReadFrame(absl::string_view input, absl::string_view& record,
+                      size_t& frame_length) {
+  if (input.empty()) return FrameStatus::kIncomplete;
+  size_t prefix_length = 0;
+  switch (static_cast<uint8_t>(input[0])) {
+    case 232:
+      prefix_length = 3;
+      break;
+    case 233:
+      prefix_length = 5;
+      break;
+    case 234:
+      prefix_length = 9;
+      break;
+    default:
+      if (static_cast<uint8_t>(input[0]) >= 232) return FrameStatus::kError;
+      prefix_length = 1;
+  }
+  if (input.length() < prefix_length) return FrameStatus::kIncomplete;
+  ByteSource source(input.data(), prefix_length);
+  uint64_t record_length = 0;
+  Uint64Adapter::Parse(source, record_length);
+  if (source.error) return FrameStatus::kError;
+  if (input.length() - prefix_length < record_length) {
+    return FrameStatus::kIncomplete;
+  }
+  record = input.substr(prefix_length, record_length);
+  frame_length = prefix_length + record_length;
+  return FrameStatus::kOk;
+}
+
+namespace {
+absl::Status ErrnoError(absl::string_view operation, absl::string_view path) {
+  return absl::UnknownError(
+      absl::StrCat("error while trying to ", operation, " ", path, ": ",
+                   std::strerror(errno)));
+}
+}  // namespace
+
+#if defined(SOIA_HAVE_MMAP)
+
+absl::StatusOr<std::unique_ptr<MappedFile>> MappedFile::Open(
+    const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return ErrnoError("open", path);
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    const absl::Status status = ErrnoError("stat", path);
+    ::close(fd);
+    return status;
+  }
+  const size_t length = static_cast<size_t>(file_stat.st_size);
+  void* data = nullptr;
+  if (length != 0) {
+    data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      const absl::Status status = ErrnoError("mmap", path);
+      ::close(fd);
+      return status;
+    }
+  }
+  // The mapping stays valid after the file descriptor is closed.
+  ::close(fd);
+  return std::unique_ptr<MappedFile>(new MappedFile(data, length));
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(data_, length_);
+  }
+}
+
+#else
+
+// Without mmap, the whole file is read into memory.
+absl::StatusOr<std::unique_ptr<MappedFile>> MappedFile::Open(
+    const std::string& path) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) return ErrnoError("open", path);
+  long length = -1;
+  if (std::fseek(file, 0, SEEK_END) == 0) {
+    length = std::ftell(file);
+  }
+  if (length < 0 || std::fseek(file, 0, SEEK_SET) != 0) {
+    const absl::Status status = ErrnoError("seek", path);
+    std::fclose(file);
+    return status;
+  }
+  uint8_t* data = nullptr;
+  if (length != 0) {
+    data = new uint8_t[length];
+    if (std::fread(data, 1, length, file) != static_cast<size_t>(length)) {
+      const absl::Status status = ErrnoError("read", path);
+      delete[] data;
+      std::fclose(file);
+      return status;
+    }
+  }
+  std::fclose(file);
+  return std::unique_ptr<MappedFile>(new MappedFile(data, length));
+}
+
+MappedFile::~MappedFile() { delete[] static_cast<uint8_t*>(data_); }
+
+#endif
+
+absl::StatusOr<std::unique_ptr<FileSink>> FileSink::Open(
+    const std::string& path, bool append) {
+  std::FILE* file = std::fopen(path.c_str(), append ? "ab" : "wb");
+  if (file == nullptr) return ErrnoError("open", path);
+  uint64_t length = 0;
+  if (append) {
+    if (std::fseek(file, 0, SEEK_END) != 0) {
+      const absl::Status status = ErrnoError("seek", path);
+      std::fclose(file);
+      return status;
+    }
+    length = static_cast<uint64_t>(std::ftell(file));
+  }
+  return std::unique_ptr<FileSink>(new FileSink(file, path, length));
+}
+
+FileSink::~FileSink() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+  }
+}
+
+absl::Status FileSink::Append(absl::string_view bytes) {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("file is closed");
+  }
+  if (std::fwrite(bytes.data(), 1, bytes.length(), file_) != bytes.length()) {
+    return ErrnoError("write to", path_);
+  }
+  length_ += bytes.length();
+  return absl::OkStatus();
+}
+
+absl::Status FileSink::Flush() {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("file is closed");
+  }
+  if (std::fflush(file_) != 0) {
+    return ErrnoError("flush", path_);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileSink::Close() {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("file is closed");
+  }
+  const int result = std::fclose(file_);
+  file_ = nullptr;
+  if (result != 0) {
+    return ErrnoError("close", path_);
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace soia_internal
 
 namespace soia {
+
+void* Arena::AllocateInNewBlock(size_t size, size_t alignment) {
+  const size_t block_size = std::max(next_block_size_, size + alignment);
+  next_block_size_ = std::min(next_block_size_ * 2, kMaxBlockSize);
+  uint8_t* block = blocks_.emplace_back(new uint8_t[block_size]).get();
+  bytes_reserved_ += block_size;
+  pos_ = block;
+  end_ = block + block_size;
+  return Allocate(size, alignment);
+}
+
+void ThreadExecutor::RunAll(size_t num_tasks,
+                            absl::FunctionRef<void(size_t task_index)> task) {
+  std::atomic<size_t> next_task_index{0};
+  const auto run_tasks = [&]() {
+    for (size_t i = next_task_index++; i < num_tasks; i = next_task_index++) {
+      task(i);
+    }
+  };
+  const size_t num_threads = std::min<size_t>(num_threads_, num_tasks);
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(run_tasks);
+  }
+  run_tasks();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
 namespace reflection {
 
 std::string TypeDescriptor::AsJson() const {
@@ -2579,6 +3770,422 @@ absl::StatusOr<TypeDescriptor> TypeDescriptor::FromJson(
   return result;
 }
 
+class DynamicCodec::Compiler {
+ public:
+  Compiler(const TypeDescriptor& descriptor, DynamicCodec& codec)
+      : descriptor_(descriptor), codec_(codec) {}
+
+  // Returns the index of the op for the given type.
+  absl::StatusOr<uint32_t> Compile(const Type& type) {
+    const RecordType* record_type = std::get_if<RecordType>(&type);
+    if (record_type != nullptr) {
+      // Records can be recursive: compile each record only once.
+      const auto it = record_ops_.find(record_type->record_id);
+      if (it != record_ops_.cend()) return it->second;
+    }
+    const uint32_t index = codec_.ops_.size();
+    codec_.ops_.emplace_back();
+    codec_.types_.push_back(type);
+    if (const auto* primitive = std::get_if<PrimitiveType>(&type)) {
+      switch (*primitive) {
+        case PrimitiveType::kBool:
+          codec_.ops_[index].kind = OpKind::kBool;
+          break;
+        case PrimitiveType::kInt32:
+          codec_.ops_[index].kind = OpKind::kInt32;
+          break;
+        case PrimitiveType::kInt64:
+          codec_.ops_[index].kind = OpKind::kInt64;
+          break;
+        case PrimitiveType::kUint64:
+          codec_.ops_[index].kind = OpKind::kUint64;
+          break;
+        case PrimitiveType::kFloat32:
+          codec_.ops_[index].kind = OpKind::kFloat32;
+          break;
+        case PrimitiveType::kFloat64:
+          codec_.ops_[index].kind = OpKind::kFloat64;
+          break;
+        case PrimitiveType::kTimestamp:
+          codec_.ops_[index].kind = OpKind::kTimestamp;
+          break;
+        case PrimitiveType::kString:
+          codec_.ops_[index].kind = OpKind::kString;
+          break;
+        case PrimitiveType::kBytes:
+          codec_.ops_[index].kind = OpKind::kBytes;
+          break;
+      }
+      return index;
+    }
+    if (const auto* optional = std::get_if<OptionalType>(&type)) {
+      if (std::holds_alternative<OptionalType>(*optional->other)) {
+        return absl::InvalidArgumentError("optional of optional type");
+      }
+      const absl::StatusOr<uint32_t> item = Compile(*optional->other);
+      if (!item.ok()) return item.status();
+      codec_.ops_[index].kind = OpKind::kOptional;
+      codec_.ops_[index].item = *item;
+      return index;
+    }
+    if (const auto* array = std::get_if<ArrayType>(&type)) {
+      const absl::StatusOr<uint32_t> item = Compile(*array->item);
+      if (!item.ok()) return item.status();
+      codec_.ops_[index].kind = OpKind::kArray;
+      codec_.ops_[index].item = *item;
+      return index;
+    }
+    const Record* record =
+        descriptor_.records.find_or_null(record_type->record_id);
+    if (record == nullptr) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("record not found: ", record_type->record_id));
+    }
+    record_ops_[record->id] = index;
+    const absl::Status status = record->kind == RecordKind::kStruct
+                                    ? CompileStruct(*record, index)
+                                    : CompileEnum(*record, index);
+    if (!status.ok()) return status;
+    return index;
+  }
+
+ private:
+  absl::Status CompileStruct(const Record& record, uint32_t index) {
+    // Field numbers are dense: each slot is either a field or a removed
+    // number.
+    const size_t num_slots =
+        record.fields.size() + record.removed_numbers.size();
+    std::vector<Slot> slots(num_slots);
+    std::vector<bool> taken(num_slots);
+    for (const int number : record.removed_numbers) {
+      if (number < 0 || static_cast<size_t>(number) >= num_slots ||
+          taken[number]) {
+        return InvalidNumberError(record, number);
+      }
+      taken[number] = true;
+    }
+    for (const Field& field : record.fields) {
+      if (field.number < 0 || static_cast<size_t>(field.number) >= num_slots ||
+          taken[field.number]) {
+        return InvalidNumberError(record, field.number);
+      }
+      taken[field.number] = true;
+      if (!field.type.has_value()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "struct field has no type: ", record.id, ".", field.name));
+      }
+      const absl::StatusOr<uint32_t> op = Compile(*field.type);
+      if (!op.ok()) return op.status();
+      slots[field.number] = {field.name, field.number, int32_t(*op)};
+    }
+    AddSlots(std::move(slots), OpKind::kStruct, index);
+    return absl::OkStatus();
+  }
+
+  absl::Status CompileEnum(const Record& record, uint32_t index) {
+    std::vector<Slot> slots;
+    slots.reserve(record.fields.size());
+    for (const Field& field : record.fields) {
+      int32_t op = -1;
+      if (field.type.has_value()) {
+        const absl::StatusOr<uint32_t> value_op = Compile(*field.type);
+        if (!value_op.ok()) return value_op.status();
+        op = *value_op;
+      }
+      slots.push_back({field.name, field.number, op});
+    }
+    std::sort(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) {
+      return a.number < b.number;
+    });
+    for (size_t i = 1; i < slots.size(); ++i) {
+      if (slots[i].number == slots[i - 1].number) {
+        return InvalidNumberError(record, slots[i].number);
+      }
+    }
+    AddSlots(std::move(slots), OpKind::kEnum, index);
+    return absl::OkStatus();
+  }
+
+  // Appends the slots of a record once the types of its fields are compiled,
+  // so the slots of the record are contiguous.
+  void AddSlots(std::vector<Slot> slots, OpKind kind, uint32_t index) {
+    Op& op = codec_.ops_[index];
+    op.kind = kind;
+    op.slots_begin = codec_.slots_.size();
+    for (Slot& slot : slots) {
+      codec_.slots_.push_back(std::move(slot));
+    }
+    op.slots_end = codec_.slots_.size();
+  }
+
+  static absl::Status InvalidNumberError(const Record& record, int number) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("invalid field number in ", record.id, ": ", number));
+  }
+
+  const TypeDescriptor& descriptor_;
+  DynamicCodec& codec_;
+  absl::flat_hash_map<std::string, uint32_t> record_ops_;
+};
+
+absl::StatusOr<DynamicCodec> DynamicCodec::Create(
+    const TypeDescriptor& descriptor) {
+  DynamicCodec codec;
+  const absl::StatusOr<uint32_t> root =
+      Compiler(descriptor, codec).Compile(descriptor.type);
+  if (!root.ok()) return root.status();
+  codec.root_ = *root;
+  return codec;
+}
+
+namespace {
+
+template <typename T>
+void TranscodeToDenseJson(soia_internal::ByteSource& source,
+                          soia_internal::DenseJson& out) {
+  T value{};
+  soia_internal::Parse(source, value);
+  soia_internal::Append(value, out);
+}
+
+bool StartsWithBytesPrefix(absl::string_view bytes) {
+  return absl::StartsWith(bytes, "soia") || absl::StartsWith(bytes, "soir");
+}
+
+// Returns the source for reading a value encoded with the "soia" or the "soir"
+// prefix.
+soia_internal::ByteSource MakeByteSource(absl::string_view bytes) {
+  soia_internal::ByteSource source(bytes.data() + 4, bytes.length() - 4);
+  if (bytes[3] == 'r') {
+    source.string_refs_base = (const uint8_t*)bytes.data();
+  }
+  return source;
+}
+
+}  // namespace
+
+void DynamicCodec::AppendDenseJson(uint32_t op_index,
+                                   soia_internal::ByteSource& source,
+                                   soia_internal::DenseJson& out) const {
+  const Op& op = ops_[op_index];
+  switch (op.kind) {
+    case OpKind::kBool:
+      return TranscodeToDenseJson<bool>(source, out);
+    case OpKind::kInt32:
+      return TranscodeToDenseJson<int32_t>(source, out);
+    case OpKind::kInt64:
+      return TranscodeToDenseJson<int64_t>(source, out);
+    case OpKind::kUint64:
+      return TranscodeToDenseJson<uint64_t>(source, out);
+    case OpKind::kFloat32:
+      return TranscodeToDenseJson<float>(source, out);
+    case OpKind::kFloat64:
+      return TranscodeToDenseJson<double>(source, out);
+    case OpKind::kTimestamp:
+      return TranscodeToDenseJson<absl::Time>(source, out);
+    case OpKind::kString:
+      return TranscodeToDenseJson<std::string>(source, out);
+    case OpKind::kBytes:
+      return TranscodeToDenseJson<ByteString>(source, out);
+    case OpKind::kOptional: {
+      if (source.PeekWire() == 255) {
+        ++source.pos;
+        out.out += {'n', 'u', 'l', 'l'};
+      } else {
+        AppendDenseJson(op.item, source, out);
+      }
+      return;
+    }
+    case OpKind::kArray: {
+      uint32_t length = 0;
+      soia_internal::ParseArrayPrefix(source, length);
+      out.out += '[';
+      for (uint32_t i = 0; i < length && !source.error; ++i) {
+        if (i != 0) out.out += ',';
+        AppendDenseJson(op.item, source, out);
+      }
+      out.out += ']';
+      return;
+    }
+    case OpKind::kStruct: {
+      uint32_t array_len = 0;
+      soia_internal::ParseArrayPrefix(source, array_len);
+      const uint32_t num_slots = op.slots_end - op.slots_begin;
+      const uint32_t length = std::min(array_len, num_slots);
+      out.out += '[';
+      for (uint32_t i = 0; i < length && !source.error; ++i) {
+        if (i != 0) out.out += ',';
+        const Slot& slot = slots_[op.slots_begin + i];
+        if (slot.op < 0) {
+          soia_internal::SkipValue(source);
+          out.out += '0';
+        } else {
+          AppendDenseJson(slot.op, source, out);
+        }
+      }
+      out.out += ']';
+      if (array_len > length) {
+        soia_internal::SkipValues(source, array_len - length);
+      }
+      return;
+    }
+    case OpKind::kEnum: {
+      const auto [has_value, number] = soia_internal::ParseEnumPrefix(source);
+      const Slot* const begin = slots_.data() + op.slots_begin;
+      const Slot* const end = slots_.data() + op.slots_end;
+      const Slot* slot =
+          std::lower_bound(begin, end, number, [](const Slot& s, int32_t n) {
+            return s.number < n;
+          });
+      if (slot != end && slot->number != number) slot = end;
+      if (has_value) {
+        if (slot != end && slot->op >= 0) {
+          out.out += '[';
+          absl::StrAppend(&out.out, number);
+          out.out += ',';
+          AppendDenseJson(slot->op, source, out);
+          out.out += ']';
+        } else {
+          soia_internal::SkipValue(source);
+          out.out += '0';
+        }
+      } else if (slot != end && slot->op < 0) {
+        absl::StrAppend(&out.out, number);
+      } else {
+        out.out += '0';
+      }
+      return;
+    }
+  }
+}
+
+absl::StatusOr<std::string> DynamicCodec::BytesToDenseJson(
+    absl::string_view bytes) const {
+  if (!StartsWithBytesPrefix(bytes)) {
+    return absl::InvalidArgumentError("missing \"soia\" prefix");
+  }
+  soia_internal::ByteSource source = MakeByteSource(bytes);
+  soia_internal::DenseJson out;
+  AppendDenseJson(root_, source, out);
+  if (source.error || source.pos < source.end) {
+    return absl::UnknownError("error while decoding soia value from bytes");
+  }
+  return std::move(out.out);
+}
+
+absl::StatusOr<DynamicValue> DynamicCodec::GetField(
+    absl::string_view bytes, absl::string_view path) const {
+  if (!StartsWithBytesPrefix(bytes)) {
+    return absl::InvalidArgumentError("missing \"soia\" prefix");
+  }
+  soia_internal::ByteSource source = MakeByteSource(bytes);
+  uint32_t op_index = root_;
+  // Set once the path goes through a struct field missing from the input: the
+  // value is then the default value of its type.
+  bool is_default = false;
+  const std::vector<absl::string_view> names =
+      path.empty() ? std::vector<absl::string_view>()
+                   : absl::StrSplit(path, '.');
+  for (const absl::string_view name : names) {
+    const auto not_found = [&]() {
+      return absl::NotFoundError(
+          absl::StrCat("no value at ", name, " in path ", path));
+    };
+    if (ops_[op_index].kind == OpKind::kOptional) {
+      if (is_default || source.PeekWire() == 255) return not_found();
+      op_index = ops_[op_index].item;
+    }
+    const Op& op = ops_[op_index];
+    switch (op.kind) {
+      case OpKind::kStruct: {
+        const Slot* slot = nullptr;
+        for (uint32_t i = op.slots_begin; i < op.slots_end; ++i) {
+          if (slots_[i].op >= 0 && slots_[i].name == name) {
+            slot = &slots_[i];
+            break;
+          }
+        }
+        if (slot == nullptr) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("no field named ", name));
+        }
+        if (!is_default) {
+          uint32_t array_len = 0;
+          soia_internal::ParseArrayPrefix(source, array_len);
+          if (static_cast<uint32_t>(slot->number) < array_len) {
+            soia_internal::SkipValues(source, slot->number);
+          } else {
+            is_default = true;
+          }
+        }
+        op_index = slot->op;
+        break;
+      }
+      case OpKind::kEnum: {
+        const Slot* slot = nullptr;
+        for (uint32_t i = op.slots_begin; i < op.slots_end; ++i) {
+          if (slots_[i].op >= 0 && slots_[i].name == name) {
+            slot = &slots_[i];
+            break;
+          }
+        }
+        if (slot == nullptr) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("no wrapper field named ", name));
+        }
+        if (is_default) return not_found();
+        const auto [has_value, number] =
+            soia_internal::ParseEnumPrefix(source);
+        if (!has_value || number != slot->number) return not_found();
+        op_index = slot->op;
+        break;
+      }
+      case OpKind::kArray: {
+        uint32_t index = 0;
+        if (!absl::SimpleAtoi(name, &index)) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("not an array index: ", name));
+        }
+        if (is_default) return not_found();
+        uint32_t length = 0;
+        soia_internal::ParseArrayPrefix(source, length);
+        if (index >= length) return not_found();
+        soia_internal::SkipValues(source, index);
+        op_index = op.item;
+        break;
+      }
+      default:
+        return absl::InvalidArgumentError(
+            absl::StrCat("cannot read ", name, " in a primitive value"));
+    }
+    if (source.error) break;
+  }
+  absl::string_view value_bytes;
+  if (is_default) {
+    value_bytes = ops_[op_index].kind == OpKind::kOptional
+                      ? absl::string_view("\xff", 1)
+                      : absl::string_view("\0", 1);
+  } else {
+    const uint8_t* const begin = source.pos;
+    soia_internal::SkipValue(source);
+    value_bytes = absl::string_view((const char*)begin, source.pos - begin);
+  }
+  if (source.error) {
+    return absl::UnknownError("error while decoding soia value from bytes");
+  }
+  return DynamicValue(this, op_index, value_bytes, source.string_refs_base);
+}
+
+const Type& DynamicValue::type() const { return codec_->types_[op_]; }
+
+std::string DynamicValue::ToDenseJson() const {
+  soia_internal::ByteSource source(bytes_.data(), bytes_.length());
+  source.string_refs_base = string_refs_base_;
+  soia_internal::DenseJson out;
+  codec_->AppendDenseJson(op_, source, out);
+  return std::move(out.out);
+}
+
 }  // namespace reflection
 
 namespace service {
@@ -2645,5 +4252,33 @@ invalid_escape_sequence:
   return absl::InvalidArgumentError("Invalid escape sequence");
 }
 
+absl::Status RpcBatch::Send(const Client& client,
+                            const HttpHeaders& request_headers,
+                            HttpHeaders* absl_nullable response_headers) {
+  ABSL_CHECK(!sent_);
+  sent_ = true;
+  HttpHeaders response_headers_tmp;
+  absl::StatusOr<std::string> response_data =
+      client(soia_internal::EncodeBatchRequest(request_bodies_),
+             request_headers, response_headers_tmp);
+  if (response_headers != nullptr) {
+    *response_headers = std::move(response_headers_tmp);
+  }
+  if (!response_data.ok()) {
+    return std::move(response_data).status();
+  }
+  response_data_ = *std::move(response_data);
+  absl::StatusOr<std::vector<soia_internal::BatchItemResponse>> responses =
+      soia_internal::ParseBatchResponse(response_data_);
+  if (!responses.ok()) {
+    return std::move(responses).status();
+  }
+  if (responses->size() != request_bodies_.size()) {
+    return absl::UnknownError("wrong number of responses in batch");
+  }
+  responses_ = *std::move(responses);
+  return absl::OkStatus();
+}
+
 }  // namespace service
 }  // namespace soia
@@ -4,25 +4,36 @@
 #define SOIA_SOIA_H_VERSION 20251107
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <initializer_list>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include "absl/base/call_once.h"
 #include "absl/base/nullability.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
 #include "absl/hash/hash.h"
 #include "absl/log/absl_check.h"
 #include "absl/log/die_if_null.h"
@@ -36,8 +47,14 @@
 #include "absl/types/optional.h"
 
 namespace soia_internal {
+class ArenaScope;
 class ByteSink;
+struct ColumnsAdapter;
+class FieldMaskNode;
+struct FrozenAdapter;
+struct LazyAdapter;
 struct RecAdapter;
+struct SharedAdapter;
 
 template <typename T, typename Getter>
 using getter_value_type = std::remove_const_t<
@@ -53,6 +70,13 @@ namespace soia {
 // Always pick kDrop if the input JSON or binary string might come from a
 // malicious user.
 //
+// Both policies cost the same for structs without unrecognized fields. With
+// kKeep, each struct with unrecognized fields costs one heap allocation for the
+// fields, plus their copy: one more allocation when parsing binary, and the
+// conversion of every value to binary when parsing JSON. The unrecognized
+// fields are never allocated from the arena passed to soia::Parse, if any,
+// because they can outlive it.
+//
 // Default: kDrop
 enum class UnrecognizedFieldsPolicy { kDrop, kKeep };
 
@@ -146,12 +170,146 @@ H AbslHashValue(H h, const ByteString& byte_string) {
   return H::combine(std::move(h), byte_string.as_string());
 }
 
+// Bytes which point into the input they were parsed from instead of owning a
+// copy. This is the type of the bytes fields of the code generated with the
+// `views` option. The input must outlive the view.
+class ByteStringView {
+ public:
+  ByteStringView() = default;
+
+  ByteStringView(absl::string_view bytes) : bytes_(bytes) {}
+
+  absl::string_view as_string() const { return bytes_; }
+
+  size_t length() const { return bytes_.length(); }
+
+  bool empty() const { return bytes_.empty(); }
+
+  bool operator==(const ByteStringView& other) const {
+    return bytes_ == other.bytes_;
+  }
+  bool operator!=(const ByteStringView& other) const {
+    return bytes_ != other.bytes_;
+  }
+
+ private:
+  absl::string_view bytes_;
+};
+
+template <typename H>
+H AbslHashValue(H h, const ByteStringView& byte_string) {
+  return H::combine(std::move(h), byte_string.as_string());
+}
+
+// A memory pool from which the strings and vectors of a decoded value can be
+// allocated, and which frees everything in one shot when destroyed.
+// See soia::Parse(bytes_or_json, arena).
+//
+// Not thread-safe: use one arena per thread, e.g. one arena per request.
+class Arena {
+ public:
+  Arena() = default;
+  explicit Arena(size_t initial_block_size)
+      : next_block_size_(std::max<size_t>(initial_block_size, 64)) {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* absl_nonnull Allocate(size_t size, size_t alignment) {
+    const uintptr_t pos = reinterpret_cast<uintptr_t>(pos_);
+    const uintptr_t begin = (pos + alignment - 1) & ~(alignment - 1);
+    if (pos_ == nullptr || begin + size > reinterpret_cast<uintptr_t>(end_)) {
+      return AllocateInNewBlock(size, alignment);
+    }
+    pos_ = reinterpret_cast<uint8_t*>(begin + size);
+    return reinterpret_cast<void*>(begin);
+  }
+
+  // Number of bytes obtained from the heap so far.
+  size_t bytes_reserved() const { return bytes_reserved_; }
+
+ private:
+  static constexpr size_t kMaxBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+  uint8_t* absl_nullable pos_ = nullptr;
+  uint8_t* absl_nullable end_ = nullptr;
+  size_t next_block_size_ = 4096;
+  size_t bytes_reserved_ = 0;
+
+  void* absl_nonnull AllocateInNewBlock(size_t size, size_t alignment);
+
+  // The arena which soia::ArenaAllocator allocates from when default
+  // constructed, or null for the heap.
+  static Arena* absl_nullable& current() {
+    thread_local Arena* current = nullptr;
+    return current;
+  }
+
+  template <typename T>
+  friend class ArenaAllocator;
+  friend class ::soia_internal::ArenaScope;
+};
+
+// Allocates from the arena which is current when the allocator is constructed,
+// or from the heap if there is none. Memory allocated from an arena is only
+// freed when the arena is destroyed.
+//
+// A container copy-constructed from an arena-allocated container allocates
+// from the current arena (usually the heap), so copying a value is the way to
+// make it outlive its arena.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator() : arena_(Arena::current()) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* absl_nonnull allocate(size_t n) {
+    if (arena_ == nullptr) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* absl_nonnull p, size_t n) {
+    if (arena_ == nullptr) std::allocator<T>().deallocate(p, n);
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  Arena* absl_nullable arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return arena_ == other.arena();
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena* absl_nullable arena_;
+};
+
+// String and array types of the code generated with the `arena` option.
+using arena_string =
+    std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+template <typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
 template <typename T, typename GetKey>
-using key_type =
-    std::conditional_t<std::is_same<soia_internal::getter_value_type<T, GetKey>,
-                                    std::string>::value,
-                       absl::string_view,
-                       soia_internal::getter_value_type<T, GetKey>>;
+using key_type = std::conditional_t<
+    std::is_same<soia_internal::getter_value_type<T, GetKey>,
+                 std::string>::value ||
+        std::is_same<soia_internal::getter_value_type<T, GetKey>,
+                     arena_string>::value,
+    absl::string_view, soia_internal::getter_value_type<T, GetKey>>;
 
 // A vector-like container that stores items of type T and allows for fast
 // lookups by key using a hash table. The key is extracted from each item
@@ -163,7 +321,7 @@ using key_type =
 //   users.push_back({.id = 2, .name = "Bob"});
 //   const User* user = users.find_or_null(1);  // returns pointer to Alice
 //
-// If multiple items in the container have the same key, only the last one can
+// If multiple items in the container have the same key, only the first one can
 // be found when calling find_or_null() or find_or_default().
 //
 // Accessors, such as at(), operator[], front(), and back() all return constant
@@ -174,6 +332,10 @@ using key_type =
 // must not access the keyed_items. When the vector_mutator is destroyed, all
 // the items in the vector are rehashed, which runs in O(N).
 //
+// To modify a few items of a large keyed_items, prefer mutate_at(),
+// emplace_or_assign_by_key(), erase_at() and erase_by_key(), which only update
+// the hash table entries of the affected items.
+//
 // Example:
 //   keyed_items<User, soiagen::get_id> users;
 //   users.push_back({.id = 1, .name = "Alice"});
@@ -335,14 +497,14 @@ class keyed_items {
     std::swap(slot_type_, other.slot_type_);
   }
 
-  // Returns a pointer to the last item with the given key or nullptr if no such
-  // item exists.
+  // Returns a pointer to the first item with the given key or nullptr if no
+  // such item exists.
   template <typename K>
   const T* absl_nullable find_or_null(const K& key) const {
     return find_or_null_impl(key_type<T, GetKey>(key));
   }
 
-  // Returns the last item with the given key or a constant reference to a
+  // Returns the first item with the given key or a constant reference to a
   // zero-initialized T if no such item exists.
   //
   // In some cases, this can help you write more succint code than if you were
@@ -359,13 +521,80 @@ class keyed_items {
     return find_or_default_impl(key_type<T, GetKey>(key));
   }
 
-  // Returns the last item with the given key or default_value if no such item
+  // Returns the first item with the given key or default_value if no such item
   // exists.
   template <typename K>
   const T& find_or_default(const K& key, const T& default_value) const {
     return find_or_default_impl(key_type<T, GetKey>(key), default_value);
   }
 
+  // Calls f(item) with a mutable reference to the item at the given index, then
+  // updates the hash table if the key of the item has changed. Runs in O(1),
+  // without counting f. If f throws, the hash table is updated all the same.
+  template <typename F>
+  void mutate_at(size_t index, F&& f) {
+    ABSL_CHECK(!being_mutated_);
+    ABSL_CHECK_LT(index, vector_.size());
+    using key_type = key_type<T, GetKey>;
+    // Ends the mutation when destroyed, even if f throws after changing the
+    // key of the item.
+    struct MutationEnder {
+      keyed_items& items;
+      const size_t index;
+      const uint32_t old_key_hash;
+      ~MutationEnder() {
+        items.being_mutated_ = false;
+        items.UpdateSlot(index, old_key_hash);
+      }
+    };
+    const uint32_t old_key_hash =
+        absl::Hash<key_type>{}(GetKey()(vector_[index]));
+    const MutationEnder mutation_ender = {*this, index, old_key_hash};
+    being_mutated_ = true;
+    std::forward<F>(f)(vector_[index]);
+  }
+
+  // If an item with the same key as the given value exists, assigns the value
+  // to the first such item. Otherwise, adds the value at the end.
+  // Returns the assigned or added item.
+  const T& emplace_or_assign_by_key(T value) {
+    const T* absl_nullable existing =
+        find_or_null_impl(key_type<T, GetKey>(GetKey()(value)));
+    if (existing == nullptr) {
+      push_back(std::move(value));
+      return vector_.back();
+    }
+    // The key is unchanged: so is the hash table.
+    T& item = vector_[existing - vector_.data()];
+    item = std::move(value);
+    return item;
+  }
+
+  // Removes the item at the given index, preserving the order of the other
+  // items. Runs in O(N) like std::vector::erase, but does not rehash any key.
+  void erase_at(size_t index) {
+    ABSL_CHECK(!being_mutated_);
+    ABSL_CHECK_LT(index, vector_.size());
+    using key_type = key_type<T, GetKey>;
+    const uint32_t key_hash = absl::Hash<key_type>{}(GetKey()(vector_[index]));
+    WithSlotIntType([&](auto slot_int) {
+      using SlotIntType = decltype(slot_int);
+      RemoveSlot<SlotIntType>(key_hash, index + 1);
+      ShiftSlotsAfter<SlotIntType>(index);
+    });
+    vector_.erase(vector_.begin() + index);
+  }
+
+  // Removes the first item with the given key, if any. Returns true if an item
+  // was removed.
+  template <typename K>
+  bool erase_by_key(const K& key) {
+    const T* absl_nullable item = find_or_null_impl(key_type<T, GetKey>(key));
+    if (item == nullptr) return false;
+    erase_at(item - vector_.data());
+    return true;
+  }
+
   void sort_by_key() {
     ABSL_CHECK(!being_mutated_);
     std::sort(vector_.begin(), vector_.end(),
@@ -436,6 +665,19 @@ class keyed_items {
   SlotType slot_type_ = SlotType::kUint8;
   bool being_mutated_ = false;
 
+  // Moves the slot of the item at the given index if its key has changed.
+  void UpdateSlot(size_t index, uint32_t old_key_hash) {
+    using key_type = key_type<T, GetKey>;
+    const uint32_t new_key_hash =
+        absl::Hash<key_type>{}(GetKey()(vector_[index]));
+    if (new_key_hash == old_key_hash) return;
+    WithSlotIntType([&](auto slot_int) {
+      using SlotIntType = decltype(slot_int);
+      RemoveSlot<SlotIntType>(old_key_hash, index + 1);
+      InsertSlotInOrder<SlotIntType>(new_key_hash, index + 1);
+    });
+  }
+
   bool MaybeRehash() {
     const size_t capacity = vector_.capacity();
     const SlotType slot_type = GetSlotType(capacity);
@@ -465,6 +707,31 @@ class keyed_items {
     }
   }
 
+  // The hash table is stored in slots_bytes_. With N the number of slots, a
+  // power of two, the first N bytes are control bytes and the rest is an array
+  // of N integers of type SlotIntType.
+  // A zero control byte means the slot is empty. Otherwise, the control byte
+  // contains 7 bits of the key hash, and the slot contains the index of the
+  // item plus one. Lookups can skip most non-matching slots by only looking at
+  // the control bytes, without accessing the items.
+  template <typename SlotIntType>
+  struct Slots {
+    uint8_t* control;
+    SlotIntType* slots;
+    size_t mask;
+  };
+
+  template <typename SlotIntType>
+  Slots<SlotIntType> GetSlots() const {
+    const size_t num_slots = slots_bytes_.size() / (1 + sizeof(SlotIntType));
+    uint8_t* const data = const_cast<uint8_t*>(slots_bytes_.data());
+    return {data, (SlotIntType*)(data + num_slots), num_slots - 1};
+  }
+
+  static uint8_t GetControlByte(uint32_t key_hash) {
+    return static_cast<uint8_t>(key_hash >> 25) | 0x80;
+  }
+
   void PutSlot(uint32_t key_hash, size_t next_index, SlotType slot_type) {
     switch (slot_type) {
       case SlotType::kUint8:
@@ -484,17 +751,91 @@ class keyed_items {
 
   template <typename SlotIntType>
   void PutSlot(uint32_t key_hash, size_t next_index) {
-    const size_t num_slots = slots_bytes_.size() / sizeof(SlotIntType);
-    SlotIntType* slots = (SlotIntType*)slots_bytes_.data();
-    size_t slot_index = key_hash % num_slots;
-    while (true) {
-      SlotIntType& slot = slots[slot_index];
-      if (slot == 0) {
+    const Slots<SlotIntType> slots = GetSlots<SlotIntType>();
+    size_t slot_index = key_hash & slots.mask;
+    while (slots.control[slot_index] != 0) {
+      slot_index = (slot_index + 1) & slots.mask;
+    }
+    slots.control[slot_index] = GetControlByte(key_hash);
+    slots.slots[slot_index] = next_index;
+  }
+
+  // Calls f(SlotIntType()) with the integer type of the slots.
+  template <typename F>
+  void WithSlotIntType(F&& f) {
+    switch (slot_type_) {
+      case SlotType::kUint8:
+        return f(uint8_t());
+      case SlotType::kUint16:
+        return f(uint16_t());
+      case SlotType::kUint32:
+        return f(uint32_t());
+      case SlotType::kUint64:
+        return f(uint64_t());
+    }
+  }
+
+  // Removes the slot pointing to the given item, and moves back the slots
+  // which follow it in the probe sequence to fill the hole.
+  template <typename SlotIntType>
+  void RemoveSlot(uint32_t key_hash, size_t next_index) {
+    using key_type = key_type<T, GetKey>;
+    const Slots<SlotIntType> slots = GetSlots<SlotIntType>();
+    size_t hole = key_hash & slots.mask;
+    while (slots.control[hole] == 0 || slots.slots[hole] != next_index) {
+      hole = (hole + 1) & slots.mask;
+    }
+    for (size_t slot_index = hole;;) {
+      slot_index = (slot_index + 1) & slots.mask;
+      if (slots.control[slot_index] == 0) break;
+      const SlotIntType slot = slots.slots[slot_index];
+      const size_t home =
+          absl::Hash<key_type>{}(GetKey()(vector_[slot - 1])) & slots.mask;
+      // The slot can move to the hole unless its home position is cyclically
+      // in (hole, slot_index].
+      const bool home_after_hole =
+          hole <= slot_index ? hole < home && home <= slot_index
+                             : hole < home || home <= slot_index;
+      if (!home_after_hole) {
+        slots.control[hole] = slots.control[slot_index];
+        slots.slots[hole] = slot;
+        hole = slot_index;
+      }
+    }
+    slots.control[hole] = 0;
+    slots.slots[hole] = 0;
+  }
+
+  // Same as PutSlot, but if other items have the same key, keeps their slots
+  // ordered by index in the probe sequence, so the first item is found first.
+  template <typename SlotIntType>
+  void InsertSlotInOrder(uint32_t key_hash, size_t next_index) {
+    const Slots<SlotIntType> slots = GetSlots<SlotIntType>();
+    const uint8_t control_byte = GetControlByte(key_hash);
+    size_t slot_index = key_hash & slots.mask;
+    while (slots.control[slot_index] != 0) {
+      SlotIntType& slot = slots.slots[slot_index];
+      if (slots.control[slot_index] == control_byte && slot > next_index &&
+          GetKey()(vector_[slot - 1]) == GetKey()(vector_[next_index - 1])) {
+        // Continue with the item which comes later, which has the same hash.
+        const size_t displaced = slot;
         slot = next_index;
-        break;
+        next_index = displaced;
       }
-      if (++slot_index == num_slots) {
-        slot_index = 0;
+      slot_index = (slot_index + 1) & slots.mask;
+    }
+    slots.control[slot_index] = control_byte;
+    slots.slots[slot_index] = next_index;
+  }
+
+  // Decrements the slots pointing to items after the given index, after the
+  // item at the given index has been removed.
+  template <typename SlotIntType>
+  void ShiftSlotsAfter(size_t index) {
+    const Slots<SlotIntType> slots = GetSlots<SlotIntType>();
+    for (size_t i = 0; i <= slots.mask; ++i) {
+      if (slots.slots[i] > index + 1) {
+        --slots.slots[i];
       }
     }
   }
@@ -536,17 +877,17 @@ class keyed_items {
   template <typename SlotIntType, typename K>
   const T* absl_nullable FindOrNull(K key, uint32_t key_hash) const {
     static_assert(std::is_same_v<K, key_type<T, GetKey>>);
-    const size_t num_slots = slots_bytes_.size() / sizeof(SlotIntType);
-    SlotIntType* slots = (SlotIntType*)slots_bytes_.data();
-    size_t slot_index = key_hash % num_slots;
+    const Slots<SlotIntType> slots = GetSlots<SlotIntType>();
+    const uint8_t control_byte = GetControlByte(key_hash);
+    size_t slot_index = key_hash & slots.mask;
     while (true) {
-      const SlotIntType slot = slots[slot_index];
-      if (slot == 0) return nullptr;
-      const T& candidate = vector_[slot - 1];
-      if (GetKey()(candidate) == key) return &candidate;
-      if (++slot_index == num_slots) {
-        slot_index = 0;
+      const uint8_t control = slots.control[slot_index];
+      if (control == 0) return nullptr;
+      if (control == control_byte) {
+        const T& candidate = vector_[slots.slots[slot_index] - 1];
+        if (GetKey()(candidate) == key) return &candidate;
       }
+      slot_index = (slot_index + 1) & slots.mask;
     }
   }
 
@@ -578,22 +919,34 @@ class keyed_items {
 
   // Returns the new size of slots_bytes_ for the given vector_'s capactiy.
   static size_t GetNumSlotsBytes(size_t capacity, SlotType slot_type) {
-    constexpr int kNumSlotsPerItem = 2;
+    if (capacity == 0) return 0;
+    // One control byte plus the slot integer.
+    size_t num_bytes_per_slot;
     switch (slot_type) {
       case SlotType::kUint8:
-        return capacity * kNumSlotsPerItem;
+        num_bytes_per_slot = 2;
+        break;
       case SlotType::kUint16:
-        return capacity * kNumSlotsPerItem * 2;
+        num_bytes_per_slot = 3;
+        break;
       case SlotType::kUint32:
-        if (std::is_same_v<size_t, uint32_t> &&
-            capacity >
-                std::numeric_limits<uint32_t>::max() / (kNumSlotsPerItem * 4)) {
-          return std::numeric_limits<uint32_t>::max();
-        }
-        return capacity * kNumSlotsPerItem * 4;
+        num_bytes_per_slot = 5;
+        break;
       default:
-        return capacity * kNumSlotsPerItem * 8;
+        num_bytes_per_slot = 9;
+    }
+    // There are fewer than 4 slots per item. Make the allocation fail rather
+    // than wrap around, which could happen on 32-bit targets.
+    if (capacity >
+        std::numeric_limits<size_t>::max() / (4 * num_bytes_per_slot)) {
+      return std::numeric_limits<size_t>::max();
+    }
+    // At least 2 slots per item, rounded up to a power of two.
+    size_t num_slots = 2;
+    while (num_slots < capacity * 2) {
+      num_slots <<= 1;
     }
+    return num_slots * num_bytes_per_slot;
   }
 
   friend class vector_mutator;
@@ -699,6 +1052,275 @@ std::ostream& operator<<(std::ostream& os, const rec<T>& input) {
   return os << *input;
 }
 
+// A value of type T which is decoded the first time it is accessed.
+//
+// When a struct field of type lazy<T> is parsed, only the encoded bytes of the
+// value are recorded, and the work of decoding them is deferred until the
+// value is read or modified. A program which only reads a few fields of a
+// large struct, or which forwards the struct without looking inside, never
+// pays for decoding the other fields.
+//
+// If the value was parsed from the binary format with
+// UnrecognizedFieldsPolicy::kKeep and it has not been modified since, it is
+// serialized to the binary format by copying the encoded bytes through.
+//
+// Because decoding is deferred, an invalid encoded value, e.g. a string where T
+// expects an int, is not reported as an error by soia::Parse. Call decoded() to
+// get the error. The value of an invalid lazy<T> is the default value of T.
+//
+// Decoding on const access is thread-safe. As with any other type, modifying
+// the value while another thread reads it is not.
+template <typename T>
+class lazy {
+ public:
+  using value_type = T;
+
+  lazy() = default;
+  lazy(const lazy& other) : encoded_(other.encoded_) {
+    if (encoded_ != nullptr) {
+      decode_once_ = std::make_unique<absl::once_flag>();
+    } else {
+      if (other.value_ != nullptr) {
+        value_ = std::make_unique<T>(*other.value_);
+      }
+      status_ = other.status_;
+    }
+  }
+  lazy(lazy&& other) = default;
+  lazy(T value) : value_(std::make_unique<T>(std::move(value))) {}
+
+  const T& operator*() const {
+    DecodeIfNeeded();
+    if (value_ != nullptr) {
+      return *value_;
+    } else {
+      static const T* const default_value = new T();
+      return *default_value;
+    }
+  }
+
+  // The encoded bytes can no longer be trusted once the value is modified, so
+  // they are dropped, along with the error returned by decoded().
+  T& operator*() {
+    if (encoded_ != nullptr) {
+      DecodeIfNeeded();
+      encoded_ = nullptr;
+      decode_once_ = nullptr;
+      status_ = absl::OkStatus();
+    }
+    if (value_ != nullptr) {
+      return *value_;
+    } else {
+      return *(value_ = std::make_unique<T>());
+    }
+  }
+
+  operator const T&() const { return **this; }
+  operator T&() { return **this; }
+
+  const T* absl_nonnull operator->() const { return &(**this); }
+  T* absl_nonnull operator->() { return &(**this); }
+
+  lazy& operator=(const lazy& other) { return *this = lazy(other); }
+
+  lazy& operator=(lazy&& other) = default;
+
+  lazy& operator=(T other) {
+    encoded_ = nullptr;
+    decode_once_ = nullptr;
+    status_ = absl::OkStatus();
+    value_ = std::make_unique<T>(std::move(other));
+    return *this;
+  }
+
+  bool operator==(const lazy& other) const { return **this == *other; }
+  bool operator!=(const lazy& other) const { return !operator==(other); }
+
+  // Returns true if the value still holds the bytes it was parsed from, i.e.
+  // it was parsed and has not been modified since.
+  bool has_encoded_bytes() const { return encoded_ != nullptr; }
+
+  // Decodes the value if needed, and returns it, or an error if the bytes it
+  // was parsed from are invalid.
+  absl::StatusOr<const T* absl_nonnull> decoded() const {
+    DecodeIfNeeded();
+    if (!status_.ok()) return status_;
+    return &**this;
+  }
+
+ private:
+  struct Encoded {
+    // A slice of the input, either in binary format or in JSON format.
+    std::string bytes;
+    bool binary = false;
+    bool keep_unrecognized_fields = false;
+    absl::Status (*absl_nonnull decode)(const Encoded&, T&);
+  };
+
+  // Shared between copies, since it is never modified.
+  std::shared_ptr<const Encoded> encoded_;
+  // Null if encoded_ is null.
+  mutable std::unique_ptr<absl::once_flag> decode_once_;
+  mutable std::unique_ptr<T> value_;
+  // Error from decoding the encoded bytes.
+  mutable absl::Status status_;
+
+  void DecodeIfNeeded() const {
+    if (encoded_ == nullptr) return;
+    absl::call_once(*decode_once_, [this]() {
+      value_ = std::make_unique<T>();
+      status_ = encoded_->decode(*encoded_, *value_);
+      // Do not expose a partially decoded value.
+      if (!status_.ok()) *value_ = T();
+    });
+  }
+
+  friend struct ::soia_internal::LazyAdapter;
+};
+
+// A value of type T which copies share until one of them is modified.
+//
+// Copying a shared<T> is O(1): the copies point to the same heap-allocated T.
+// Calling the mutable operator*() or operator->() on a copy first gives it its
+// own deep copy of the value, unless it is the only owner of the value
+// ("copy-on-write"). This makes it cheap to hand out copies of large values,
+// like configuration trees, which the readers rarely modify.
+//
+// A reference obtained from the mutable operator*() must not be used to modify
+// the value after the shared<T> was copied, since the modification would be
+// visible to all the copies.
+//
+// As for rec<T>, calling operator*() on a zero-initialized const shared<T>
+// returns a constant reference to a static zero-initialized T.
+//
+// Different threads can read, copy and destroy copies of the same value. As
+// with any other type, modifying a shared<T> while another thread reads the
+// same shared<T> is not thread-safe.
+template <typename T>
+class shared {
+ public:
+  using value_type = T;
+
+  shared() = default;
+  shared(const shared& other) = default;
+  shared(shared&& other) = default;
+  shared(T value) : value_(std::make_shared<T>(std::move(value))) {}
+
+  const T& operator*() const {
+    if (value_ != nullptr) {
+      return *value_;
+    } else {
+      static const T* const default_value = new T();
+      return *default_value;
+    }
+  }
+
+  T& operator*() {
+    if (value_ == nullptr) {
+      value_ = std::make_shared<T>();
+    } else if (value_.use_count() != 1) {
+      value_ = std::make_shared<T>(*value_);
+    } else {
+      // The other owners may have released the value from other threads.
+      // Their reads must happen before our writes.
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *value_;
+  }
+
+  operator const T&() const { return **this; }
+  operator T&() { return **this; }
+
+  const T* absl_nonnull operator->() const { return &(**this); }
+  T* absl_nonnull operator->() { return &(**this); }
+
+  shared& operator=(const shared& other) = default;
+  shared& operator=(shared&& other) = default;
+
+  shared& operator=(T other) {
+    value_ = std::make_shared<T>(std::move(other));
+    return *this;
+  }
+
+  // Comparing two copies of the same value is O(1).
+  bool operator==(const shared& other) const {
+    return value_ == other.value_ || **this == *other;
+  }
+  bool operator!=(const shared& other) const { return !operator==(other); }
+
+  // Returns true if the value is shared with at least one other copy.
+  bool is_shared() const {
+    return value_ != nullptr && value_.use_count() != 1;
+  }
+
+ private:
+  std::shared_ptr<T> value_;
+
+  friend struct ::soia_internal::SharedAdapter;
+};
+
+// An immutable value of type T whose hash is computed once, on construction.
+//
+// Hashing a frozen<T> is O(1), which makes it a good key for a hash map keyed
+// by large soia values. Equality returns early if the two values are the same
+// object or if their hashes differ, and only compares the values otherwise.
+//
+// Copies share the same value, so copying a frozen<T> is also O(1). Call thaw()
+// to get a mutable copy of the value.
+template <typename T>
+class frozen {
+ public:
+  using value_type = T;
+
+  frozen() : value_(GetDefault()) {}
+  frozen(T value) : value_(std::make_shared<const Value>(std::move(value))) {}
+  frozen(const frozen& other) = default;
+  // Moving copies, so that the moved-from value stays valid. Copies are O(1).
+  frozen(frozen&& other) : value_(other.value_) {}
+
+  frozen& operator=(const frozen& other) = default;
+  frozen& operator=(frozen&& other) {
+    value_ = other.value_;
+    return *this;
+  }
+
+  const T& operator*() const { return value_->value; }
+  const T* absl_nonnull operator->() const { return &value_->value; }
+  operator const T&() const { return value_->value; }
+
+  // Returns the precomputed absl::Hash of the value.
+  size_t hash() const { return value_->hash; }
+
+  T thaw() const { return value_->value; }
+
+  bool operator==(const frozen& other) const {
+    return value_ == other.value_ ||
+           (value_->hash == other.value_->hash &&
+            value_->value == other.value_->value);
+  }
+  bool operator!=(const frozen& other) const { return !operator==(other); }
+
+ private:
+  struct Value {
+    explicit Value(T value)
+        : value(std::move(value)), hash(absl::Hash<T>()(this->value)) {}
+
+    const T value;
+    const size_t hash;
+  };
+
+  static const std::shared_ptr<const Value>& GetDefault() {
+    static const auto* const default_value =
+        new std::shared_ptr<const Value>(std::make_shared<const Value>(T()));
+    return *default_value;
+  }
+
+  // Never null.
+  std::shared_ptr<const Value> value_;
+
+  friend struct ::soia_internal::FrozenAdapter;
+};
+
 template <typename T>
 class must_init {
  public:
@@ -870,6 +1492,12 @@ enum class ResponseType {
   kOkJson,
   // The method invocation succeeded and the response data is in HTML format.
   kOkHtml,
+  // The method invocation succeeded and the response data is in soia's binary
+  // format, starting with "soia".
+  kOkBinary,
+  // The request was a batch of method invocations and the response data
+  // contains the response to each method invocation. See RpcBatch.
+  kOkBatch,
   // The method invocation failed because the request was malformed.
   // The response data is "bad-request:" followed by an error message.
   kBadRequest,
@@ -883,11 +1511,26 @@ struct RawResponse {
   // The meaning of this string depends on the response type.
   std::string data;
   ResponseType type{};
+  // If set, `data` is empty and the data is produced in chunks by calling this
+  // function. See StreamingOptions.
+  std::function<void(absl::FunctionRef<void(absl::string_view)>)> stream =
+      nullptr;
+
+  // Moves the data produced by `stream` into `data`.
+  void MaterializeStream() {
+    if (!stream) return;
+    stream([this](absl::string_view chunk) {
+      data.append(chunk.data(), chunk.size());
+    });
+    stream = nullptr;
+  }
 
   int status_code() const {
     switch (type) {
       case ResponseType::kOkJson:
       case ResponseType::kOkHtml:
+      case ResponseType::kOkBinary:
+      case ResponseType::kOkBatch:
         return 200;
       case ResponseType::kBadRequest:
         return 400;
@@ -906,6 +1549,12 @@ struct RawResponse {
         static const char kTextHtml[] = "text/html";
         return kTextHtml;
       }
+      case ResponseType::kOkBinary:
+      case ResponseType::kOkBatch: {
+        static const char kApplicationOctetStream[] =
+            "application/octet-stream";
+        return kApplicationOctetStream;
+      }
       case ResponseType::kBadRequest:
       case ResponseType::kServerError: {
         static const char kTextPlain[] = "text/plain; charset=utf-8";
@@ -915,9 +1564,12 @@ struct RawResponse {
   }
 
   absl::StatusOr<std::string> AsStatus() && {
+    MaterializeStream();
     switch (type) {
       case ResponseType::kOkJson:
       case ResponseType::kOkHtml:
+      case ResponseType::kOkBinary:
+      case ResponseType::kOkBatch:
         return std::move(data);
       case ResponseType::kBadRequest:
       case ResponseType::kServerError:
@@ -958,6 +1610,55 @@ class HttpHeaders {
   absl::flat_hash_map<std::string, std::vector<std::string>> map_;
 };
 
+// How a server sends large responses.
+struct StreamingOptions {
+  // If not zero, JSON responses are sent in chunks of about this many bytes
+  // while they are serialized, instead of being fully serialized first. This
+  // lowers the peak memory and the time to the first byte for large responses.
+  size_t chunk_size = 0;
+};
+
+// Metrics of one method invocation handled by HandleRequest.
+struct MethodCallStats {
+  // Empty if the request could not be parsed or if the service does not have
+  // the requested method.
+  absl::string_view method_name;
+  int method_number = 0;
+  // Time spent parsing the request body, running the method implementation
+  // and serializing the response. For an asynchronous method implementation,
+  // `handler_time` runs until the responder is called. For a streamed response,
+  // `serialize_time` includes the time spent writing the chunks.
+  absl::Duration parse_time;
+  absl::Duration handler_time;
+  absl::Duration serialize_time;
+  size_t request_size = 0;
+  size_t response_size = 0;
+  // Either kBadRequest, kServerError or one of the OK types.
+  ResponseType response_type{};
+};
+
+// Receives the metrics of the method invocations handled by a service, for
+// example to export them to a monitoring system.
+//
+// Requests for the method list or for RESTudio are not reported. Each method
+// invocation of a batch request is reported separately.
+class ServiceObserver {
+ public:
+  virtual ~ServiceObserver() = default;
+
+  // Called once per method invocation, after the response is serialized. Can
+  // be called concurrently from multiple threads.
+  virtual void OnMethodCall(const MethodCallStats& stats) = 0;
+};
+
+// Format of the request and response data of an RPC.
+enum class WireFormat {
+  kJson,
+  // Smaller and faster to encode and decode than JSON, but not human-readable.
+  // If the server does not support the binary format, it responds in JSON.
+  kBinary,
+};
+
 // Sends RPCs to a soia service.
 class Client {
  public:
@@ -966,8 +1667,30 @@ class Client {
   virtual absl::StatusOr<std::string> operator()(
       absl::string_view request_data, const HttpHeaders& request_headers,
       HttpHeaders& response_headers) const = 0;
+
+  // Sends the RPC and calls `done` with the response data and the response
+  // headers once the response is received, possibly from another thread.
+  // Implementations which do not block must copy the request data and the
+  // request headers.
+  //
+  // The default implementation calls operator() and then `done`.
+  virtual void SendAsync(
+      absl::string_view request_data, const HttpHeaders& request_headers,
+      absl::AnyInvocable<void(absl::StatusOr<std::string>, HttpHeaders) &&>
+          done) const {
+    HttpHeaders response_headers;
+    absl::StatusOr<std::string> response_data =
+        (*this)(request_data, request_headers, response_headers);
+    std::move(done)(std::move(response_data), std::move(response_headers));
+  }
 };
 
+// Passed to an asynchronous method implementation, which must call it exactly
+// once with the result of the method, possibly from another thread.
+// See HandleRequestAsync.
+template <typename Response>
+using Responder = absl::AnyInvocable<void(absl::StatusOr<Response>) &&>;
+
 }  // namespace service
 }  // namespace soia
 
@@ -985,14 +1708,34 @@ template <typename T>
 const T& get(const soia::rec<T>& input) {
   return *input;
 }
-
-template <typename Struct, typename Getter>
-using struct_field =
-    soia::reflection::struct_field<Getter, getter_value_type<Struct, Getter>>;
-
-template <typename Enum, typename Option>
-using enum_wrapper_field = soia::reflection::enum_wrapper_field<
-    Option, std::remove_const_t<std::remove_pointer_t<
+template <typename T>
+T& get(soia::lazy<T>& input) {
+  return *input;
+}
+template <typename T>
+const T& get(const soia::lazy<T>& input) {
+  return *input;
+}
+template <typename T>
+T& get(soia::shared<T>& input) {
+  return *input;
+}
+template <typename T>
+const T& get(const soia::shared<T>& input) {
+  return *input;
+}
+template <typename T>
+const T& get(const soia::frozen<T>& input) {
+  return *input;
+}
+
+template <typename Struct, typename Getter>
+using struct_field =
+    soia::reflection::struct_field<Getter, getter_value_type<Struct, Getter>>;
+
+template <typename Enum, typename Option>
+using enum_wrapper_field = soia::reflection::enum_wrapper_field<
+    Option, std::remove_const_t<std::remove_pointer_t<
                 decltype(Option::get_or_null(std::declval<Enum&>()))>>>;
 
 struct NewLine {
@@ -1013,23 +1756,51 @@ struct NewLine {
   std::string new_line_ = "\n";
 };
 
+// Receives JSON in chunks while it is serialized. See soia::WriteDenseJson.
+struct JsonChunkWriter {
+  size_t chunk_size = 0;
+  absl::FunctionRef<void(absl::string_view)> write;
+};
+
 struct DenseJson {
   std::string out;
+  // If not null, array adapters pass `out` to it and clear `out` between two
+  // items once `out` reaches the chunk size.
+  const JsonChunkWriter* absl_nullable chunk_writer = nullptr;
 };
 
 struct ReadableJson {
   std::string out;
   NewLine new_line;
+  // Same as DenseJson::chunk_writer.
+  const JsonChunkWriter* absl_nullable chunk_writer = nullptr;
 };
 
+template <typename Json>
+void MaybeWriteChunk(Json& out) {
+  if (out.chunk_writer != nullptr &&
+      out.out.length() >= out.chunk_writer->chunk_size) {
+    out.chunk_writer->write(out.out);
+    out.out.clear();
+  }
+}
+
 struct DebugString {
   std::string out;
   NewLine new_line;
 };
 
+// Maps the strings written to a ByteSink to the offset of their first
+// occurrence. See ByteSink::set_string_refs.
+using StringRefs = absl::flat_hash_map<std::string, size_t>;
+
 class ByteSink {
  public:
   ByteSink() = default;
+  explicit ByteSink(size_t capacity)
+      : capacity_(std::max<size_t>(capacity, 1)),
+        data_(new uint8_t[capacity_]),
+        pos_(data_) {}
   ByteSink(const ByteSink&) = delete;
   ByteSink(ByteSink&&) = delete;
 
@@ -1101,6 +1872,18 @@ class ByteSink {
 
   void PopN(size_t n) { pos_ -= n; }
 
+  // Discards the contents of the byte sink but keeps its capacity.
+  void Clear() { pos_ = data_; }
+
+  // If not null, strings appended to the byte sink are recorded in
+  // `string_refs`, and a string which was already appended is written as a
+  // reference to its first occurrence when that is shorter.
+  // See soia::ToBytesWithStringRefs.
+  void set_string_refs(StringRefs* absl_nullable string_refs) {
+    string_refs_ = string_refs;
+  }
+  StringRefs* absl_nullable string_refs() const { return string_refs_; }
+
   ::soia::ByteString ToByteString() && {
     ::soia::ByteString byte_string(data_, length());
     // To prevent the ByteString destructor from deleting the array.
@@ -1113,10 +1896,29 @@ class ByteSink {
   size_t capacity_ = kDefaultCapacity;
   uint8_t* absl_nonnull data_ = new uint8_t[kDefaultCapacity];
   uint8_t* absl_nonnull pos_ = data_;
+  StringRefs* absl_nullable string_refs_ = nullptr;
 
   size_t capacity_left() const { return capacity_ - length(); }
 };
 
+// Counts the bytes that appending a value to a ByteSink would write, without
+// writing anything. Every Append(const T&, ByteSink&) has a ByteCounter
+// overload with the same structure, so the count is exact.
+class ByteCounter {
+ public:
+  size_t length() const { return length_; }
+
+  template <typename... Bytes>
+  void Push(uint8_t, Bytes... tail) {
+    length_ += 1 + sizeof...(tail);
+  }
+
+  void Add(size_t n) { length_ += n; }
+
+ private:
+  size_t length_ = 0;
+};
+
 struct ByteSource {
   ByteSource(const uint8_t* absl_nonnull begin, size_t length)
       : pos(begin), end(begin + length) {}
@@ -1127,6 +1929,13 @@ struct ByteSource {
   const uint8_t* absl_nonnull const end;
   bool keep_unrecognized_fields = false;
   bool error = false;
+  // Fields of the struct being parsed which must be parsed, or nullptr if
+  // all the fields must be parsed.
+  const FieldMaskNode* absl_nullable field_mask = nullptr;
+  // If the input was written by soia::ToBytesWithStringRefs, points to the
+  // beginning of the input, from which the offsets of string references are
+  // measured. Otherwise, string references are invalid.
+  const uint8_t* absl_nullable string_refs_base = nullptr;
 
   size_t num_bytes_left() const { return end - pos; }
 
@@ -1217,7 +2026,27 @@ class JsonTokenizer {
     int64_t int_value = 0;
     uint64_t uint_value = 0;
     double float_value = 0.0;
-    std::string string_value;
+    // If the last string token needed no decoding, i.e. it has no escape
+    // sequence and no non-ASCII-7 char, its value is borrowed from the JSON
+    // code. Otherwise it is decoded into string_buffer, which is reused from
+    // one token to the next.
+    absl::string_view borrowed_string_value;
+    std::string string_buffer;
+    bool string_value_in_buffer = false;
+    // Fields of the struct being parsed which must be parsed, or nullptr if
+    // all the fields must be parsed.
+    const FieldMaskNode* absl_nullable field_mask = nullptr;
+
+    // Value of the last string token. Invalidated when the next string token
+    // is read.
+    absl::string_view string_value() const {
+      return string_value_in_buffer ? absl::string_view(string_buffer)
+                                    : borrowed_string_value;
+    }
+
+    // Returns the value of the last string token, moving it out of the buffer
+    // if possible.
+    std::string TakeStringValue();
 
     size_t chars_left() const { return end - pos; }
 
@@ -1270,20 +2099,59 @@ class JsonObjectReader {
 
   // Name component of the current entry.
   // Invalidated when NextEntry() is called.
-  const std::string& name() const { return name_; }
+  absl::string_view name() const { return name_; }
 
  private:
   JsonTokenizer& tokenizer_;
-  std::string name_;
+  absl::string_view name_;
+  // Only used if the name needed decoding.
+  std::string name_buffer_;
   bool zero_state_ = true;
 };
 
 void SkipValue(ByteSource& source);
 
 void AppendArrayPrefix(size_t length, ByteSink& out);
+void AppendArrayPrefix(size_t length, ByteCounter& out);
 
 void ParseArrayPrefix(ByteSource& source, uint32_t& length);
 
+// Bulk kernels for arrays of numbers. They produce and accept exactly the same
+// bytes as encoding or decoding each number with its adapter, but the output
+// is prepared once for the whole array and the per-number code is inlined.
+void AppendNumbers(const int32_t* absl_nullable begin, size_t n,
+                   ByteSink& out);
+void AppendNumbers(const int64_t* absl_nullable begin, size_t n,
+                   ByteSink& out);
+void AppendNumbers(const uint64_t* absl_nullable begin, size_t n,
+                   ByteSink& out);
+void AppendNumbers(const float* absl_nullable begin, size_t n, ByteSink& out);
+void AppendNumbers(const double* absl_nullable begin, size_t n, ByteSink& out);
+void AppendNumbers(const int32_t* absl_nullable begin, size_t n,
+                   ByteCounter& out);
+void AppendNumbers(const int64_t* absl_nullable begin, size_t n,
+                   ByteCounter& out);
+void AppendNumbers(const uint64_t* absl_nullable begin, size_t n,
+                   ByteCounter& out);
+void AppendNumbers(const float* absl_nullable begin, size_t n,
+                   ByteCounter& out);
+void AppendNumbers(const double* absl_nullable begin, size_t n,
+                   ByteCounter& out);
+// Parses n numbers. The n numbers pointed to by out must be zero.
+void ParseNumbers(ByteSource& source, size_t n, int32_t* absl_nullable out);
+void ParseNumbers(ByteSource& source, size_t n, int64_t* absl_nullable out);
+void ParseNumbers(ByteSource& source, size_t n, uint64_t* absl_nullable out);
+void ParseNumbers(ByteSource& source, size_t n, float* absl_nullable out);
+void ParseNumbers(ByteSource& source, size_t n, double* absl_nullable out);
+
+// True if AppendNumbers and ParseNumbers accept arrays of T.
+template <typename T>
+constexpr bool HasNumberKernels() {
+  return std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t> ||
+         std::is_same_v<T, uint64_t> || std::is_same_v<T, float> ||
+         std::is_same_v<T, double>;
+}
+
 template <typename T>
 struct soia_type {};
 
@@ -1303,6 +2171,7 @@ struct BoolAdapter {
   }
 
   static void Append(bool input, ByteSink& out) { out.Push(input ? 1 : 0); }
+  static void Append(bool, ByteCounter& out) { out.Add(1); }
 
   static void Parse(JsonTokenizer& tokenizer, bool& out);
 
@@ -1337,6 +2206,7 @@ struct Int32Adapter {
   }
 
   static void Append(int32_t input, ByteSink& out);
+  static void Append(int32_t input, ByteCounter& out);
 
   static void Parse(JsonTokenizer& tokenizer, int32_t& out);
   static void Parse(ByteSource& source, int32_t& out);
@@ -1375,6 +2245,7 @@ struct Int64Adapter {
   }
 
   static void Append(int64_t input, ByteSink& out);
+  static void Append(int64_t input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, int64_t& out);
   static void Parse(ByteSource& source, int64_t& out);
 
@@ -1408,6 +2279,7 @@ struct Uint64Adapter {
   }
 
   static void Append(uint64_t input, ByteSink& out);
+  static void Append(uint64_t input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, uint64_t& out);
   static void Parse(ByteSource& source, uint64_t& out);
 
@@ -1460,6 +2332,7 @@ struct Float32Adapter {
   }
 
   static void Append(float input, ByteSink& out);
+  static void Append(float input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, float& out);
   static void Parse(ByteSource& source, float& out);
 
@@ -1497,6 +2370,7 @@ struct Float64Adapter {
   }
 
   static void Append(double input, ByteSink& out);
+  static void Append(double input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, double& out);
   static void Parse(ByteSource& source, double& out);
 
@@ -1518,6 +2392,7 @@ struct TimestampAdapter {
   static void Append(absl::Time input, ReadableJson& out);
   static void Append(absl::Time input, DebugString& out);
   static void Append(absl::Time input, ByteSink& out);
+  static void Append(absl::Time input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, absl::Time& out);
   static void Parse(ByteSource& source, absl::Time& out);
 
@@ -1543,6 +2418,7 @@ struct StringAdapter {
   static void AppendJson(const std::string& input, std::string& out);
   static void Append(const std::string& input, DebugString& out);
   static void Append(const std::string& input, ByteSink& out);
+  static void Append(const std::string& input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, std::string& out);
   static void Parse(ByteSource& source, std::string& out);
 
@@ -1564,6 +2440,7 @@ struct BytesAdapter {
   static void Append(const soia::ByteString&, ReadableJson& out);
   static void Append(const soia::ByteString& input, DebugString& out);
   static void Append(const soia::ByteString& input, ByteSink& out);
+  static void Append(const soia::ByteString& input, ByteCounter& out);
   static void Parse(JsonTokenizer& tokenizer, soia::ByteString& out);
   static void Parse(ByteSource& source, soia::ByteString& out);
 
@@ -1578,6 +2455,91 @@ struct BytesAdapter {
   static constexpr bool IsEnum() { return false; }
 };
 
+struct ArenaStringAdapter {
+  static bool IsDefault(const soia::arena_string& input) {
+    return input.empty();
+  }
+
+  template <typename Out>
+  static void Append(const soia::arena_string& input, Out& out) {
+    AppendJson(input, out.out);
+  }
+
+  static void AppendJson(const soia::arena_string& input, std::string& out);
+  static void Append(const soia::arena_string& input, DebugString& out);
+  static void Append(const soia::arena_string& input, ByteSink& out);
+  static void Append(const soia::arena_string& input, ByteCounter& out);
+  static void Parse(JsonTokenizer& tokenizer, soia::arena_string& out);
+  static void Parse(ByteSource& source, soia::arena_string& out);
+
+  static soia::reflection::Type GetType(soia_type<soia::arena_string>) {
+    return soia::reflection::PrimitiveType::kString;
+  }
+
+  static void RegisterRecords(soia_type<soia::arena_string>,
+                              soia::reflection::RecordRegistry&) {}
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+};
+
+// Adapter for absl::string_view, a string which points into the input it was
+// parsed from instead of owning a copy, e.g. the string fields of the code
+// generated with the `views` option, or the items of
+// soia::Parse<std::vector<absl::string_view>>(bytes). The input must outlive
+// the views. Can only be parsed from string values in binary format.
+struct StringViewAdapter {
+  static bool IsDefault(absl::string_view input) { return input.empty(); }
+
+  template <typename Out>
+  static void Append(absl::string_view input, Out& out) {
+    AppendJson(input, out.out);
+  }
+
+  static void AppendJson(absl::string_view input, std::string& out);
+  static void Append(absl::string_view input, DebugString& out);
+  static void Append(absl::string_view input, ByteSink& out);
+  static void Append(absl::string_view input, ByteCounter& out);
+  static void Parse(JsonTokenizer& tokenizer, absl::string_view& out);
+  static void Parse(ByteSource& source, absl::string_view& out);
+
+  static soia::reflection::Type GetType(soia_type<absl::string_view>) {
+    return soia::reflection::PrimitiveType::kString;
+  }
+
+  static void RegisterRecords(soia_type<absl::string_view>,
+                              soia::reflection::RecordRegistry&) {}
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+};
+
+// Adapter for soia::ByteStringView. Can only be parsed from bytes values in
+// binary format.
+struct BytesViewAdapter {
+  static bool IsDefault(const soia::ByteStringView& input) {
+    return input.empty();
+  }
+
+  static void Append(const soia::ByteStringView& input, DenseJson& out);
+  static void Append(const soia::ByteStringView& input, ReadableJson& out);
+  static void Append(const soia::ByteStringView& input, DebugString& out);
+  static void Append(const soia::ByteStringView& input, ByteSink& out);
+  static void Append(const soia::ByteStringView& input, ByteCounter& out);
+  static void Parse(JsonTokenizer& tokenizer, soia::ByteStringView& out);
+  static void Parse(ByteSource& source, soia::ByteStringView& out);
+
+  static soia::reflection::Type GetType(soia_type<soia::ByteStringView>) {
+    return soia::reflection::PrimitiveType::kBytes;
+  }
+
+  static void RegisterRecords(soia_type<soia::ByteStringView>,
+                              soia::reflection::RecordRegistry&) {}
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+};
+
 template <typename T>
 void GetAdapter(soia_type<T>) {
   static_assert(false, "not a soia type");
@@ -1592,6 +2554,9 @@ inline Float64Adapter GetAdapter(soia_type<double>);
 inline TimestampAdapter GetAdapter(soia_type<absl::Time>);
 inline StringAdapter GetAdapter(soia_type<std::string>);
 inline BytesAdapter GetAdapter(soia_type<soia::ByteString>);
+inline StringViewAdapter GetAdapter(soia_type<absl::string_view>);
+inline BytesViewAdapter GetAdapter(soia_type<soia::ByteStringView>);
+inline ArenaStringAdapter GetAdapter(soia_type<soia::arena_string>);
 
 // =============================================================================
 // BEGIN serialization of type descriptors
@@ -1775,6 +2740,15 @@ struct OptionalAdapter {
     }
   }
 
+  template <typename T>
+  static void Append(const absl::optional<T>& input, ByteCounter& out) {
+    if (input.has_value()) {
+      TypeAdapter<T>::Append(*input, out);
+    } else {
+      out.Push(255);
+    }
+  }
+
   template <typename T>
   static void Parse(JsonTokenizer& tokenizer, absl::optional<T>& out) {
     if (tokenizer.state().token_type == JsonTokenType::kNull) {
@@ -1835,6 +2809,7 @@ struct ArrayAdapter {
       out.out += '[';
       TypeAdapter<T>::Append(input[0], out);
       for (size_t i = 1; i < input.size(); ++i) {
+        MaybeWriteChunk(out);
         out.out += ',';
         TypeAdapter<T>::Append(input[i], out);
       }
@@ -1852,6 +2827,7 @@ struct ArrayAdapter {
       out.out += out.new_line.Indent();
       TypeAdapter<T>::Append(input[0], out);
       for (size_t i = 1; i < input.size(); ++i) {
+        MaybeWriteChunk(out);
         out.out += ',';
         out.out += *out.new_line;
         TypeAdapter<T>::Append(input[i], out);
@@ -1883,8 +2859,25 @@ struct ArrayAdapter {
   static void Append(const Input& input, ByteSink& out) {
     using T = typename Input::value_type;
     AppendArrayPrefix(input.size(), out);
-    for (const T& item : input) {
-      TypeAdapter<T>::Append(item, out);
+    if constexpr (HasNumberKernels<T>()) {
+      AppendNumbers(input.data(), input.size(), out);
+    } else {
+      for (const T& item : input) {
+        TypeAdapter<T>::Append(item, out);
+      }
+    }
+  }
+
+  template <typename Input>
+  static void Append(const Input& input, ByteCounter& out) {
+    using T = typename Input::value_type;
+    AppendArrayPrefix(input.size(), out);
+    if constexpr (HasNumberKernels<T>()) {
+      AppendNumbers(input.data(), input.size(), out);
+    } else {
+      for (const T& item : input) {
+        TypeAdapter<T>::Append(item, out);
+      }
     }
   }
 
@@ -1912,15 +2905,22 @@ struct ArrayAdapter {
     if (source.num_bytes_left() < length) {
       return source.RaiseError();
     };
-    out.reserve(length);
-    for (size_t i = 0; i < length; ++i) {
-      if (source.error) return;
-      ParseAndPush(source, out);
+    using T = typename Out::value_type;
+    if constexpr (HasNumberKernels<T>()) {
+      const size_t offset = out.size();
+      out.resize(offset + length);
+      ParseNumbers(source, length, out.data() + offset);
+    } else {
+      out.reserve(length);
+      for (size_t i = 0; i < length; ++i) {
+        if (source.error) return;
+        ParseAndPush(source, out);
+      }
     }
   }
 
-  template <typename T>
-  static soia::reflection::Type GetType(soia_type<std::vector<T>>) {
+  template <typename T, typename Alloc>
+  static soia::reflection::Type GetType(soia_type<std::vector<T, Alloc>>) {
     return soia::reflection::ArrayType{soia_internal::GetType<T>()};
   }
 
@@ -1943,15 +2943,15 @@ struct ArrayAdapter {
   static constexpr bool IsEnum() { return false; }
 
  private:
-  template <typename Source>
-  static void ParseAndPush(Source& source, std::vector<bool>& out) {
+  template <typename Source, typename Alloc>
+  static void ParseAndPush(Source& source, std::vector<bool, Alloc>& out) {
     bool item{};
     BoolAdapter::Parse(source, item);
     out.push_back(item);
   }
 
-  template <typename Source, typename T>
-  static void ParseAndPush(Source& source, std::vector<T>& out) {
+  template <typename Source, typename T, typename Alloc>
+  static void ParseAndPush(Source& source, std::vector<T, Alloc>& out) {
     T& item = out.emplace_back();
     TypeAdapter<T>::Parse(source, item);
   }
@@ -1964,8 +2964,8 @@ struct ArrayAdapter {
   }
 };
 
-template <typename T>
-inline ArrayAdapter GetAdapter(soia_type<std::vector<T>>);
+template <typename T, typename Alloc>
+inline ArrayAdapter GetAdapter(soia_type<std::vector<T, Alloc>>);
 
 template <typename T, typename GetKey>
 inline ArrayAdapter GetAdapter(soia_type<soia::keyed_items<T, GetKey>>);
@@ -2012,6 +3012,15 @@ struct RecAdapter {
     }
   }
 
+  template <typename T>
+  static void Append(const soia::rec<T>& input, ByteCounter& out) {
+    if (input.value_ == nullptr) {
+      out.Push(246);
+    } else {
+      TypeAdapter<T>::Append(*input, out);
+    }
+  }
+
   template <typename T>
   static void Parse(JsonTokenizer& tokenizer, soia::rec<T>& out) {
     TypeAdapter<T>::Parse(tokenizer, *out);
@@ -2040,6 +3049,237 @@ struct RecAdapter {
 template <typename T>
 inline RecAdapter GetAdapter(soia_type<soia::rec<T>>);
 
+struct LazyAdapter {
+  template <typename T>
+  static bool IsDefault(const soia::lazy<T>& input) {
+    if (input.encoded_ != nullptr && input.encoded_->binary) {
+      // Compare the encoded bytes with the encoding of the default value to
+      // avoid decoding the value.
+      if (input.encoded_->bytes == GetDefaultBytes<T>()) return true;
+      // If the bytes are copied through, a default value in a non-canonical
+      // encoding is written explicitly, which is still a valid encoding.
+      if (CanCopyBytes(input)) return false;
+    }
+    return TypeAdapter<T>::IsDefault(*input);
+  }
+
+  template <typename T>
+  static void Append(const soia::lazy<T>& input, DenseJson& out) {
+    TypeAdapter<T>::Append(*input, out);
+  }
+
+  template <typename T>
+  static void Append(const soia::lazy<T>& input, ReadableJson& out) {
+    TypeAdapter<T>::Append(*input, out);
+  }
+
+  template <typename T>
+  static void Append(const soia::lazy<T>& input, DebugString& out) {
+    TypeAdapter<T>::Append(*input, out);
+  }
+
+  template <typename T>
+  static void Append(const soia::lazy<T>& input, ByteSink& out) {
+    if (CanCopyBytes(input)) {
+      const std::string& bytes = input.encoded_->bytes;
+      out.PushN((const uint8_t*)bytes.data(), bytes.length());
+    } else {
+      TypeAdapter<T>::Append(*input, out);
+    }
+  }
+
+  template <typename T>
+  static void Append(const soia::lazy<T>& input, ByteCounter& out) {
+    if (CanCopyBytes(input)) {
+      out.Add(input.encoded_->bytes.length());
+    } else {
+      TypeAdapter<T>::Append(*input, out);
+    }
+  }
+
+  template <typename T>
+  static void Parse(JsonTokenizer& tokenizer, soia::lazy<T>& out) {
+    const char* absl_nullable begin = tokenizer.state().token_begin;
+    SkipValue(tokenizer);
+    const JsonTokenizer::State& state = tokenizer.state();
+    if (!state.status.ok()) return;
+    // The tokenizer has read the token which follows the value.
+    const char* absl_nullable end =
+        state.token_type == JsonTokenType::kStrEnd ? state.pos
+                                                   : state.token_begin;
+    SetEncoded(std::string(begin, end - begin), false,
+               tokenizer.keep_unrecognized_fields(), out);
+  }
+
+  template <typename T>
+  static void Parse(ByteSource& source, soia::lazy<T>& out) {
+    if (source.string_refs_base != nullptr) {
+      // The encoded bytes may contain references to strings outside of them.
+      TypeAdapter<T>::Parse(source, *out);
+      return;
+    }
+    const uint8_t* absl_nonnull begin = source.pos;
+    SkipValue(source);
+    if (source.error) return;
+    SetEncoded(std::string((const char*)begin, source.pos - begin), true,
+               source.keep_unrecognized_fields, out);
+  }
+
+  template <typename T>
+  static soia::reflection::Type GetType(soia_type<soia::lazy<T>>) {
+    return soia_internal::GetType<T>();
+  }
+
+  template <typename T>
+  static void RegisterRecords(soia_type<soia::lazy<T>>,
+                              soia::reflection::RecordRegistry& registry) {
+    soia_internal::RegisterRecords<T>(registry);
+  }
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+
+ private:
+  // With UnrecognizedFieldsPolicy::kDrop, the encoded bytes may contain
+  // unrecognized fields, which must be dropped by decoding and encoding again.
+  template <typename T>
+  static bool CanCopyBytes(const soia::lazy<T>& input) {
+    return input.encoded_ != nullptr && input.encoded_->binary &&
+           input.encoded_->keep_unrecognized_fields;
+  }
+
+  template <typename T>
+  static const std::string& GetDefaultBytes() {
+    static const std::string* absl_nonnull const kDefaultBytes = []() {
+      ByteSink out;
+      TypeAdapter<T>::Append(T(), out);
+      return new std::string((const char*)out.data(), out.length());
+    }();
+    return *kDefaultBytes;
+  }
+
+  template <typename T>
+  static void SetEncoded(std::string bytes, bool binary,
+                         bool keep_unrecognized_fields, soia::lazy<T>& out) {
+    using Encoded = typename soia::lazy<T>::Encoded;
+    out.encoded_ = std::make_shared<const Encoded>(Encoded{
+        std::move(bytes), binary, keep_unrecognized_fields, &Decode<T>});
+    out.decode_once_ = std::make_unique<absl::once_flag>();
+    out.value_ = nullptr;
+  }
+
+  template <typename T>
+  static absl::Status Decode(const typename soia::lazy<T>::Encoded& encoded,
+                             T& out) {
+    if (encoded.binary) {
+      ByteSource source(encoded.bytes.data(), encoded.bytes.length());
+      source.keep_unrecognized_fields = encoded.keep_unrecognized_fields;
+      TypeAdapter<T>::Parse(source, out);
+      if (source.error || source.pos < source.end) {
+        return absl::UnknownError("error while decoding soia value from bytes");
+      }
+      return absl::OkStatus();
+    } else {
+      JsonTokenizer tokenizer(encoded.bytes.data(),
+                              encoded.bytes.data() + encoded.bytes.length(),
+                              encoded.keep_unrecognized_fields
+                                  ? soia::UnrecognizedFieldsPolicy::kKeep
+                                  : soia::UnrecognizedFieldsPolicy::kDrop);
+      tokenizer.Next();
+      TypeAdapter<T>::Parse(tokenizer, out);
+      if (tokenizer.state().token_type != JsonTokenType::kStrEnd) {
+        tokenizer.mutable_state().PushUnexpectedTokenError("end");
+      }
+      return tokenizer.state().status;
+    }
+  }
+};
+
+template <typename T>
+inline LazyAdapter GetAdapter(soia_type<soia::lazy<T>>);
+
+struct SharedAdapter {
+  template <typename T>
+  static bool IsDefault(const soia::shared<T>& input) {
+    return input.value_ == nullptr || TypeAdapter<T>::IsDefault(*input);
+  }
+
+  template <typename T, typename Out>
+  static void Append(const soia::shared<T>& input, Out& out) {
+    TypeAdapter<T>::Append(*input, out);
+  }
+
+  template <typename T>
+  static void Parse(JsonTokenizer& tokenizer, soia::shared<T>& out) {
+    TypeAdapter<T>::Parse(tokenizer, *out);
+  }
+
+  template <typename T>
+  static void Parse(ByteSource& source, soia::shared<T>& out) {
+    TypeAdapter<T>::Parse(source, *out);
+  }
+
+  template <typename T>
+  static soia::reflection::Type GetType(soia_type<soia::shared<T>>) {
+    return soia_internal::GetType<T>();
+  }
+
+  template <typename T>
+  static void RegisterRecords(soia_type<soia::shared<T>>,
+                              soia::reflection::RecordRegistry& registry) {
+    soia_internal::RegisterRecords<T>(registry);
+  }
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+};
+
+template <typename T>
+inline SharedAdapter GetAdapter(soia_type<soia::shared<T>>);
+
+struct FrozenAdapter {
+  template <typename T>
+  static bool IsDefault(const soia::frozen<T>& input) {
+    return TypeAdapter<T>::IsDefault(*input);
+  }
+
+  template <typename T, typename Out>
+  static void Append(const soia::frozen<T>& input, Out& out) {
+    TypeAdapter<T>::Append(*input, out);
+  }
+
+  template <typename T>
+  static void Parse(JsonTokenizer& tokenizer, soia::frozen<T>& out) {
+    T value{};
+    TypeAdapter<T>::Parse(tokenizer, value);
+    out = soia::frozen<T>(std::move(value));
+  }
+
+  template <typename T>
+  static void Parse(ByteSource& source, soia::frozen<T>& out) {
+    T value{};
+    TypeAdapter<T>::Parse(source, value);
+    out = soia::frozen<T>(std::move(value));
+  }
+
+  template <typename T>
+  static soia::reflection::Type GetType(soia_type<soia::frozen<T>>) {
+    return soia_internal::GetType<T>();
+  }
+
+  template <typename T>
+  static void RegisterRecords(soia_type<soia::frozen<T>>,
+                              soia::reflection::RecordRegistry& registry) {
+    soia_internal::RegisterRecords<T>(registry);
+  }
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+};
+
+template <typename T>
+inline FrozenAdapter GetAdapter(soia_type<soia::frozen<T>>);
+
 class JsonObjectWriter {
  public:
   JsonObjectWriter(ReadableJson* absl_nonnull out) : out_(*out) {}
@@ -2132,6 +3372,16 @@ class StructJsonObjectParser {
   StructJsonObjectParserImpl impl_;
 };
 
+// Parses a JSON object of the form {"kind": ..., "value": ...}.
+// `find_kind` returns the number of the field with the given name, or 0 if
+// there is no such field. `parse_value` parses the value of the field with the
+// given number from the tokenizer.
+// The generated code calls this function with switch-based lambdas.
+void ParseEnumJsonObject(
+    JsonTokenizer& tokenizer,
+    absl::FunctionRef<int(absl::string_view kind)> find_kind,
+    absl::FunctionRef<void(int number)> parse_value);
+
 class EnumJsonObjectParserImpl {
  public:
   template <typename T, typename WrapperType>
@@ -2258,15 +3508,28 @@ enum class UnrecognizedFormat {
 class UnrecognizedValues {
  public:
   void ParseFrom(JsonTokenizer& tokenizer);
-  void ParseFrom(ByteSource& source);
+  // Parses the next `num_values` values.
+  void ParseFrom(ByteSource& source, size_t num_values = 1);
   void AppendTo(DenseJson& out) const;
   void AppendTo(ByteSink& out) const;
+  void AppendTo(ByteCounter& out) const;
 
  private:
-  ByteSink bytes_;
+  // Number of bytes written by AppendTo(ByteSink&).
+  size_t GetEncodedLength() const;
+
+  // Values parsed from JSON, converted to binary format, except that the
+  // length of the arrays with wire 250 is in `array_lengths_`.
+  // Only set if values were parsed from JSON.
+  absl::optional<ByteSink> bytes_;
   std::vector<uint32_t> array_lengths_;
+  // Values parsed from binary format, copied from the input in one piece.
+  // Only set if values were parsed from binary format.
+  std::string encoded_;
 };
 
+// Always allocated from the heap, even when parsing into an arena: copies of a
+// struct share it, and a copy must remain valid after the arena is destroyed.
 struct UnrecognizedFieldsData {
   UnrecognizedFormat format = UnrecognizedFormat::kUnknown;
   uint32_t array_len = 0;
@@ -2295,6 +3558,8 @@ void AppendUnrecognizedEnum(const UnrecognizedEnum* absl_nullable input,
                             DenseJson& out);
 void AppendUnrecognizedEnum(const UnrecognizedEnum* absl_nullable input,
                             ByteSink& out);
+void AppendUnrecognizedEnum(const UnrecognizedEnum* absl_nullable input,
+                            ByteCounter& out);
 
 void ParseUnrecognizedFields(JsonArrayReader& array_reader, size_t num_slots,
                              size_t num_slots_incl_removed,
@@ -2304,13 +3569,76 @@ void ParseUnrecognizedFields(ByteSource& source, size_t array_len,
                              size_t num_slots, size_t num_slots_incl_removed,
                              std::shared_ptr<UnrecognizedFieldsData>& out);
 
-template <typename HttplibHeaders>
-void SoiaToHttplibHeaders(const soia::service::HttpHeaders& input,
-                          HttplibHeaders& out) {
-  for (const auto& [name, values] : input.map()) {
-    for (const absl::string_view value : values) {
-      out.insert({std::string(name), std::string(value)});
-    }
+// The fields of one struct type selected by a soia::FieldMask.
+class FieldMaskNode {
+ public:
+  bool Includes(int number) const {
+    return static_cast<size_t>(number) < fields_.size() &&
+           fields_[number].included;
+  }
+
+  // Returns the fields to parse in the value of the given field, or nullptr if
+  // the whole value must be parsed.
+  // The given field must be included.
+  const FieldMaskNode* absl_nullable GetChild(int number) const {
+    return fields_[number].child.get();
+  }
+
+  // Includes the field at the end of the given path of field names.
+  // The type of this node is the struct obtained by unwrapping arrays and
+  // optionals from `type`. A path can go through arrays and optionals, and
+  // selects the whole field if it goes through an enum.
+  void AddPath(const soia::reflection::RecordRegistry& records,
+               const soia::reflection::Type& type,
+               const std::vector<std::string>& path);
+
+ private:
+  struct Entry {
+    bool included = false;
+    std::unique_ptr<FieldMaskNode> child;
+  };
+
+  // Indexed by field number.
+  std::vector<Entry> fields_;
+};
+
+// Parses the value of a struct field, or skips it if the field mask excludes
+// the field. `field_mask` is the field mask of the struct.
+template <typename T>
+void ParseField(const FieldMaskNode* absl_nullable field_mask, int number,
+                ByteSource& source, T& out) {
+  if (field_mask == nullptr) {
+    Parse(source, out);
+  } else if (field_mask->Includes(number)) {
+    source.field_mask = field_mask->GetChild(number);
+    Parse(source, out);
+    source.field_mask = field_mask;
+  } else {
+    SkipValue(source);
+  }
+}
+
+template <typename T>
+void ParseField(const FieldMaskNode* absl_nullable field_mask, int number,
+                JsonTokenizer& tokenizer, T& out) {
+  if (field_mask == nullptr) {
+    Parse(tokenizer, out);
+  } else if (field_mask->Includes(number)) {
+    tokenizer.mutable_state().field_mask = field_mask->GetChild(number);
+    Parse(tokenizer, out);
+    tokenizer.mutable_state().field_mask = field_mask;
+  } else {
+    SkipValue(tokenizer);
+  }
+}
+
+template <typename HttplibHeaders>
+void SoiaToHttplibHeaders(const soia::service::HttpHeaders& input,
+                          HttplibHeaders& out) {
+  for (const auto& [name, values] : input.map()) {
+    for (const absl::string_view value : values) {
+      out.insert({std::string(name), std::string(value)});
+    }
   }
 }
 
@@ -2349,37 +3677,125 @@ void assert_unique_method_numbers() {
                 "Method numbers are not unique");
 }
 
-}  // namespace soia_internal
+// Makes the given arena current for the lifetime of the scope: the
+// soia::ArenaAllocator objects constructed meanwhile allocate from it.
+class ArenaScope {
+ public:
+  explicit ArenaScope(soia::Arena* absl_nullable arena)
+      : previous_(soia::Arena::current()) {
+    soia::Arena::current() = arena;
+  }
 
-namespace soia {
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
 
-// Deserializes a soia value.
-// The input string can either be:
-//   - the JSON returned by soia::ToDenseJson or soia::ToReadableJson
-//   - the bytes returned by soia::ToBytes
+  ~ArenaScope() { soia::Arena::current() = previous_; }
+
+ private:
+  soia::Arena* absl_nullable const previous_;
+};
+
+// Deserializes a soia value from binary format, without the "soia" prefix.
 template <typename T>
-absl::StatusOr<T> Parse(absl::string_view bytes_or_json,
-                        UnrecognizedFieldsPolicy unrecognized_fields =
-                            UnrecognizedFieldsPolicy::kDrop) {
+absl::Status ParseBytesWithoutPrefix(
+    absl::string_view bytes, soia::UnrecognizedFieldsPolicy unrecognized_fields,
+    T& out, const FieldMaskNode* absl_nullable field_mask = nullptr) {
+  ByteSource byte_source(bytes.data(), bytes.length());
+  byte_source.keep_unrecognized_fields =
+      unrecognized_fields == soia::UnrecognizedFieldsPolicy::kKeep;
+  byte_source.field_mask = field_mask;
+  Parse(byte_source, out);
+  if (byte_source.error || byte_source.pos < byte_source.end) {
+    return absl::UnknownError("error while decoding soia value from bytes");
+  }
+  return absl::OkStatus();
+}
+
+enum class FrameStatus { kOk, kIncomplete, kError };
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  static absl::StatusOr<std::unique_ptr<MappedFile>> Open(
+      const std::string& path);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  absl::string_view contents() const {
+    return absl::string_view((const char*)data_, length_);
+  }
+
+ private:
+  MappedFile(void* absl_nullable data, size_t length)
+      : data_(data), length_(length) {}
+
+  void* absl_nullable const data_;
+  const size_t length_;
+};
+
+// A file opened for writing, with buffered appends.
+class FileSink {
+ public:
+  static absl::StatusOr<std::unique_ptr<FileSink>> Open(const std::string& path,
+                                                        bool append);
+
+  FileSink(const FileSink&) = delete;
+  FileSink& operator=(const FileSink&) = delete;
+  ~FileSink();
+
+  absl::Status Append(absl::string_view bytes);
+  absl::Status Flush();
+  absl::Status Close();
+
+  // Length of the file, including the bytes appended but not flushed yet.
+  uint64_t length() const { return length_; }
+
+ private:
+  FileSink(std::FILE* absl_nonnull file, std::string path, uint64_t length)
+      : file_(file), path_(std::move(path)), length_(length) {}
+
+  std::FILE* absl_nullable file_;
+  const std::string path_;
+  uint64_t length_;
+};
+
+// Splits the first frame of a record stream from the input: reads the length
+// prefix, and if the input contains the whole record, assigns the record bytes
+// to `record` and the length of the frame, prefix included, to `frame_length`.
+FrameStatus ReadFrame(absl::string_view input, absl::string_view& record,
+                      size_t& frame_length);
+
+template <typename T>
+absl::StatusOr<T> ParseBytesOrJson(
+    absl::string_view bytes_or_json,
+    soia::UnrecognizedFieldsPolicy unrecognized_fields,
+    const FieldMaskNode* absl_nullable field_mask) {
   T result{};
   if (bytes_or_json.length() >= 4 && bytes_or_json[0] == 's' &&
       bytes_or_json[1] == 'o' && bytes_or_json[2] == 'i' &&
       bytes_or_json[3] == 'a') {
-    bytes_or_json = bytes_or_json.substr(4);
-    soia_internal::ByteSource byte_source(bytes_or_json.data(),
-                                          bytes_or_json.length());
-    byte_source.keep_unrecognized_fields =
-        unrecognized_fields == UnrecognizedFieldsPolicy::kKeep;
-    soia_internal::Parse(byte_source, result);
-    if (byte_source.error || byte_source.pos < byte_source.end) {
+    const absl::Status status = ParseBytesWithoutPrefix(
+        bytes_or_json.substr(4), unrecognized_fields, result, field_mask);
+    if (!status.ok()) return status;
+  } else if (absl::StartsWith(bytes_or_json, "soir")) {
+    // Unrecognized fields are always dropped: their bytes may contain string
+    // references which would no longer be valid once copied.
+    ByteSource source(bytes_or_json.data() + 4, bytes_or_json.length() - 4);
+    source.field_mask = field_mask;
+    source.string_refs_base = (const uint8_t*)bytes_or_json.data();
+    Parse(source, result);
+    if (source.error || source.pos < source.end) {
       return absl::UnknownError("error while decoding soia value from bytes");
     }
   } else {
-    soia_internal::JsonTokenizer tokenizer(
-        bytes_or_json.begin(), bytes_or_json.end(), unrecognized_fields);
+    JsonTokenizer tokenizer(bytes_or_json.begin(), bytes_or_json.end(),
+                            unrecognized_fields);
+    tokenizer.mutable_state().field_mask = field_mask;
     tokenizer.Next();
-    soia_internal::Parse(tokenizer, result);
-    if (tokenizer.state().token_type != soia_internal::JsonTokenType::kStrEnd) {
+    Parse(tokenizer, result);
+    if (tokenizer.state().token_type != JsonTokenType::kStrEnd) {
       tokenizer.mutable_state().PushUnexpectedTokenError("end");
     }
     const absl::Status status = tokenizer.state().status;
@@ -2388,6 +3804,77 @@ absl::StatusOr<T> Parse(absl::string_view bytes_or_json,
   return result;
 }
 
+}  // namespace soia_internal
+
+namespace soia {
+
+// Deserializes a soia value.
+// The input string can either be:
+//   - the JSON returned by soia::ToDenseJson or soia::ToReadableJson
+//   - the bytes returned by soia::ToBytes
+template <typename T>
+absl::StatusOr<T> Parse(absl::string_view bytes_or_json,
+                        UnrecognizedFieldsPolicy unrecognized_fields =
+                            UnrecognizedFieldsPolicy::kDrop) {
+  return soia_internal::ParseBytesOrJson<T>(bytes_or_json, unrecognized_fields,
+                                            nullptr);
+}
+
+// Selects the fields of a struct to parse with soia::Parse. The fields are
+// given as the getters generated for them, which can be composed to select the
+// fields of nested structs, e.g.:
+//
+//   const soia::FieldMask<User> mask(
+//       soiagen::get_name<>(), soiagen::get_name<soiagen::get_pets<>>());
+//   absl::StatusOr<User> user = soia::Parse<User>(input, mask);
+//
+// The other fields are skipped, and keep their default value. A path can go
+// through arrays and optionals: above, `pets` is an array of structs and the
+// name of every pet is selected. A path which goes through an enum selects the
+// whole enum.
+// Building a field mask is not free: build it once and reuse it.
+template <typename T>
+class FieldMask {
+ public:
+  template <typename... Getters>
+  explicit FieldMask(Getters...) {
+    soia::reflection::RecordRegistry registry;
+    soia_internal::RegisterRecords<T>(registry);
+    const soia::reflection::Type type = soia_internal::GetType<T>();
+    std::vector<std::string> path;
+    ((path.clear(), soia_internal::MakeKeyChain<Getters>(path),
+      root_.AddPath(registry, type, path)),
+     ...);
+  }
+
+  const soia_internal::FieldMaskNode& root() const { return root_; }
+
+ private:
+  soia_internal::FieldMaskNode root_;
+};
+
+// Same as soia::Parse, but only parses the fields selected by the field mask.
+template <typename T>
+absl::StatusOr<T> Parse(absl::string_view bytes_or_json,
+                        const FieldMask<T>& field_mask,
+                        UnrecognizedFieldsPolicy unrecognized_fields =
+                            UnrecognizedFieldsPolicy::kDrop) {
+  return soia_internal::ParseBytesOrJson<T>(bytes_or_json, unrecognized_fields,
+                                            &field_mask.root());
+}
+
+// Same as soia::Parse, but allocates the strings and arrays of the returned
+// value from the given arena, if their type uses soia::ArenaAllocator. This is
+// the case of the code generated with the `arena` option.
+// The returned value must not outlive the arena: copy it to keep it longer.
+template <typename T>
+absl::StatusOr<T> Parse(absl::string_view bytes_or_json, Arena& arena,
+                        UnrecognizedFieldsPolicy unrecognized_fields =
+                            UnrecognizedFieldsPolicy::kDrop) {
+  soia_internal::ArenaScope arena_scope(&arena);
+  return Parse<T>(bytes_or_json, unrecognized_fields);
+}
+
 // Serializes the given value to dense JSON format.
 template <typename T>
 std::string ToDenseJson(const T& input) {
@@ -2402,6 +3889,19 @@ inline std::string ToDenseJson(const char* absl_nonnull input) {
   return ToDenseJson(std::string(input));
 }
 
+// Serializes the given value to dense JSON format and appends the result to
+// `out`. Reusing the same string across calls avoids allocating once its
+// capacity fits the largest value.
+template <typename T>
+void AppendDenseJson(const T& input, std::string& out) {
+  static_assert(!std::is_pointer<T>::value,
+                "Can't pass a pointer to AppendDenseJson");
+  soia_internal::DenseJson dense_json;
+  dense_json.out = std::move(out);
+  Append(input, dense_json);
+  out = std::move(dense_json).out;
+}
+
 // Serializes the given value to readable JSON format.
 template <typename T>
 std::string ToReadableJson(const T& input) {
@@ -2416,92 +3916,1337 @@ inline std::string ToReadableJson(const char* absl_nonnull input) {
   return ToReadableJson(std::string(input));
 }
 
-// Serializes the given value to binary format.
-template <typename T>
-ByteString ToBytes(const T& input) {
-  static_assert(!std::is_pointer<T>::value, "Can't pass a pointer to ToBytes");
-  soia_internal::ByteSink byte_sink;
-  byte_sink.Push('s', 'o', 'i', 'a');
-  Append(input, byte_sink);
-  return std::move(byte_sink).ToByteString();
-}
+// Same as ToDenseJson, but passes the JSON to `write` in chunks while it is
+// serialized, so the whole JSON is never held in memory. Chunks are cut
+// between the items of arrays, once they reach about `chunk_size` bytes.
+template <typename T>
+void WriteDenseJson(const T& input, size_t chunk_size,
+                    absl::FunctionRef<void(absl::string_view)> write) {
+  static_assert(!std::is_pointer<T>::value,
+                "Can't pass a pointer to WriteDenseJson");
+  const soia_internal::JsonChunkWriter chunk_writer{chunk_size, write};
+  soia_internal::DenseJson dense_json;
+  dense_json.chunk_writer = &chunk_writer;
+  Append(input, dense_json);
+  if (!dense_json.out.empty()) {
+    write(dense_json.out);
+  }
+}
+
+// Same as WriteDenseJson, for readable JSON.
+template <typename T>
+void WriteReadableJson(const T& input, size_t chunk_size,
+                       absl::FunctionRef<void(absl::string_view)> write) {
+  static_assert(!std::is_pointer<T>::value,
+                "Can't pass a pointer to WriteReadableJson");
+  const soia_internal::JsonChunkWriter chunk_writer{chunk_size, write};
+  soia_internal::ReadableJson readable_json;
+  readable_json.chunk_writer = &chunk_writer;
+  Append(input, readable_json);
+  if (!readable_json.out.empty()) {
+    write(readable_json.out);
+  }
+}
+
+// Returns the exact length of the bytes returned by soia::ToBytes, without
+// serializing the value.
+template <typename T>
+size_t GetEncodedSize(const T& input) {
+  static_assert(!std::is_pointer<T>::value,
+                "Can't pass a pointer to GetEncodedSize");
+  soia_internal::ByteCounter byte_counter;
+  byte_counter.Push('s', 'o', 'i', 'a');
+  Append(input, byte_counter);
+  return byte_counter.length();
+}
+
+inline size_t GetEncodedSize(const char* absl_nonnull input) {
+  return GetEncodedSize(std::string(input));
+}
+
+// Serializes the given value to binary format.
+//
+// The buffer grows as the value is serialized. To allocate it once, call
+// ToBytes(input, GetEncodedSize(input)) instead. That costs one more pass over
+// the value, which only pays off for large values.
+template <typename T>
+ByteString ToBytes(const T& input) {
+  static_assert(!std::is_pointer<T>::value, "Can't pass a pointer to ToBytes");
+  soia_internal::ByteSink byte_sink;
+  byte_sink.Push('s', 'o', 'i', 'a');
+  Append(input, byte_sink);
+  return std::move(byte_sink).ToByteString();
+}
+
+// Same as ToBytes, but allocates `capacity` bytes upfront. If the capacity is
+// at least the length of the result, e.g. the result of GetEncodedSize or the
+// length of a similar value, the buffer is never reallocated.
+template <typename T>
+ByteString ToBytes(const T& input, size_t capacity) {
+  static_assert(!std::is_pointer<T>::value, "Can't pass a pointer to ToBytes");
+  soia_internal::ByteSink byte_sink(capacity);
+  byte_sink.Push('s', 'o', 'i', 'a');
+  Append(input, byte_sink);
+  return std::move(byte_sink).ToByteString();
+}
+
+inline ByteString ToBytes(const char* absl_nonnull input) {
+  return ToBytes(std::string(input));
+}
+
+// Same as ToBytes, but a string which occurs several times in the value is
+// written in full once, and the other occurrences are written as references
+// to the first one. This makes the bytes much smaller if the value repeats the
+// same strings, e.g. names or tags in a large array of structs.
+//
+// The bytes start with "soir" instead of "soia". They can be parsed with
+// soia::Parse. Unrecognized fields are dropped when parsing them.
+//
+// Only the encoded bytes are smaller: parsing a string reference into a
+// std::string, which is the type of the generated string fields, still copies
+// the string. Only absl::string_view values share the bytes of a repeated
+// string, e.g. when parsing a std::vector<absl::string_view>.
+template <typename T>
+ByteString ToBytesWithStringRefs(const T& input) {
+  static_assert(!std::is_pointer<T>::value,
+                "Can't pass a pointer to ToBytesWithStringRefs");
+  soia_internal::StringRefs string_refs;
+  soia_internal::ByteSink byte_sink;
+  byte_sink.set_string_refs(&string_refs);
+  byte_sink.Push('s', 'o', 'i', 'r');
+  Append(input, byte_sink);
+  return std::move(byte_sink).ToByteString();
+}
+
+// Runs the tasks of the functions which can split their work over several
+// threads, e.g. ToBytes(input, executor).
+// Implement this interface to plug in an existing thread pool.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // Calls task(i) for every i in [0, num_tasks), possibly concurrently, and
+  // returns once all the calls have returned.
+  virtual void RunAll(size_t num_tasks,
+                      absl::FunctionRef<void(size_t task_index)> task) = 0;
+};
+
+// An executor which starts up to `num_threads` threads, the calling thread
+// included, for every call to RunAll.
+class ThreadExecutor : public Executor {
+ public:
+  explicit ThreadExecutor(int num_threads)
+      : num_threads_(std::max(num_threads, 1)) {}
+
+  void RunAll(size_t num_tasks,
+              absl::FunctionRef<void(size_t task_index)> task) override;
+
+ private:
+  const int num_threads_;
+};
+
+}  // namespace soia
+
+namespace soia_internal {
+
+// Number of items of an array encoded or decoded by one task, when encoding or
+// decoding in parallel. Arrays with fewer items are processed on the calling
+// thread.
+constexpr size_t kItemsPerTask = 4096;
+
+template <typename T>
+struct is_parallel_array : std::false_type {};
+template <typename T, typename Alloc>
+struct is_parallel_array<std::vector<T, Alloc>> : std::true_type {};
+// The items of a std::vector<bool> are packed bits: they can't be decoded on
+// several threads at once, nor even be bound to a bool&.
+template <typename Alloc>
+struct is_parallel_array<std::vector<bool, Alloc>> : std::false_type {};
+template <typename T, typename GetKey>
+struct is_parallel_array<soia::keyed_items<T, GetKey>> : std::true_type {};
+
+inline size_t GetNumTasks(size_t num_items) {
+  return (num_items + kItemsPerTask - 1) / kItemsPerTask;
+}
+
+// Appends the items at the given task's indexes, without the array prefix.
+template <typename Input, typename Out>
+void AppendTaskItems(const Input& input, size_t task_index, Out& out) {
+  using T = typename Input::value_type;
+  const size_t begin = task_index * kItemsPerTask;
+  const size_t end = std::min(begin + kItemsPerTask, input.size());
+  if constexpr (HasNumberKernels<T>()) {
+    AppendNumbers(input.data() + begin, end - begin, out);
+  } else {
+    for (size_t i = begin; i < end; ++i) {
+      TypeAdapter<T>::Append(input[i], out);
+    }
+  }
+}
+
+template <typename Input>
+void AppendTaskItems(const Input& input, size_t task_index, DenseJson& out) {
+  using T = typename Input::value_type;
+  const size_t begin = task_index * kItemsPerTask;
+  const size_t end = std::min(begin + kItemsPerTask, input.size());
+  for (size_t i = begin; i < end; ++i) {
+    if (i != begin) {
+      out.out += ',';
+    }
+    TypeAdapter<T>::Append(input[i], out);
+  }
+}
+
+// Decodes the items of an array from bytes, after the array prefix, splitting
+// the work over the executor. Finds the boundaries of the items with
+// SkipValue first.
+template <typename T, typename Alloc>
+void ParseItemsInParallel(ByteSource& source, size_t num_items,
+                          soia::Executor& executor,
+                          std::vector<T, Alloc>& out) {
+  const size_t num_tasks = GetNumTasks(num_items);
+  std::vector<const uint8_t*> task_begins;
+  task_begins.reserve(num_tasks + 1);
+  for (size_t i = 0; i < num_items; ++i) {
+    if (i % kItemsPerTask == 0) {
+      task_begins.push_back(source.pos);
+    }
+    SkipValue(source);
+    if (source.error) return;
+  }
+  task_begins.push_back(source.pos);
+  out.resize(num_items);
+  // Not a std::vector<bool>, which cannot be written concurrently.
+  std::vector<char> task_errors(num_tasks);
+  executor.RunAll(num_tasks, [&](size_t task_index) {
+    const uint8_t* begin = task_begins[task_index];
+    ByteSource task_source(begin, task_begins[task_index + 1] - begin);
+    task_source.keep_unrecognized_fields = source.keep_unrecognized_fields;
+    const size_t end = std::min((task_index + 1) * kItemsPerTask, num_items);
+    for (size_t i = task_index * kItemsPerTask; i < end; ++i) {
+      TypeAdapter<T>::Parse(task_source, out[i]);
+    }
+    task_errors[task_index] =
+        task_source.error || task_source.pos != task_source.end;
+  });
+  for (const char task_error : task_errors) {
+    if (task_error) return source.RaiseError();
+  }
+}
+
+template <typename T, typename GetKey>
+void ParseItemsInParallel(ByteSource& source, size_t num_items,
+                          soia::Executor& executor,
+                          soia::keyed_items<T, GetKey>& out) {
+  std::vector<T> items;
+  ParseItemsInParallel(source, num_items, executor, items);
+  out = soia::keyed_items<T, GetKey>(std::move(items));
+}
+
+}  // namespace soia_internal
+
+namespace soia {
+
+// Same as ToBytes, but if the input is a large array, encodes the items on
+// several threads and joins the results.
+template <typename T>
+ByteString ToBytes(const T& input, Executor& executor) {
+  if constexpr (soia_internal::is_parallel_array<T>::value) {
+    const size_t num_tasks = soia_internal::GetNumTasks(input.size());
+    if (num_tasks >= 2) {
+      std::vector<soia_internal::ByteSink> task_outputs(num_tasks);
+      executor.RunAll(num_tasks, [&](size_t task_index) {
+        soia_internal::AppendTaskItems(input, task_index,
+                                       task_outputs[task_index]);
+      });
+      size_t length = 0;
+      for (const soia_internal::ByteSink& task_output : task_outputs) {
+        length += task_output.length();
+      }
+      // 4 bytes for "soia" and at most 5 bytes for the array prefix.
+      soia_internal::ByteSink byte_sink(length + 9);
+      byte_sink.Push('s', 'o', 'i', 'a');
+      soia_internal::AppendArrayPrefix(input.size(), byte_sink);
+      for (const soia_internal::ByteSink& task_output : task_outputs) {
+        byte_sink.PushN(task_output.data(), task_output.length());
+      }
+      return std::move(byte_sink).ToByteString();
+    }
+  }
+  return ToBytes(input);
+}
+
+// Same as ToDenseJson, but if the input is a large array, encodes the items on
+// several threads and joins the results.
+template <typename T>
+std::string ToDenseJson(const T& input, Executor& executor) {
+  if constexpr (soia_internal::is_parallel_array<T>::value) {
+    const size_t num_tasks = soia_internal::GetNumTasks(input.size());
+    if (num_tasks >= 2) {
+      std::vector<soia_internal::DenseJson> task_outputs(num_tasks);
+      executor.RunAll(num_tasks, [&](size_t task_index) {
+        soia_internal::AppendTaskItems(input, task_index,
+                                       task_outputs[task_index]);
+      });
+      size_t length = 2 + num_tasks;
+      for (const soia_internal::DenseJson& task_output : task_outputs) {
+        length += task_output.out.length();
+      }
+      std::string result;
+      result.reserve(length);
+      result += '[';
+      for (const soia_internal::DenseJson& task_output : task_outputs) {
+        if (result.length() > 1) {
+          result += ',';
+        }
+        result += task_output.out;
+      }
+      result += ']';
+      return result;
+    }
+  }
+  return ToDenseJson(input);
+}
+
+// Same as Parse, but if the input is a large array in binary format, decodes
+// the items on several threads. JSON is parsed on the calling thread.
+template <typename T>
+absl::StatusOr<T> Parse(absl::string_view bytes_or_json, Executor& executor,
+                        UnrecognizedFieldsPolicy unrecognized_fields =
+                            UnrecognizedFieldsPolicy::kDrop) {
+  if constexpr (soia_internal::is_parallel_array<T>::value) {
+    if (absl::StartsWith(bytes_or_json, "soia")) {
+      soia_internal::ByteSource source(bytes_or_json.data() + 4,
+                                       bytes_or_json.length() - 4);
+      source.keep_unrecognized_fields =
+          unrecognized_fields == UnrecognizedFieldsPolicy::kKeep;
+      uint32_t length = 0;
+      soia_internal::ParseArrayPrefix(source, length);
+      using Item = typename T::value_type;
+      if (!source.error && soia_internal::GetNumTasks(length) >= 2 &&
+          !soia_internal::HasNumberKernels<Item>()) {
+        T result;
+        soia_internal::ParseItemsInParallel(source, length, executor, result);
+        if (source.error || source.pos < source.end) {
+          return absl::UnknownError(
+              "error while decoding soia value from bytes");
+        }
+        return result;
+      }
+    }
+  }
+  return Parse<T>(bytes_or_json, unrecognized_fields);
+}
+
+// Serializes soia values to binary format into a buffer which is reused from
+// one call to the next. Once the buffer has grown to fit the largest value,
+// serializing does not allocate.
+//
+// Not thread-safe: use one BytesWriter per thread.
+class BytesWriter {
+ public:
+  BytesWriter() = default;
+  BytesWriter(const BytesWriter&) = delete;
+  BytesWriter& operator=(const BytesWriter&) = delete;
+
+  // Serializes the given value to binary format, replacing the result of the
+  // previous call. The returned view is equal to what ToBytes would return,
+  // and is invalidated by the next call to Write.
+  template <typename T>
+  absl::string_view Write(const T& input) {
+    static_assert(!std::is_pointer<T>::value,
+                  "Can't pass a pointer to BytesWriter::Write");
+    byte_sink_.Clear();
+    byte_sink_.Push('s', 'o', 'i', 'a');
+    Append(input, byte_sink_);
+    return absl::string_view((const char*)byte_sink_.data(),
+                             byte_sink_.length());
+  }
+
+  absl::string_view Write(const char* absl_nonnull input) {
+    return Write(std::string(input));
+  }
+
+  // Serializes the given value as one frame of a record stream, replacing the
+  // result of the previous call. A frame is the length of the value in binary
+  // format, encoded as a soia number, followed by the value without the "soia"
+  // prefix. Concatenated frames can be read back with RecordStreamDecoder.
+  // The returned view is invalidated by the next call to Write or WriteFrame.
+  template <typename T>
+  absl::string_view WriteFrame(const T& input) {
+    static_assert(!std::is_pointer<T>::value,
+                  "Can't pass a pointer to BytesWriter::WriteFrame");
+    soia_internal::ByteCounter byte_counter;
+    Append(input, byte_counter);
+    byte_sink_.Clear();
+    soia_internal::Uint64Adapter::Append(byte_counter.length(), byte_sink_);
+    Append(input, byte_sink_);
+    return absl::string_view((const char*)byte_sink_.data(),
+                             byte_sink_.length());
+  }
+
+ private:
+  soia_internal::ByteSink byte_sink_;
+};
+
+// Decodes a stream of records written with BytesWriter::WriteFrame, from an
+// input which arrives in chunks, e.g. from a socket. Only the frame being
+// decoded is buffered, so memory stays bounded by the size of the largest
+// record, and decoding can overlap with I/O.
+//
+// Usage:
+//   soia::RecordStreamDecoder<User> decoder;
+//   while (ReadChunk(&chunk)) {
+//     decoder.Feed(chunk);
+//     for (;;) {
+//       absl::StatusOr<absl::optional<User>> user = decoder.Next();
+//       if (!user.ok()) return user.status();
+//       if (!user->has_value()) break;  // More input is needed.
+//       Process(**user);
+//     }
+//   }
+//   return decoder.Finish();
+template <typename T>
+class RecordStreamDecoder {
+ public:
+  explicit RecordStreamDecoder(UnrecognizedFieldsPolicy unrecognized_fields =
+                                   UnrecognizedFieldsPolicy::kDrop)
+      : unrecognized_fields_(unrecognized_fields) {}
+
+  // Appends a chunk of input.
+  void Feed(absl::string_view chunk) {
+    if (consumed_ != 0) {
+      // Drop the frames already decoded before growing the buffer.
+      buffer_.erase(0, consumed_);
+      consumed_ = 0;
+    }
+    buffer_.append(chunk.data(), chunk.length());
+  }
+
+  // Decodes the next record, or returns absl::nullopt if the input fed so far
+  // does not contain a whole frame.
+  absl::StatusOr<absl::optional<T>> Next() {
+    absl::string_view record;
+    size_t frame_length = 0;
+    const absl::string_view input =
+        absl::string_view(buffer_).substr(consumed_);
+    switch (soia_internal::ReadFrame(input, record, frame_length)) {
+      case soia_internal::FrameStatus::kOk:
+        break;
+      case soia_internal::FrameStatus::kIncomplete:
+        return absl::optional<T>();
+      case soia_internal::FrameStatus::kError:
+        return absl::UnknownError("error while decoding soia record frame");
+    }
+    absl::optional<T> result(absl::in_place);
+    const absl::Status status = soia_internal::ParseBytesWithoutPrefix(
+        record, unrecognized_fields_, *result);
+    if (!status.ok()) return status;
+    consumed_ += frame_length;
+    return result;
+  }
+
+  // Returns an error if the input ends in the middle of a frame.
+  absl::Status Finish() const {
+    if (consumed_ < buffer_.length()) {
+      return absl::UnknownError("soia record stream ends with a partial frame");
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const UnrecognizedFieldsPolicy unrecognized_fields_;
+  std::string buffer_;
+  size_t consumed_ = 0;
+};
+
+// Writes records of type T to a file, framed as with BytesWriter::WriteFrame.
+// The file can be read back with RecordFileReader, or with a
+// RecordStreamDecoder.
+//
+// Not thread-safe.
+template <typename T>
+class RecordFileWriter {
+ public:
+  // Creates or truncates the file, or appends to it if `append` is true.
+  static absl::StatusOr<RecordFileWriter> Open(const std::string& path,
+                                               bool append = false) {
+    absl::StatusOr<std::unique_ptr<soia_internal::FileSink>> file =
+        soia_internal::FileSink::Open(path, append);
+    if (!file.ok()) return file.status();
+    return RecordFileWriter(*std::move(file));
+  }
+
+  RecordFileWriter(RecordFileWriter&&) = default;
+  RecordFileWriter& operator=(RecordFileWriter&&) = default;
+
+  // Appends the given record to the file. On success, returns the offset of
+  // the record's frame in the file, which can be passed to
+  // RecordFileReader::ReadAt.
+  absl::StatusOr<uint64_t> Write(const T& input) {
+    const uint64_t offset = file_->length();
+    const absl::Status status =
+        file_->Append(bytes_writer_->WriteFrame(input));
+    if (!status.ok()) return status;
+    return offset;
+  }
+
+  // Flushes the buffered records to the operating system.
+  absl::Status Flush() { return file_->Flush(); }
+
+  // Flushes the buffered records and closes the file.
+  absl::Status Close() { return file_->Close(); }
+
+ private:
+  explicit RecordFileWriter(std::unique_ptr<soia_internal::FileSink> file)
+      : file_(std::move(file)) {}
+
+  std::unique_ptr<soia_internal::FileSink> file_;
+  std::unique_ptr<BytesWriter> bytes_writer_ = std::make_unique<BytesWriter>();
+};
+
+// Reads records of type T from a file written by RecordFileWriter.
+// The file is memory-mapped: records are only decoded when read, and
+// processes which map the same file share its pages. On platforms without
+// mmap, the whole file is read into memory when opened.
+//
+// T may contain absl::string_view anywhere a string value is expected. Every
+// such view points into the mapping, and remains valid as long as the reader.
+//
+// Thread-compatible: ReadAt can be called concurrently.
+template <typename T>
+class RecordFileReader {
+ public:
+  static absl::StatusOr<RecordFileReader> Open(
+      const std::string& path, UnrecognizedFieldsPolicy unrecognized_fields =
+                                   UnrecognizedFieldsPolicy::kDrop) {
+    absl::StatusOr<std::unique_ptr<soia_internal::MappedFile>> file =
+        soia_internal::MappedFile::Open(path);
+    if (!file.ok()) return file.status();
+    return RecordFileReader(*std::move(file), unrecognized_fields);
+  }
+
+  RecordFileReader(RecordFileReader&&) = default;
+  RecordFileReader& operator=(RecordFileReader&&) = default;
+
+  // Decodes the next record, or returns absl::nullopt at the end of the file.
+  absl::StatusOr<absl::optional<T>> Next() {
+    if (next_offset_ == file_->contents().length()) {
+      return absl::optional<T>();
+    }
+    absl::optional<T> result(absl::in_place);
+    absl::StatusOr<uint64_t> frame_end = ReadFrameAt(next_offset_, *result);
+    if (!frame_end.ok()) return frame_end.status();
+    next_offset_ = *frame_end;
+    return result;
+  }
+
+  // Decodes the record whose frame starts at the given offset.
+  absl::StatusOr<T> ReadAt(uint64_t offset) const {
+    T result{};
+    absl::StatusOr<uint64_t> frame_end = ReadFrameAt(offset, result);
+    if (!frame_end.ok()) return frame_end.status();
+    return result;
+  }
+
+  // Returns the offset of every frame in the file, for random access with
+  // ReadAt. Only reads the length prefixes: records are not decoded.
+  absl::StatusOr<std::vector<uint64_t>> BuildIndex() const {
+    std::vector<uint64_t> offsets;
+    const absl::string_view contents = file_->contents();
+    uint64_t offset = 0;
+    while (offset < contents.length()) {
+      absl::string_view record;
+      size_t frame_length = 0;
+      if (soia_internal::ReadFrame(contents.substr(offset), record,
+                                   frame_length) !=
+          soia_internal::FrameStatus::kOk) {
+        return absl::UnknownError(
+            absl::StrCat("invalid soia record frame at offset ", offset));
+      }
+      offsets.push_back(offset);
+      offset += frame_length;
+    }
+    return offsets;
+  }
+
+  // The bytes of the file.
+  absl::string_view contents() const { return file_->contents(); }
+
+ private:
+  RecordFileReader(std::unique_ptr<soia_internal::MappedFile> file,
+                   UnrecognizedFieldsPolicy unrecognized_fields)
+      : file_(std::move(file)), unrecognized_fields_(unrecognized_fields) {}
+
+  // Returns the offset of the end of the frame.
+  absl::StatusOr<uint64_t> ReadFrameAt(uint64_t offset, T& out) const {
+    const absl::string_view contents = file_->contents();
+    if (offset >= contents.length()) {
+      return absl::OutOfRangeError(
+          absl::StrCat("no soia record at offset ", offset));
+    }
+    absl::string_view record;
+    size_t frame_length = 0;
+    if (soia_internal::ReadFrame(contents.substr(offset), record,
+                                 frame_length) !=
+        soia_internal::FrameStatus::kOk) {
+      return absl::UnknownError(
+          absl::StrCat("invalid soia record frame at offset ", offset));
+    }
+    const absl::Status status = soia_internal::ParseBytesWithoutPrefix(
+        record, unrecognized_fields_, out);
+    if (!status.ok()) return status;
+    return offset + frame_length;
+  }
+
+  std::unique_ptr<soia_internal::MappedFile> file_;
+  UnrecognizedFieldsPolicy unrecognized_fields_;
+  uint64_t next_offset_ = 0;
+};
+
+// Minimum absl::Time encodable as a soia timestamp.
+// Equal to 100M days before the Unix EPOCH.
+constexpr absl::Time kMinEncodedTimestamp =
+    absl::FromUnixMillis(-8640000000000000);
+// Maximum absl::Time encodable as a soia timestamp.
+// Equal to 100M days before the Unix EPOCH.
+constexpr absl::Time kMaxEncodedTimestamp =
+    absl::FromUnixMillis(8640000000000000);
+
+template <typename H, typename T>
+H AbslHashValue(H h, const rec<T>& rec) {
+  if (::soia_internal::RecAdapter::IsDefault(rec)) {
+    return H::combine(std::move(h), -6387689);
+  } else {
+    return H::combine(std::move(h), *rec);
+  }
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const lazy<T>& input) {
+  return os << soia_internal::ToDebugString(*input);
+}
+
+template <typename H, typename T>
+H AbslHashValue(H h, const lazy<T>& lazy) {
+  return H::combine(std::move(h), *lazy);
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const shared<T>& input) {
+  return os << soia_internal::ToDebugString(*input);
+}
+
+template <typename H, typename T>
+H AbslHashValue(H h, const shared<T>& shared) {
+  return H::combine(std::move(h), *shared);
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const frozen<T>& input) {
+  return os << soia_internal::ToDebugString(*input);
+}
+
+template <typename H, typename T>
+H AbslHashValue(H h, const frozen<T>& frozen) {
+  return H::combine(std::move(h), frozen.hash());
+}
+
+namespace reflection {
+
+template <typename T>
+const TypeDescriptor& GetTypeDescriptor() {
+  static const TypeDescriptor* result = []() -> const TypeDescriptor* {
+    RecordRegistry registry;
+    soia_internal::RegisterRecords<T>(registry);
+    return new TypeDescriptor{soia_internal::GetType<T>(), std::move(registry)};
+  }();
+  return *result;
+}
+
+template <typename T>
+constexpr bool IsStruct() {
+  return soia_internal::TypeAdapter<T>::IsStruct();
+}
+
+template <typename T>
+constexpr bool IsEnum() {
+  return soia_internal::TypeAdapter<T>::IsEnum();
+}
+
+template <typename T>
+constexpr bool IsRecord() {
+  return IsStruct<T>() || IsEnum<T>();
+}
+
+// Calls f(field) for each field in the soia-generated datatype.
+// The type of the single argument passed to f is one of: struct_field,
+// enum_const_field, enum_wrapper_field.
+template <typename Record, typename F>
+void ForEachField(F&& f) {
+  static_assert(IsStruct<Record>() || IsEnum<Record>());
+  std::apply(
+      [&f](auto&&... x) {
+        (static_cast<void>(f(std::forward<decltype(x)>(x))), ...);
+      },
+      typename soia_internal::TypeAdapter<Record>::fields_tuple());
+}
+
+class DynamicCodec;
+
+// A soia value read by a DynamicCodec, whose type is only known at runtime.
+//
+// Points into the input passed to the codec: the input and the codec must
+// outlive the value.
+class DynamicValue {
+ public:
+  // Type of the value. Records are defined in the TypeDescriptor the codec
+  // was created from.
+  const Type& type() const;
+
+  // The value in binary format, without the "soia" prefix.
+  absl::string_view bytes() const { return bytes_; }
+
+  // Converts the value to dense JSON.
+  std::string ToDenseJson() const;
+
+  // Decodes the value into a C++ type with the same schema, for example
+  // As<int32_t>() or As<std::string>().
+  template <typename T>
+  absl::StatusOr<T> As() const {
+    T result{};
+    soia_internal::ByteSource source(bytes_.data(), bytes_.length());
+    source.string_refs_base = string_refs_base_;
+    soia_internal::Parse(source, result);
+    if (source.error || source.pos < source.end) {
+      return absl::UnknownError("error while decoding soia value from bytes");
+    }
+    return result;
+  }
+
+ private:
+  friend class DynamicCodec;
+
+  DynamicValue(const DynamicCodec* absl_nonnull codec, uint32_t op,
+               absl::string_view bytes,
+               const uint8_t* absl_nullable string_refs_base)
+      : codec_(codec),
+        op_(op),
+        bytes_(bytes),
+        string_refs_base_(string_refs_base) {}
+
+  const DynamicCodec* absl_nonnull codec_;
+  uint32_t op_;
+  absl::string_view bytes_;
+  const uint8_t* absl_nullable string_refs_base_;
+};
+
+// Reads soia values of a type only known at runtime, for example a type
+// loaded with TypeDescriptor::FromJson, without generated code.
+//
+// Create() compiles the TypeDescriptor into a flat table of instructions, one
+// per type, with records resolved once. Reuse the codec for all the values of
+// the type.
+//
+// Example:
+//   absl::StatusOr<DynamicCodec> codec = DynamicCodec::Create(descriptor);
+//   absl::StatusOr<std::string> json = codec->BytesToDenseJson(bytes);
+//   absl::StatusOr<DynamicValue> city = codec->GetField(bytes, "address.city");
+class DynamicCodec {
+ public:
+  // Returns an error if the descriptor is not valid, for example if it refers
+  // to a record it does not define.
+  static absl::StatusOr<DynamicCodec> Create(const TypeDescriptor& descriptor);
+
+  // Converts a value from binary format, with the "soia" or the "soir" prefix,
+  // to dense JSON. Unrecognized fields are dropped.
+  absl::StatusOr<std::string> BytesToDenseJson(absl::string_view bytes) const;
+
+  // Reads the value at the given path within a value in binary format. The
+  // path is a dot-separated sequence of struct field names, enum wrapper field
+  // names and array indexes, for example "items.0.name". An empty path refers
+  // to the whole value. Optional values along the path are transparent.
+  //
+  // Returns a NotFound error if an optional value along the path is null, if
+  // an enum holds a different field or if an array index is out of range.
+  absl::StatusOr<DynamicValue> GetField(absl::string_view bytes,
+                                        absl::string_view path) const;
+
+ private:
+  friend class DynamicValue;
+
+  enum class OpKind : uint8_t {
+    kBool,
+    kInt32,
+    kInt64,
+    kUint64,
+    kFloat32,
+    kFloat64,
+    kTimestamp,
+    kString,
+    kBytes,
+    kOptional,
+    kArray,
+    kStruct,
+    kEnum,
+  };
+
+  struct Op {
+    OpKind kind{};
+    // If the kind is kOptional or kArray: index of the op of the item.
+    uint32_t item = 0;
+    // If the kind is kStruct or kEnum: range of the record's slots. The slots
+    // of a struct are indexed by field number, the slots of an enum are sorted
+    // by field number.
+    uint32_t slots_begin = 0;
+    uint32_t slots_end = 0;
+  };
+
+  struct Slot {
+    // Empty for a removed number.
+    std::string name;
+    int32_t number = 0;
+    // Index of the op of the value, or -1 if the number was removed or if the
+    // field is an enum constant field.
+    int32_t op = -1;
+  };
+
+  class Compiler;
+
+  DynamicCodec() = default;
+
+  void AppendDenseJson(uint32_t op, soia_internal::ByteSource& source,
+                       soia_internal::DenseJson& out) const;
+
+  std::vector<Op> ops_;
+  std::vector<Slot> slots_;
+  std::vector<Type> types_;
+  uint32_t root_ = 0;
+};
+
+}  // namespace reflection
+
+// Struct-of-arrays representation of an array of soia structs: the values of
+// each field are stored contiguously, in one vector per field. Scanning one
+// field over many rows is cache friendly and vectorizes well.
+//
+// The binary and dense JSON formats of a columns<T> are columnar too: the
+// number of rows, followed by one array per field, indexed by field number.
+// The array of a field whose values are all default is empty, except for the
+// first field if all the fields are default. Similar values end up next to
+// each other, which makes the encoded bytes compress well.
+//
+// The readable JSON and debug string formats of a columns<T> are the same as
+// the formats of the equivalent std::vector<T>, which makes them easy to read.
+// So is the type descriptor of a columns<T>. Unrecognized fields are dropped.
+//
+// When parsing, the number of rows can't exceed the length of the input. If T
+// has no fields, it can't exceed 65536.
+//
+// Example:
+//
+//   soia::columns<Point> points(std::vector<Point>{{.x = 1}, {.x = 2}});
+//   const std::vector<int32_t>& xs = points.column<soiagen::get_x<>>();
+template <typename T>
+class columns {
+  static_assert(reflection::IsStruct<T>(), "T must be a soia struct");
+
+  using fields_tuple = typename soia_internal::TypeAdapter<T>::fields_tuple;
+
+  template <typename Fields>
+  struct columns_tuple_of;
+  template <typename... Fields>
+  struct columns_tuple_of<std::tuple<Fields...>> {
+    using type = std::tuple<std::vector<typename Fields::value_type>...>;
+  };
+  using columns_tuple = typename columns_tuple_of<fields_tuple>::type;
+
+  static constexpr size_t kNumFields = std::tuple_size_v<fields_tuple>;
+  using field_indices = std::make_index_sequence<kNumFields>;
+
+ public:
+  using value_type = T;
+
+  columns() = default;
+  explicit columns(const std::vector<T>& rows) {
+    reserve(rows.size());
+    for (const T& row : rows) {
+      push_back(row);
+    }
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  void reserve(size_t n) {
+    std::apply([n](auto&... column) { (column.reserve(n), ...); }, columns_);
+  }
+
+  void clear() {
+    std::apply([](auto&... column) { (column.clear(), ...); }, columns_);
+    size_ = 0;
+  }
+
+  void push_back(const T& row) {
+    PushBack(row, field_indices());
+    ++size_;
+  }
+  void push_back(T&& row) {
+    PushBack(std::move(row), field_indices());
+    ++size_;
+  }
+
+  // Returns a copy of the row at the given index.
+  T row(size_t index) const { return GetRow(index, field_indices()); }
+
+  std::vector<T> ToRows() const {
+    std::vector<T> rows;
+    rows.reserve(size_);
+    for (size_t i = 0; i < size_; ++i) {
+      rows.push_back(row(i));
+    }
+    return rows;
+  }
+
+  // Returns the values of the field with the given getter, e.g.
+  // soiagen::get_x<>. The column always contains size() values: resizing it
+  // is not allowed.
+  template <typename Getter>
+  const auto& column() const {
+    return std::get<IndexOf<Getter>()>(columns_);
+  }
+  template <typename Getter>
+  auto& column() {
+    return std::get<IndexOf<Getter>()>(columns_);
+  }
+
+  bool operator==(const columns& other) const {
+    return size_ == other.size_ && columns_ == other.columns_;
+  }
+  bool operator!=(const columns& other) const { return !operator==(other); }
+
+ private:
+  columns_tuple columns_;
+  size_t size_ = 0;
+
+  template <typename Getter, size_t I = 0>
+  static constexpr size_t IndexOf() {
+    static_assert(I < kNumFields, "no such field in the struct");
+    using getter_type =
+        typename std::tuple_element_t<I, fields_tuple>::getter_type;
+    if constexpr (std::is_same_v<getter_type, Getter>) {
+      return I;
+    } else {
+      return IndexOf<Getter, I + 1>();
+    }
+  }
+
+  template <size_t... I>
+  void PushBack(const T& row, std::index_sequence<I...>) {
+    (std::get<I>(columns_).push_back(
+         typename std::tuple_element_t<I, fields_tuple>::getter_type()(row)),
+     ...);
+  }
+  template <size_t... I>
+  void PushBack(T&& row, std::index_sequence<I...>) {
+    (std::get<I>(columns_).push_back(std::move(
+         typename std::tuple_element_t<I, fields_tuple>::getter_type()(row))),
+     ...);
+  }
+
+  template <size_t... I>
+  T GetRow(size_t index, std::index_sequence<I...>) const {
+    T row{};
+    ((typename std::tuple_element_t<I, fields_tuple>::getter_type()(row) =
+          std::get<I>(columns_)[index]),
+     ...);
+    return row;
+  }
+
+  friend struct ::soia_internal::ColumnsAdapter;
+};
+
+}  // namespace soia
+
+namespace soia_internal {
+
+// Maps the fields of a soia struct, in the order of the fields tuple, to their
+// numbers, using the reflection records.
+std::vector<int> GetFieldNumbers(
+    const soia::reflection::TypeDescriptor& type_descriptor,
+    const std::vector<absl::string_view>& field_names);
+
+struct ColumnsAdapter {
+  template <typename T>
+  static bool IsDefault(const soia::columns<T>& input) {
+    return input.empty();
+  }
+
+  template <typename T>
+  static void Append(const soia::columns<T>& input, DenseJson& out) {
+    if (input.empty()) {
+      out.out += {'[', ']'};
+      return;
+    }
+    const std::vector<bool> columns_in_full = GetColumnsInFull(input);
+    out.out += '[';
+    ::soia_internal::Append(static_cast<uint64_t>(input.size_), out);
+    const std::vector<int>& field_index_by_number = GetFieldIndexByNumber<T>();
+    for (size_t number = 0; number < columns_in_full.size(); ++number) {
+      out.out += ',';
+      const int field_index = field_index_by_number[number];
+      VisitColumn(input, field_index, [&](const auto& column) {
+        if (!columns_in_full[number]) {
+          out.out += {'[', ']'};
+        } else {
+          TypeAdapter<std::decay_t<decltype(column)>>::Append(column, out);
+        }
+      });
+      if (field_index < 0) {
+        out.out += '0';
+      }
+    }
+    out.out += ']';
+  }
+
+  template <typename T>
+  static void Append(const soia::columns<T>& input, ReadableJson& out) {
+    TypeAdapter<std::vector<T>>::Append(input.ToRows(), out);
+  }
+
+  template <typename T>
+  static void Append(const soia::columns<T>& input, DebugString& out) {
+    TypeAdapter<std::vector<T>>::Append(input.ToRows(), out);
+  }
+
+  template <typename T>
+  static void Append(const soia::columns<T>& input, ByteSink& out) {
+    AppendBytes(input, out);
+  }
+
+  template <typename T>
+  static void Append(const soia::columns<T>& input, ByteCounter& out) {
+    AppendBytes(input, out);
+  }
+
+  template <typename T>
+  static void Parse(JsonTokenizer& tokenizer, soia::columns<T>& out) {
+    out.clear();
+    switch (tokenizer.state().token_type) {
+      case JsonTokenType::kLeftSquareBracket:
+        break;
+      case JsonTokenType::kZero:
+        tokenizer.Next();
+        return;
+      default:
+        tokenizer.mutable_state().PushErrorAtPosition("'['");
+        return;
+    }
+    JsonArrayReader array_reader(&tokenizer);
+    if (!array_reader.NextElement()) return;
+    if (tokenizer.state().token_type == JsonTokenType::kLeftCurlyBracket) {
+      // The readable JSON format: an array of rows.
+      do {
+        T row{};
+        TypeAdapter<T>::Parse(tokenizer, row);
+        out.push_back(std::move(row));
+      } while (array_reader.NextElement());
+      return;
+    }
+    uint64_t size = 0;
+    ::soia_internal::Parse(tokenizer, size);
+    if (!CheckSize<T>(size, tokenizer.state().chars_left())) {
+      tokenizer.mutable_state().PushError(
+          "number of rows exceeds the length of the input");
+      return;
+    }
+    const std::vector<int>& field_index_by_number = GetFieldIndexByNumber<T>();
+    for (size_t number = 0; array_reader.NextElement(); ++number) {
+      const int field_index = number < field_index_by_number.size()
+                                  ? field_index_by_number[number]
+                                  : -1;
+      if (field_index < 0) {
+        SkipValue(tokenizer);
+        continue;
+      }
+      VisitColumn(out, field_index, [&](auto& column) {
+        TypeAdapter<std::decay_t<decltype(column)>>::Parse(tokenizer, column);
+        if (!ResizeColumn(column, size)) {
+          tokenizer.mutable_state().PushError(
+              "column length does not match the number of rows");
+        }
+      });
+    }
+    if (!tokenizer.state().status.ok()) return;
+    FinishParse(size, out);
+  }
+
+  template <typename T>
+  static void Parse(ByteSource& source, soia::columns<T>& out) {
+    out.clear();
+    uint32_t array_len = 0;
+    ParseArrayPrefix(source, array_len);
+    if (array_len == 0) return;
+    uint64_t size = 0;
+    ::soia_internal::Parse(source, size);
+    if (!CheckSize<T>(size, source.num_bytes_left())) {
+      return source.RaiseError();
+    }
+    const std::vector<int>& field_index_by_number = GetFieldIndexByNumber<T>();
+    for (size_t number = 0; number < array_len - 1 && !source.error;
+         ++number) {
+      const int field_index = number < field_index_by_number.size()
+                                  ? field_index_by_number[number]
+                                  : -1;
+      if (field_index < 0) {
+        SkipValue(source);
+        continue;
+      }
+      VisitColumn(out, field_index, [&](auto& column) {
+        TypeAdapter<std::decay_t<decltype(column)>>::Parse(source, column);
+        if (!ResizeColumn(column, size)) {
+          source.RaiseError();
+        }
+      });
+    }
+    if (source.error) return;
+    FinishParse(size, out);
+  }
+
+  template <typename T>
+  static soia::reflection::Type GetType(soia_type<soia::columns<T>>) {
+    return soia::reflection::ArrayType{soia_internal::GetType<T>()};
+  }
+
+  template <typename T>
+  static void RegisterRecords(soia_type<soia::columns<T>>,
+                              soia::reflection::RecordRegistry& registry) {
+    soia_internal::RegisterRecords<T>(registry);
+  }
+
+  static constexpr bool IsStruct() { return false; }
+  static constexpr bool IsEnum() { return false; }
+
+ private:
+  // Returns the index of each field in the fields tuple, by field number. The
+  // index of a removed number is -1.
+  template <typename T>
+  static const std::vector<int>& GetFieldIndexByNumber() {
+    static const std::vector<int>* const result = []() {
+      std::vector<absl::string_view> field_names;
+      soia::reflection::ForEachField<T>([&](auto field) {
+        using getter_type = typename decltype(field)::getter_type;
+        field_names.push_back(getter_type::kFieldName);
+      });
+      const std::vector<int> numbers = GetFieldNumbers(
+          soia::reflection::GetTypeDescriptor<T>(), field_names);
+      auto* result = new std::vector<int>();
+      for (size_t i = 0; i < numbers.size(); ++i) {
+        if (result->size() <= static_cast<size_t>(numbers[i])) {
+          result->resize(numbers[i] + 1, -1);
+        }
+        (*result)[numbers[i]] = i;
+      }
+      return result;
+    }();
+    return *result;
+  }
+
+  // Calls f(column) with the column at the given index in the fields tuple.
+  // Does nothing if the index is negative.
+  template <typename Columns, typename F>
+  static void VisitColumn(Columns& columns, int field_index, F&& f) {
+    std::apply(
+        [&](auto&... column) {
+          int i = 0;
+          ((i++ == field_index ? f(column) : void()), ...);
+        },
+        columns.columns_);
+  }
 
-inline ByteString ToBytes(const char* absl_nonnull input) {
-  return ToBytes(std::string(input));
-}
+  template <typename Column>
+  static bool IsAllDefault(const Column& column) {
+    using Value = typename Column::value_type;
+    for (const auto& value : column) {
+      if (!TypeAdapter<Value>::IsDefault(value)) return false;
+    }
+    return true;
+  }
 
-// Minimum absl::Time encodable as a soia timestamp.
-// Equal to 100M days before the Unix EPOCH.
-constexpr absl::Time kMinEncodedTimestamp =
-    absl::FromUnixMillis(-8640000000000000);
-// Maximum absl::Time encodable as a soia timestamp.
-// Equal to 100M days before the Unix EPOCH.
-constexpr absl::Time kMaxEncodedTimestamp =
-    absl::FromUnixMillis(8640000000000000);
+  // An empty column stands for a column of default values.
+  template <typename Column>
+  static bool ResizeColumn(Column& column, uint64_t size) {
+    if (column.size() == size) return true;
+    if (!column.empty()) return false;
+    column.resize(size);
+    return true;
+  }
 
-template <typename H, typename T>
-H AbslHashValue(H h, const rec<T>& rec) {
-  if (::soia_internal::RecAdapter::IsDefault(rec)) {
-    return H::combine(std::move(h), -6387689);
-  } else {
-    return H::combine(std::move(h), *rec);
+  // The number of rows is read from the input, and must not make the parser
+  // allocate columns of any size. Since at least one column is written in full
+  // (see GetColumnsInFull), every row takes at least one byte or char of the
+  // remaining input. A struct without fields has no column, so the number of
+  // its rows is capped instead.
+  template <typename T>
+  static bool CheckSize(uint64_t size, size_t input_left) {
+    using fields_tuple = typename TypeAdapter<T>::fields_tuple;
+    if constexpr (std::tuple_size_v<fields_tuple> == 0) {
+      return size <= kMaxNumRowsWithoutFields;
+    } else {
+      return size <= input_left;
+    }
   }
-}
 
-namespace reflection {
+  static constexpr uint64_t kMaxNumRowsWithoutFields = 1 << 16;
 
-template <typename T>
-const TypeDescriptor& GetTypeDescriptor() {
-  static const TypeDescriptor* result = []() -> const TypeDescriptor* {
-    RecordRegistry registry;
-    soia_internal::RegisterRecords<T>(registry);
-    return new TypeDescriptor{soia_internal::GetType<T>(), std::move(registry)};
-  }();
-  return *result;
-}
+  // Fills the columns of the fields which were not in the input.
+  template <typename T>
+  static void FinishParse(uint64_t size, soia::columns<T>& out) {
+    std::apply([&](auto&... column) { (ResizeColumn(column, size), ...); },
+               out.columns_);
+    out.size_ = size;
+  }
 
-template <typename T>
-constexpr bool IsStruct() {
-  return soia_internal::TypeAdapter<T>::IsStruct();
-}
+  // Returns whether to write the column of each field number in full, up to
+  // the last number to write: a column whose values are all default is written
+  // as an empty array. If all the columns are default, the column of the first
+  // field is written in full anyway, so the number of rows can be checked
+  // against the length of the input when parsing.
+  template <typename T>
+  static std::vector<bool> GetColumnsInFull(const soia::columns<T>& input) {
+    const std::vector<int>& field_index_by_number = GetFieldIndexByNumber<T>();
+    std::vector<bool> result(field_index_by_number.size());
+    size_t num_slots = 0;
+    for (size_t number = 0; number < result.size(); ++number) {
+      VisitColumn(input, field_index_by_number[number],
+                  [&](const auto& column) {
+                    result[number] = !IsAllDefault(column);
+                  });
+      if (result[number]) num_slots = number + 1;
+    }
+    if (num_slots == 0) {
+      for (size_t number = 0; number < result.size(); ++number) {
+        if (field_index_by_number[number] >= 0) {
+          result[number] = true;
+          num_slots = number + 1;
+          break;
+        }
+      }
+    }
+    result.resize(num_slots);
+    return result;
+  }
 
-template <typename T>
-constexpr bool IsEnum() {
-  return soia_internal::TypeAdapter<T>::IsEnum();
-}
+  template <typename T, typename Out>
+  static void AppendBytes(const soia::columns<T>& input, Out& out) {
+    if (input.empty()) {
+      out.Push(246);
+      return;
+    }
+    const std::vector<bool> columns_in_full = GetColumnsInFull(input);
+    AppendArrayPrefix(1 + columns_in_full.size(), out);
+    ::soia_internal::Append(static_cast<uint64_t>(input.size_), out);
+    const std::vector<int>& field_index_by_number = GetFieldIndexByNumber<T>();
+    for (size_t number = 0; number < columns_in_full.size(); ++number) {
+      const int field_index = field_index_by_number[number];
+      VisitColumn(input, field_index, [&](const auto& column) {
+        if (!columns_in_full[number]) {
+          out.Push(246);
+        } else {
+          TypeAdapter<std::decay_t<decltype(column)>>::Append(column, out);
+        }
+      });
+      if (field_index < 0) {
+        out.Push(0);
+      }
+    }
+  }
+};
 
 template <typename T>
-constexpr bool IsRecord() {
-  return IsStruct<T>() || IsEnum<T>();
-}
-
-// Calls f(field) for each field in the soia-generated datatype.
-// The type of the single argument passed to f is one of: struct_field,
-// enum_const_field, enum_wrapper_field.
-template <typename Record, typename F>
-void ForEachField(F&& f) {
-  static_assert(IsStruct<Record>() || IsEnum<Record>());
-  std::apply(
-      [&f](auto&&... x) {
-        (static_cast<void>(f(std::forward<decltype(x)>(x))), ...);
-      },
-      typename soia_internal::TypeAdapter<Record>::fields_tuple());
-}
+inline ColumnsAdapter GetAdapter(soia_type<soia::columns<T>>);
 
-}  // namespace reflection
-}  // namespace soia
+}  // namespace soia_internal
 
 namespace soia_internal {
 
-struct RequestBody {
+class RequestBody {
+ public:
   std::string method_name;
   absl::optional<int> method_number;
   bool readable = true;
+  bool binary = false;
   absl::string_view request_data;
 
-  absl::Status Parse(absl::string_view request_body);
+  absl::Status Parse(absl::string_view request_body,
+                     soia::UnrecognizedFieldsPolicy unrecognized_fields =
+                         soia::UnrecognizedFieldsPolicy::kDrop);
+
+  // Parses the request data into a value of type T.
+  // If the request is a JSON object where "method" comes before "request",
+  // RequestBody::Parse stops on the request value and this function parses it
+  // from the same tokenizer, so the request value is only scanned once.
+  template <typename T>
+  absl::StatusOr<T> ParseRequest(
+      soia::UnrecognizedFieldsPolicy unrecognized_fields) {
+    if (!request_data_pending_) {
+      return soia::Parse<T>(request_data, unrecognized_fields);
+    }
+    T result{};
+    soia_internal::Parse(*envelope_tokenizer_, result);
+    if (const absl::Status status = FinishEnvelope(); !status.ok()) {
+      return status;
+    }
+    return result;
+  }
+
+ private:
+  absl::Status ReadEnvelope();
+  absl::Status FinishEnvelope();
+
+  std::unique_ptr<JsonTokenizer> envelope_tokenizer_;
+  std::unique_ptr<JsonObjectReader> envelope_reader_;
+  bool request_data_pending_ = false;
+  bool request_data_parsed_ = false;
+};
+
+// Returns true if the given request body was sent by a client using
+// WireFormat::kBinary.
+bool IsBinaryRequest(absl::string_view request_body);
+
+// A batch request is "batch:" followed by, for each method invocation, the
+// length of its request body in decimal, ':' and the request body.
+// The response to a batch request contains, for each method invocation, the
+// HTTP status code, ':', the length of the response data in decimal, ':' and
+// the response data.
+inline bool IsBatchRequest(absl::string_view request_body) {
+  return absl::StartsWith(request_body, "batch:");
+}
+
+std::string EncodeBatchRequest(const std::vector<std::string>& request_bodies);
+
+absl::StatusOr<std::vector<absl::string_view>> ParseBatchRequest(
+    absl::string_view request_body);
+
+std::string EncodeBatchResponse(
+    const std::vector<soia::service::RawResponse>& responses);
+
+struct BatchItemResponse {
+  int status_code = 0;
+  absl::string_view data;
 };
 
+absl::StatusOr<std::vector<BatchItemResponse>> ParseBatchResponse(
+    absl::string_view response_data);
+
+// Fills in the response fields of `stats` and passes them to the observer, if
+// not null. If the response is streamed, the observer is only called once the
+// stream is fully written.
+soia::service::RawResponse ReportMethodCall(
+    soia::service::ServiceObserver* absl_nullable observer,
+    soia::service::MethodCallStats stats,
+    soia::service::RawResponse raw_response);
+
 struct MethodDescriptor {
   absl::string_view name;
   int number = 0;
@@ -2539,57 +5284,153 @@ constexpr absl::string_view kRestudioHtml = R"html(<!DOCTYPE html>
 </html>
 )html";
 
+template <typename ServiceImpl, typename Method, typename RequestMeta,
+          typename ResponseMeta>
+constexpr bool is_async_method_impl =
+    !std::is_invocable_v<ServiceImpl&, Method, typename Method::request_type,
+                         const RequestMeta&, ResponseMeta&> &&
+    std::is_invocable_v<
+        ServiceImpl&, Method, typename Method::request_type,
+        const RequestMeta&, ResponseMeta&,
+        soia::service::Responder<typename Method::response_type>>;
+
+template <typename ServiceImpl, typename MethodsTuple>
+struct has_async_method_impl;
+
+template <typename ServiceImpl, typename... Methods>
+struct has_async_method_impl<ServiceImpl, std::tuple<Methods...>> {
+  static constexpr bool value =
+      (is_async_method_impl<ServiceImpl, Methods, soia::service::HttpHeaders,
+                            soia::service::HttpHeaders> ||
+       ...);
+};
+
+// Serializes a request or a response to binary format. Unlike soia::ToBytes,
+// counts the bytes first and allocates the buffer once, because RPC payloads
+// can be large and growing a large buffer copies it several times.
+template <typename T>
+soia::ByteString ToRpcBytes(const T& input) {
+  return soia::ToBytes(input, soia::GetEncodedSize(input));
+}
+
+template <typename Response>
+soia::service::RawResponse MakeRawResponse(absl::StatusOr<Response> output,
+                                           bool binary, bool readable,
+                                           size_t stream_chunk_size = 0) {
+  if (!output.ok()) {
+    return {
+        absl::StrCat("server error: ", output.status().message()),
+        soia::service::ResponseType::kServerError,
+    };
+  }
+  if (binary) {
+    return {
+        ToRpcBytes(*output).as_string(),
+        soia::service::ResponseType::kOkBinary,
+    };
+  }
+  if (stream_chunk_size != 0) {
+    auto response = std::make_shared<const Response>(*std::move(output));
+    return {
+        "",
+        soia::service::ResponseType::kOkJson,
+        [response, readable, stream_chunk_size](
+            absl::FunctionRef<void(absl::string_view)> write) {
+          if (readable) {
+            soia::WriteReadableJson(*response, stream_chunk_size, write);
+          } else {
+            soia::WriteDenseJson(*response, stream_chunk_size, write);
+          }
+        },
+    };
+  }
+  return {
+      readable ? soia::ToReadableJson(*output) : soia::ToDenseJson(*output),
+      soia::service::ResponseType::kOkJson,
+  };
+}
+
 template <typename ServiceImpl, typename RequestMeta, typename ResponseMeta>
 class HandleRequestOp {
  public:
+  // Called with the response of an asynchronous method implementation.
+  using AsyncDone = absl::AnyInvocable<void(soia::service::RawResponse) &&>;
+
   HandleRequestOp(ServiceImpl* absl_nonnull service_impl,
                   absl::string_view request_body,
                   soia::UnrecognizedFieldsPolicy unrecognized_fields,
                   const RequestMeta* absl_nonnull request_meta,
-                  ResponseMeta* absl_nonnull response_meta)
+                  ResponseMeta* absl_nonnull response_meta,
+                  std::shared_ptr<AsyncDone> async_done = nullptr,
+                  soia::service::StreamingOptions streaming = {},
+                  soia::service::ServiceObserver* observer = nullptr)
       : service_impl_(*service_impl),
         request_body_(request_body),
         unrecognized_fields_(unrecognized_fields),
         request_meta_(*request_meta),
-        response_meta_(*response_meta) {}
-
-  soia::service::RawResponse Run() {
+        response_meta_(*response_meta),
+        async_done_(std::move(async_done)),
+        streaming_(streaming),
+        observer_(observer) {}
+
+  // Returns nullopt if the request was passed to an asynchronous method
+  // implementation, in which case the response is passed to `async_done`.
+  absl::optional<soia::service::RawResponse> Run() {
+    const DispatchTable& dispatch_table = GetDispatchTable();
     if (request_body_ == "" || request_body_ == "list") {
-      std::vector<MethodDescriptor> method_descriptors;
-      std::apply(
-          [&](auto... method) {
-            (method_descriptors.push_back(MakeMethodDescriptor(method)), ...);
-          },
-          typename ServiceImpl::methods());
-      return {
-          MethodListToJson(method_descriptors),
+      return soia::service::RawResponse{
+          dispatch_table.method_list_json,
           soia::service::ResponseType::kOkJson,
       };
     } else if (request_body_ == "debug" || request_body_ == "restudio") {
-      return {std::string(kRestudioHtml), soia::service::ResponseType::kOkHtml};
+      return soia::service::RawResponse{
+          std::string(kRestudioHtml),
+          soia::service::ResponseType::kOkHtml,
+      };
     }
 
-    if (const absl::Status status = request_body_parsed_.Parse(request_body_);
+    if (observer_ != nullptr) {
+      phase_start_ = absl::Now();
+      stats_.request_size = request_body_.size();
+    }
+    if (const absl::Status status =
+            request_body_parsed_.Parse(request_body_, unrecognized_fields_);
         !status.ok()) {
-      return {
-          absl::StrCat("bad request: ", status.message()),
-          soia::service::ResponseType::kBadRequest,
-      };
+      EndPhase(stats_.parse_time);
+      return ReportMethodCall(
+          observer_, stats_,
+          {
+              absl::StrCat("bad request: ", status.message()),
+              soia::service::ResponseType::kBadRequest,
+          });
     }
 
-    std::apply(
-        [&](auto... method) {
-          (static_cast<void>(MaybeInvokeMethod(method)), ...);
-        },
-        typename ServiceImpl::methods());
-    if (raw_response_.has_value()) {
-      return std::move(*raw_response_);
+    const absl::optional<int>& method_number =
+        request_body_parsed_.method_number;
+    absl::optional<size_t> method_index;
+    if (method_number.has_value()) {
+      const auto it = dispatch_table.number_to_index.find(*method_number);
+      if (it != dispatch_table.number_to_index.end()) {
+        method_index = it->second;
+      }
+    } else {
+      const auto it = dispatch_table.name_to_index.find(
+          request_body_parsed_.method_name);
+      if (it != dispatch_table.name_to_index.end()) {
+        method_index = it->second;
+      }
     }
-    return {
-        absl::StrCat(
-            "bad request: method not found: ", request_body_parsed_.method_name,
-            "; number: ", request_body_parsed_.method_number.value_or(-1)),
-        soia::service::ResponseType::kBadRequest};
+    if (method_index.has_value()) {
+      (this->*dispatch_table.invokers[*method_index])();
+      return std::move(raw_response_);
+    }
+    EndPhase(stats_.parse_time);
+    return ReportMethodCall(
+        observer_, stats_,
+        {absl::StrCat("bad request: method not found: ",
+                      request_body_parsed_.method_name, "; number: ",
+                      request_body_parsed_.method_number.value_or(-1)),
+         soia::service::ResponseType::kBadRequest});
   }
 
  private:
@@ -2598,60 +5439,174 @@ class HandleRequestOp {
   const soia::UnrecognizedFieldsPolicy unrecognized_fields_;
   const RequestMeta& request_meta_;
   ResponseMeta& response_meta_;
+  const std::shared_ptr<AsyncDone> async_done_;
+  const soia::service::StreamingOptions streaming_;
+  soia::service::ServiceObserver* const observer_;
 
   RequestBody request_body_parsed_;
 
   absl::optional<soia::service::RawResponse> raw_response_;
 
+  // Only used if there is an observer.
+  soia::service::MethodCallStats stats_;
+  absl::Time phase_start_;
+
+  // Adds the time since the end of the previous phase to `phase_time`.
+  void EndPhase(absl::Duration& phase_time) {
+    if (observer_ == nullptr) return;
+    const absl::Time now = absl::Now();
+    phase_time += now - phase_start_;
+    phase_start_ = now;
+  }
+
+  using Invoker = void (HandleRequestOp::*)();
+
+  // Built once per service type, on the first request.
+  struct DispatchTable {
+    // In the order of ServiceImpl::methods.
+    std::vector<Invoker> invokers;
+    absl::flat_hash_map<int, size_t> number_to_index;
+    absl::flat_hash_map<absl::string_view, size_t> name_to_index;
+    std::string method_list_json;
+  };
+
+  static const DispatchTable& GetDispatchTable() {
+    static const DispatchTable* const kDispatchTable = [] {
+      DispatchTable* const result = new DispatchTable();
+      std::vector<MethodDescriptor> method_descriptors;
+      std::apply(
+          [&](auto... method) {
+            (result->invokers.push_back(
+                 &HandleRequestOp::InvokeMethod<decltype(method)>),
+             ...);
+            (method_descriptors.push_back(MakeMethodDescriptor(method)), ...);
+          },
+          typename ServiceImpl::methods());
+      for (size_t i = 0; i < method_descriptors.size(); ++i) {
+        const MethodDescriptor& method = method_descriptors[i];
+        result->number_to_index.emplace(method.number, i);
+        // If multiple methods have the same name and the request does not
+        // specify the method number, the first one wins.
+        result->name_to_index.emplace(method.name, i);
+      }
+      result->method_list_json = MethodListToJson(method_descriptors);
+      return result;
+    }();
+    return *kDispatchTable;
+  }
+
   template <typename Method>
-  void MaybeInvokeMethod(Method method) {
-    using MethodType = decltype(method);
-    using RequestType = typename MethodType::request_type;
-    using ResponseType = typename MethodType::response_type;
-    if (request_body_parsed_.method_number.has_value()) {
-      if (MethodType::kNumber != *request_body_parsed_.method_number) return;
-    } else {
-      if (MethodType::kMethodName != request_body_parsed_.method_name) return;
-    }
-    if (raw_response_.has_value()) {
-      // Should only happen if multiple methods have the same name and the
-      // request does not specify the method number. We should probably return
-      // an error in this case.
-      return;
-    }
-    raw_response_.emplace();
-    absl::StatusOr<RequestType> request = soia::Parse<RequestType>(
-        request_body_parsed_.request_data, unrecognized_fields_);
+  void InvokeMethod() {
+    using RequestType = typename Method::request_type;
+    using ResponseType = typename Method::response_type;
+    stats_.method_name = Method::kMethodName;
+    stats_.method_number = Method::kNumber;
+    absl::StatusOr<RequestType> request =
+        request_body_parsed_.ParseRequest<RequestType>(
+            unrecognized_fields_);
+    EndPhase(stats_.parse_time);
     if (!request.ok()) {
-      raw_response_->data =
-          absl::StrCat("bad request: ", request.status().message());
-      raw_response_->type = soia::service::ResponseType::kBadRequest;
-      return;
-    }
-    absl::StatusOr<ResponseType> output = service_impl_(
-        method, std::move(*request), request_meta_, response_meta_);
-    if (!output.ok()) {
-      raw_response_->data =
-          absl::StrCat("server error: ", output.status().message());
-      raw_response_->type = soia::service::ResponseType::kServerError;
+      raw_response_ = ReportMethodCall(
+          observer_, stats_,
+          {
+              absl::StrCat("bad request: ", request.status().message()),
+              soia::service::ResponseType::kBadRequest,
+          });
       return;
     }
-    if (request_body_parsed_.readable) {
-      raw_response_->data = soia::ToReadableJson(*output);
-      raw_response_->type = soia::service::ResponseType::kOkJson;
+    if constexpr (is_async_method_impl<ServiceImpl, Method, RequestMeta,
+                                       ResponseMeta>) {
+      ABSL_CHECK_NE(async_done_, nullptr);
+      service_impl_(
+          Method(), std::move(*request), request_meta_, response_meta_,
+          soia::service::Responder<ResponseType>(
+              [async_done = async_done_,
+               binary = request_body_parsed_.binary,
+               readable = request_body_parsed_.readable,
+               observer = observer_, stats = stats_,
+               handler_start = phase_start_](
+                  absl::StatusOr<ResponseType> output) mutable {
+                absl::Time serialize_start;
+                if (observer != nullptr) {
+                  serialize_start = absl::Now();
+                  stats.handler_time = serialize_start - handler_start;
+                }
+                soia::service::RawResponse raw_response =
+                    MakeRawResponse(std::move(output), binary, readable);
+                if (observer != nullptr) {
+                  stats.serialize_time = absl::Now() - serialize_start;
+                }
+                std::move(*async_done)(ReportMethodCall(
+                    observer, stats, std::move(raw_response)));
+              }));
     } else {
-      raw_response_->data = soia::ToDenseJson(*output);
-      raw_response_->type = soia::service::ResponseType::kOkJson;
+      absl::StatusOr<ResponseType> output = service_impl_(
+          Method(), std::move(*request), request_meta_, response_meta_);
+      EndPhase(stats_.handler_time);
+      soia::service::RawResponse raw_response = MakeRawResponse(
+          std::move(output), request_body_parsed_.binary,
+          request_body_parsed_.readable, streaming_.chunk_size);
+      EndPhase(stats_.serialize_time);
+      raw_response_ =
+          ReportMethodCall(observer_, stats_, std::move(raw_response));
     }
   }
 };
 
+template <typename ServiceImpl>
+soia::service::RawResponse HandleBatchRequest(
+    ServiceImpl& service_impl, absl::string_view request_body,
+    soia::UnrecognizedFieldsPolicy unrecognized_fields,
+    const soia::service::HttpHeaders& request_headers,
+    soia::service::HttpHeaders& response_headers,
+    soia::service::ServiceObserver* absl_nullable observer) {
+  absl::StatusOr<std::vector<absl::string_view>> request_bodies =
+      ParseBatchRequest(request_body);
+  if (!request_bodies.ok()) {
+    return {
+        absl::StrCat("bad request: ", request_bodies.status().message()),
+        soia::service::ResponseType::kBadRequest,
+    };
+  }
+  std::vector<soia::service::RawResponse> responses;
+  responses.reserve(request_bodies->size());
+  for (const absl::string_view item_request_body : *request_bodies) {
+    responses.push_back(*HandleRequestOp(&service_impl, item_request_body,
+                                         unrecognized_fields, &request_headers,
+                                         &response_headers, nullptr, {},
+                                         observer)
+                             .Run());
+  }
+  return {
+      EncodeBatchResponse(responses),
+      soia::service::ResponseType::kOkBatch,
+  };
+}
+
+template <typename Method>
+std::string MakeRequestData(Method method,
+                            const typename Method::request_type& request,
+                            soia::service::WireFormat wire_format) {
+  if (wire_format == soia::service::WireFormat::kBinary) {
+    return absl::StrCat(Method::kMethodName, ":", Method::kNumber,
+                        ":binary:", ToRpcBytes(request).as_string());
+  }
+  return absl::StrCat(Method::kMethodName, ":", Method::kNumber, "::",
+                      soia::ToDenseJson(request));
+}
+
 template <typename HttplibClientPtr>
 class HttplibClient : public soia::service::Client {
  public:
   HttplibClient(HttplibClientPtr client, std::string query_path)
       : client_(std::move(ABSL_DIE_IF_NULL(client))), query_path_(query_path) {}
 
+  // Waits for the RPCs sent with SendAsync to complete.
+  ~HttplibClient() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    no_pending_rpc_.wait(lock, [this] { return num_pending_rpcs_ == 0; });
+  }
+
   absl::StatusOr<std::string> operator()(
       absl::string_view request_data,
       const soia::service::HttpHeaders& request_headers,
@@ -2659,9 +5614,11 @@ class HttplibClient : public soia::service::Client {
     auto headers =
         decltype(std::declval<HttplibClientPtr>()->Get("")->headers)();
     SoiaToHttplibHeaders(request_headers, headers);
-    auto result =
-        client_->Post(query_path_, headers, request_data.data(),
-                      request_data.length(), "text/plain; charset=utf-8");
+    const bool binary =
+        IsBinaryRequest(request_data) || IsBatchRequest(request_data);
+    auto result = client_->Post(
+        query_path_, headers, request_data.data(), request_data.length(),
+        binary ? "application/octet-stream" : "text/plain; charset=utf-8");
     if (result) {
       response_headers = HttplibToSoiaHeaders(result->headers);
       const int status_code = result->status;
@@ -2688,9 +5645,40 @@ class HttplibClient : public soia::service::Client {
     }
   }
 
+  // Sends the RPC from a new thread, since the httplib::Client only has a
+  // blocking API. The httplib::Client serializes the requests sent from
+  // different threads.
+  void SendAsync(
+      absl::string_view request_data,
+      const soia::service::HttpHeaders& request_headers,
+      absl::AnyInvocable<void(absl::StatusOr<std::string>,
+                              soia::service::HttpHeaders) &&>
+          done) const override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++num_pending_rpcs_;
+    }
+    std::thread([this, request_data = std::string(request_data),
+                 request_headers = request_headers,
+                 done = std::move(done)]() mutable {
+      soia::service::HttpHeaders response_headers;
+      absl::StatusOr<std::string> response_data =
+          (*this)(request_data, request_headers, response_headers);
+      std::move(done)(std::move(response_data), std::move(response_headers));
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_pending_rpcs_ == 0) {
+        no_pending_rpc_.notify_all();
+      }
+    }).detach();
+  }
+
  private:
   const HttplibClientPtr client_;
   const std::string query_path_;
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable no_pending_rpc_;
+  mutable int num_pending_rpcs_ = 0;
 };
 
 }  // namespace soia_internal
@@ -2746,20 +5734,143 @@ namespace service {
 // request's body. The query string is the part of the URL after '?', and it can
 // be decoded with DecodeUrlQueryString.
 //
+// The request can also be a batch of method invocations sent by RpcBatch. The
+// method invocations are processed in order and share the request and response
+// headers.
+//
 // Pass in UnrecognizedFieldsPolicy::kKeep if the request is guaranteed to come
 // from a trusted user.
+//
+// If `observer` is not null, it receives the metrics of the method invocation.
+// It must outlive the response stream, if any. Without an observer, no time is
+// measured.
 template <typename ServiceImpl>
 RawResponse HandleRequest(ServiceImpl& service_impl,
                           absl::string_view request_body,
                           const HttpHeaders& request_headers,
                           HttpHeaders& response_headers,
                           UnrecognizedFieldsPolicy unrecognized_fields =
-                              UnrecognizedFieldsPolicy::kDrop) {
+                              UnrecognizedFieldsPolicy::kDrop,
+                          const StreamingOptions& streaming = {},
+                          ServiceObserver* absl_nullable observer = nullptr) {
+  soia_internal::assert_unique_method_numbers<typename ServiceImpl::methods>();
+  static_assert(!soia_internal::has_async_method_impl<
+                    ServiceImpl, typename ServiceImpl::methods>::value,
+                "Use HandleRequestAsync");
+  if (soia_internal::IsBatchRequest(request_body)) {
+    return soia_internal::HandleBatchRequest(
+        service_impl, request_body, unrecognized_fields, request_headers,
+        response_headers, observer);
+  }
+  return *soia_internal::HandleRequestOp(&service_impl, request_body,
+                                         unrecognized_fields, &request_headers,
+                                         &response_headers, nullptr, streaming,
+                                         observer)
+              .Run();
+}
+
+// Same as HandleRequest, but the service implementation can implement methods
+// asynchronously, with this signature:
+//   void operator()(
+//       Method method,
+//       typename Method::request_type request,
+//       const HttpHeaders& request_headers,
+//       HttpHeaders& response_headers,
+//       Responder<typename Method::response_type> responder);
+//
+// The method implementation can return before the response is ready, for
+// example while it waits for responses from other services, as long as it
+// eventually calls `responder`. The request headers and the response headers
+// remain valid until then.
+//
+// Calls `done` with the response and the response headers, possibly from
+// another thread. The service implementation must outlive the call to `done`.
+//
+// The method invocations of a batch request share the response headers. If
+// they complete on different threads, they must synchronize their writes to
+// the response headers.
+//
+// The observer, if not null, must outlive the call to `done`.
+template <typename ServiceImpl>
+void HandleRequestAsync(
+    ServiceImpl& service_impl, std::string request_body,
+    HttpHeaders request_headers,
+    absl::AnyInvocable<void(RawResponse, HttpHeaders response_headers) &&> done,
+    UnrecognizedFieldsPolicy unrecognized_fields =
+        UnrecognizedFieldsPolicy::kDrop,
+    ServiceObserver* absl_nullable observer = nullptr) {
   soia_internal::assert_unique_method_numbers<typename ServiceImpl::methods>();
-  return soia_internal::HandleRequestOp(&service_impl, request_body,
-                                        unrecognized_fields, &request_headers,
-                                        &response_headers)
-      .Run();
+  struct State {
+    std::string request_body;
+    HttpHeaders request_headers;
+    HttpHeaders response_headers;
+  };
+  std::shared_ptr<State> state = std::make_shared<State>(
+      State{std::move(request_body), std::move(request_headers), {}});
+  using Op = soia_internal::HandleRequestOp<ServiceImpl, HttpHeaders,
+                                            HttpHeaders>;
+  if (soia_internal::IsBatchRequest(state->request_body)) {
+    absl::StatusOr<std::vector<absl::string_view>> request_bodies =
+        soia_internal::ParseBatchRequest(state->request_body);
+    if (!request_bodies.ok()) {
+      std::move(done)(
+          {absl::StrCat("bad request: ", request_bodies.status().message()),
+           ResponseType::kBadRequest},
+          {});
+      return;
+    }
+    struct BatchState {
+      std::shared_ptr<State> state;
+      absl::AnyInvocable<void(RawResponse, HttpHeaders) &&> done;
+      std::vector<RawResponse> responses;
+      std::atomic<size_t> num_pending;
+    };
+    auto batch_state = std::make_shared<BatchState>();
+    batch_state->state = state;
+    batch_state->done = std::move(done);
+    batch_state->responses.resize(request_bodies->size());
+    // One extra for the loop below, so `done` is not called before all the
+    // method invocations have started.
+    batch_state->num_pending = request_bodies->size() + 1;
+    const auto complete_one = [batch_state]() {
+      if (--batch_state->num_pending == 0) {
+        std::move(batch_state->done)(
+            {soia_internal::EncodeBatchResponse(batch_state->responses),
+             ResponseType::kOkBatch},
+            std::move(batch_state->state->response_headers));
+      }
+    };
+    for (size_t i = 0; i < request_bodies->size(); ++i) {
+      auto item_done = std::make_shared<typename Op::AsyncDone>(
+          [batch_state, complete_one, i](RawResponse raw_response) {
+            batch_state->responses[i] = std::move(raw_response);
+            complete_one();
+          });
+      absl::optional<RawResponse> raw_response =
+          Op(&service_impl, (*request_bodies)[i], unrecognized_fields,
+             &state->request_headers, &state->response_headers, item_done, {},
+             observer)
+              .Run();
+      if (raw_response.has_value()) {
+        std::move(*item_done)(std::move(*raw_response));
+      }
+    }
+    complete_one();
+    return;
+  }
+  auto async_done = std::make_shared<typename Op::AsyncDone>(
+      [state, done = std::move(done)](RawResponse raw_response) mutable {
+        std::move(done)(std::move(raw_response),
+                        std::move(state->response_headers));
+      });
+  absl::optional<RawResponse> raw_response =
+      Op(&service_impl, state->request_body, unrecognized_fields,
+         &state->request_headers, &state->response_headers, async_done, {},
+         observer)
+          .Run();
+  if (raw_response.has_value()) {
+    std::move(*async_done)(std::move(*raw_response));
+  }
 }
 
 // Decodes the given query string encoded with Javascript's
@@ -2777,15 +5888,31 @@ absl::StatusOr<std::string> DecodeUrlQueryString(
 //
 // Pass in UnrecognizedFieldsPolicy::kKeep if the request is guaranteed to come
 // from a trusted user.
+//
+// With a non-zero StreamingOptions::chunk_size, JSON responses are sent with
+// chunked transfer encoding while they are serialized. If cpp-httplib is built
+// with CPPHTTPLIB_ZLIB_SUPPORT or CPPHTTPLIB_ZSTD_SUPPORT, it compresses the
+// chunks when the client accepts gzip or zstd.
+//
+// If `observer` is not null, it receives the metrics of every method
+// invocation. See ServiceObserver.
+//
+// ServiceImpl can also implement methods asynchronously, as described in the
+// documentation for HandleRequestAsync. Since httplib::Server handlers are
+// synchronous, the server thread then waits for the response, and the response
+// is not streamed.
 template <typename HttplibServer, typename ServiceImpl>
 void InstallServiceOnHttplibServer(
     HttplibServer& server, absl::string_view query_path,
     std::shared_ptr<ServiceImpl> service_impl,
     UnrecognizedFieldsPolicy unrecognized_fields =
-        UnrecognizedFieldsPolicy::kDrop) {
+        UnrecognizedFieldsPolicy::kDrop,
+    StreamingOptions streaming = {},
+    std::shared_ptr<ServiceObserver> observer = nullptr) {
   ABSL_CHECK_NE(service_impl, nullptr);
   const typename HttplibServer::Handler handler =  //
-      [service_impl, unrecognized_fields](const auto& req, auto& resp) {
+      [service_impl, unrecognized_fields, streaming, observer](
+          const auto& req, auto& resp) {
         const HttpHeaders request_headers =
             soia_internal::HttplibToSoiaHeaders(req.headers);
         HttpHeaders response_headers;
@@ -2804,13 +5931,48 @@ void InstallServiceOnHttplibServer(
               DecodeUrlQueryString(query_string).value_or("");
           request_body = decoded_query_string;
         }
-        RawResponse raw_response =
-            HandleRequest(*service_impl, request_body, request_headers,
-                          response_headers, unrecognized_fields);
+        RawResponse raw_response;
+        if constexpr (soia_internal::has_async_method_impl<
+                          ServiceImpl, typename ServiceImpl::methods>::value) {
+          std::promise<std::pair<RawResponse, HttpHeaders>> promise;
+          std::future<std::pair<RawResponse, HttpHeaders>> future =
+              promise.get_future();
+          HandleRequestAsync(
+              *service_impl, std::string(request_body), request_headers,
+              [promise = std::move(promise)](
+                  RawResponse raw_response,
+                  HttpHeaders response_headers) mutable {
+                promise.set_value(
+                    {std::move(raw_response), std::move(response_headers)});
+              },
+              unrecognized_fields, observer.get());
+          std::tie(raw_response, response_headers) = future.get();
+        } else {
+          raw_response = HandleRequest(*service_impl, request_body,
+                                       request_headers, response_headers,
+                                       unrecognized_fields, streaming,
+                                       observer.get());
+        }
         soia_internal::SoiaToHttplibHeaders(response_headers, resp.headers);
 
-        resp.set_content(std::move(raw_response.data),
-                         std::string(raw_response.content_type()));
+        if (raw_response.stream) {
+          resp.set_chunked_content_provider(
+              std::string(raw_response.content_type()),
+              [stream = std::move(raw_response.stream)](size_t,
+                                                        auto& sink) {
+                bool ok = true;
+                stream([&](absl::string_view chunk) {
+                  ok = ok && sink.write(chunk.data(), chunk.length());
+                });
+                if (ok) {
+                  sink.done();
+                }
+                return ok;
+              });
+        } else {
+          resp.set_content(std::move(raw_response.data),
+                           std::string(raw_response.content_type()));
+        }
         resp.status = raw_response.status_code();
       };
   server.Get(std::string(query_path), handler);
@@ -2820,14 +5982,17 @@ void InstallServiceOnHttplibServer(
 // Invokes the given method on a remote server through an RPC.
 // Returns an error status if there was a network error or if the server
 // returned an error.
+//
+// Pass in WireFormat::kBinary for service-to-service RPCs.
 template <typename Method>
 absl::StatusOr<typename Method::response_type> InvokeRemote(
     const Client& client, Method method,
     const typename Method::request_type& request,
     const HttpHeaders& request_headers = {},
-    HttpHeaders* absl_nonnull response_headers = nullptr) {
-  const std::string request_data = absl::StrCat(
-      Method::kMethodName, ":", Method::kNumber, "::", ToDenseJson(request));
+    HttpHeaders* absl_nonnull response_headers = nullptr,
+    WireFormat wire_format = WireFormat::kJson) {
+  const std::string request_data =
+      soia_internal::MakeRequestData(method, request, wire_format);
   HttpHeaders response_headers_tmp;
   absl::StatusOr<std::string> response_data =
       client(request_data, request_headers, response_headers_tmp);
@@ -2841,6 +6006,109 @@ absl::StatusOr<typename Method::response_type> InvokeRemote(
                                                UnrecognizedFieldsPolicy::kKeep);
 }
 
+// Same as InvokeRemote, but returns immediately if the client supports
+// asynchronous RPCs, and calls `done` with the response and the response
+// headers once the response is received. See Client::SendAsync.
+template <typename Method>
+void InvokeRemoteAsync(
+    const Client& client, Method method,
+    const typename Method::request_type& request,
+    absl::AnyInvocable<void(absl::StatusOr<typename Method::response_type>,
+                            HttpHeaders response_headers) &&>
+        done,
+    const HttpHeaders& request_headers = {},
+    WireFormat wire_format = WireFormat::kJson) {
+  using ResponseType = typename Method::response_type;
+  const std::string request_data =
+      soia_internal::MakeRequestData(method, request, wire_format);
+  client.SendAsync(
+      request_data, request_headers,
+      [done = std::move(done)](absl::StatusOr<std::string> response_data,
+                               HttpHeaders response_headers) mutable {
+        absl::StatusOr<ResponseType> response =
+            response_data.ok()
+                ? Parse<ResponseType>(*response_data,
+                                      UnrecognizedFieldsPolicy::kKeep)
+                : absl::StatusOr<ResponseType>(
+                      std::move(response_data).status());
+        std::move(done)(std::move(response), std::move(response_headers));
+      });
+}
+
+// Sends multiple RPCs to a soia service in a single round trip.
+//
+// Example:
+//
+//   RpcBatch batch;
+//   const RpcBatch::Ticket<GetUser> alice = batch.Add(GetUser(), {.id = 1});
+//   const RpcBatch::Ticket<GetUser> bob = batch.Add(GetUser(), {.id = 2});
+//   if (const absl::Status status = batch.Send(client); !status.ok()) {
+//     ...
+//   }
+//   absl::StatusOr<GetUserResponse> alice_response = batch.Get(alice);
+//
+// Send returns an error status if there was a network error, or if the server
+// does not support batches. Each method invocation can then fail separately.
+class RpcBatch {
+ public:
+  RpcBatch() = default;
+  // Not copyable or movable, because responses point into response_data_.
+  RpcBatch(const RpcBatch&) = delete;
+  RpcBatch& operator=(const RpcBatch&) = delete;
+
+  // Identifies a method invocation within a batch.
+  template <typename Method>
+  class Ticket {
+   public:
+    size_t index() const { return index_; }
+
+   private:
+    explicit Ticket(size_t index) : index_(index) {}
+    size_t index_;
+
+    friend class RpcBatch;
+  };
+
+  template <typename Method>
+  Ticket<Method> Add(Method method,
+                     const typename Method::request_type& request,
+                     WireFormat wire_format = WireFormat::kJson) {
+    ABSL_CHECK(!sent_);
+    request_bodies_.push_back(
+        soia_internal::MakeRequestData(method, request, wire_format));
+    return Ticket<Method>(request_bodies_.size() - 1);
+  }
+
+  size_t size() const { return request_bodies_.size(); }
+
+  absl::Status Send(const Client& client,
+                    const HttpHeaders& request_headers = {},
+                    HttpHeaders* absl_nullable response_headers = nullptr);
+
+  // Returns the response to the given method invocation.
+  // Send must have returned an OK status.
+  template <typename Method>
+  absl::StatusOr<typename Method::response_type> Get(
+      Ticket<Method> ticket) const {
+    ABSL_CHECK_LT(ticket.index_, responses_.size());
+    const soia_internal::BatchItemResponse& response =
+        responses_[ticket.index_];
+    if (response.status_code < 200 || response.status_code > 299) {
+      return absl::UnknownError(absl::StrCat(
+          "HTTP response status ", response.status_code, ": ", response.data));
+    }
+    return Parse<typename Method::response_type>(
+        response.data, UnrecognizedFieldsPolicy::kKeep);
+  }
+
+ private:
+  std::vector<std::string> request_bodies_;
+  bool sent_ = false;
+  std::string response_data_;
+  // Point to response_data_.
+  std::vector<soia_internal::BatchItemResponse> responses_;
+};
+
 // Returns a client for sending RPCs to a soia service via the given
 // httplib::Client.
 // The httplib::Client type is referred to as a template parameter so as not to
@@ -390,6 +390,14 @@ class Reserializer {
       // Don't return.
     }
 
+    const size_t encoded_size = soia::GetEncodedSize(subject_);
+    if (encoded_size != actual_bytes.length()) {
+      errors.Push("GetEncodedSize() doesn't match length of ToBytes()",
+                  {{"expected", absl::StrCat(actual_bytes.length())},
+                   {"actual", absl::StrCat(encoded_size)}});
+      // Don't return.
+    }
+
     absl::StatusOr<T> reserialized = soia::Parse<T>(actual_bytes);
     if (!reserialized.ok()) {
       errors.Push("Parse(ToBytes()) returned an error",
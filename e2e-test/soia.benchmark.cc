@@ -0,0 +1,152 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "soia.h"
+
+namespace {
+
+struct get_id {
+  template <typename T>
+  auto&& operator()(T&& input) const {
+    return std::forward<T>(input).id;
+  }
+};
+
+struct User {
+  std::string id;
+  std::string name;
+};
+
+struct Point {
+  int64_t id = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+};
+
+soia::keyed_items<User, get_id> MakeUsers(int64_t num_users) {
+  soia::keyed_items<User, get_id> users;
+  for (int64_t i = 0; i < num_users; ++i) {
+    users.push_back({
+        .id = absl::StrCat("user_", i),
+        .name = absl::StrCat("name_", i),
+    });
+  }
+  return users;
+}
+
+soia::keyed_items<Point, get_id> MakePoints(int64_t num_points) {
+  soia::keyed_items<Point, get_id> points;
+  for (int64_t i = 0; i < num_points; ++i) {
+    points.push_back({.id = i * 7919});
+  }
+  return points;
+}
+
+void BM_KeyedItemsPushBack(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakeUsers(state.range(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyedItemsPushBack)->Range(8, 1 << 16);
+
+void BM_KeyedItemsFindStringKey(benchmark::State& state) {
+  const soia::keyed_items<User, get_id> users = MakeUsers(state.range(0));
+  std::vector<std::string> keys;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    keys.push_back(absl::StrCat("user_", (i * 7919) % state.range(0)));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(users.find_or_null(keys[i]));
+    if (++i == keys.size()) i = 0;
+  }
+}
+BENCHMARK(BM_KeyedItemsFindStringKey)->Range(8, 1 << 20);
+
+void BM_KeyedItemsFindStringKeyMiss(benchmark::State& state) {
+  const soia::keyed_items<User, get_id> users = MakeUsers(state.range(0));
+  std::vector<std::string> keys;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    keys.push_back(absl::StrCat("missing_", i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(users.find_or_null(keys[i]));
+    if (++i == keys.size()) i = 0;
+  }
+}
+BENCHMARK(BM_KeyedItemsFindStringKeyMiss)->Range(8, 1 << 20);
+
+void BM_KeyedItemsFindIntKey(benchmark::State& state) {
+  const soia::keyed_items<Point, get_id> points = MakePoints(state.range(0));
+  int64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(points.find_or_null(i * 7919));
+    if (++i == state.range(0)) i = 0;
+  }
+}
+BENCHMARK(BM_KeyedItemsFindIntKey)->Range(8, 1 << 20);
+
+std::vector<std::string> MakeStrings(int64_t num_strings) {
+  std::vector<std::string> strings;
+  for (int64_t i = 0; i < num_strings; ++i) {
+    strings.push_back(absl::StrCat("name_", i, "_pokémon"));
+  }
+  return strings;
+}
+
+std::vector<int64_t> MakeNumbers(int64_t num_numbers) {
+  std::vector<int64_t> numbers;
+  for (int64_t i = 0; i < num_numbers; ++i) {
+    numbers.push_back(i * 7919);
+  }
+  return numbers;
+}
+
+void BM_ToBytesStrings(benchmark::State& state) {
+  const std::vector<std::string> strings = MakeStrings(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::ToBytes(strings));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToBytesStrings)->Range(8, 1 << 16);
+
+// Sizes the buffer exactly with GetEncodedSize before encoding.
+void BM_ToBytesStringsExactSize(benchmark::State& state) {
+  const std::vector<std::string> strings = MakeStrings(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        soia::ToBytes(strings, soia::GetEncodedSize(strings)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToBytesStringsExactSize)->Range(8, 1 << 16);
+
+void BM_ToBytesNumbers(benchmark::State& state) {
+  const std::vector<int64_t> numbers = MakeNumbers(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::ToBytes(numbers));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToBytesNumbers)->Range(8, 1 << 16);
+
+// Sizes the buffer exactly with GetEncodedSize before encoding.
+void BM_ToBytesNumbersExactSize(benchmark::State& state) {
+  const std::vector<int64_t> numbers = MakeNumbers(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        soia::ToBytes(numbers, soia::GetEncodedSize(numbers)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToBytesNumbersExactSize)->Range(8, 1 << 16);
+
+}  // namespace
@@ -2,9 +2,14 @@
 
 #include <gtest/gtest.h>
 
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
@@ -23,8 +28,11 @@ using ::absl_testing::IsOkAndHolds;
 using ::soia_testing_internal::HexToBytes;
 using ::soia_testing_internal::MakeReserializer;
 using ::testing::ElementsAre;
+using ::testing::HasSubstr;
 using ::testing::IsEmpty;
+using ::testing::Not;
 using ::testing::Pair;
+using ::testing::Pointee;
 using ::testing::UnorderedElementsAre;
 
 TEST(SoialibTest, RecZeroArgCtor) {
@@ -320,6 +328,64 @@ TEST(SoiaLibTest, KeyedItemsSwap) {
   EXPECT_EQ(users_2[0].id, "a");
 }
 
+TEST(SoiaLibTest, KeyedItemsIncrementalUpdates) {
+  soia::keyed_items<User, get_id> users;
+  for (int i = 0; i < 300; ++i) {
+    users.push_back({
+        .id = absl::StrCat("id_", i),
+        .name = absl::StrCat("name_", i),
+    });
+  }
+  users.push_back({.id = "id_7", .name = "duplicate_7"});
+
+  users.mutate_at(10, [](User& user) { user.name = "renamed_10"; });
+  EXPECT_EQ(users.find_or_default("id_10").name, "renamed_10");
+  users.mutate_at(11, [](User& user) { user.id = "id_moved"; });
+  EXPECT_EQ(users.find_or_null("id_11"), nullptr);
+  EXPECT_EQ(users.find_or_default("id_moved").name, "name_11");
+  // The first item with a given key is still found first.
+  users.mutate_at(12, [](User& user) { user.id = "id_7"; });
+  EXPECT_EQ(users.find_or_default("id_7").name, "name_7");
+  users.mutate_at(7, [](User& user) { user.id = "id_gone"; });
+  EXPECT_EQ(users.find_or_default("id_7").name, "name_12");
+  // The hash table is updated even if the function throws.
+  EXPECT_THROW(users.mutate_at(13,
+                               [](User& user) {
+                                 user.id = "id_thrown";
+                                 throw std::runtime_error("error");
+                               }),
+               std::runtime_error);
+  EXPECT_EQ(users.find_or_default("id_thrown").name, "name_13");
+  users.mutate_at(13, [](User& user) { user.id = "id_13"; });
+  EXPECT_EQ(users.find_or_default("id_13").name, "name_13");
+
+  EXPECT_EQ(users.emplace_or_assign_by_key({.id = "id_20", .name = "new_20"})
+                .name,
+            "new_20");
+  EXPECT_EQ(users[20].name, "new_20");
+  users.emplace_or_assign_by_key({.id = "id_300", .name = "name_300"});
+  ASSERT_EQ(users.size(), 302);
+  EXPECT_EQ(users.back().id, "id_300");
+
+  EXPECT_FALSE(users.erase_by_key("id_foo"));
+  EXPECT_TRUE(users.erase_by_key("id_0"));
+  users.erase_at(0);
+  ASSERT_EQ(users.size(), 300);
+  EXPECT_EQ(users[0].id, "id_2");
+  EXPECT_EQ(users.find_or_null("id_0"), nullptr);
+  EXPECT_EQ(users.find_or_null("id_1"), nullptr);
+  for (int i = 2; i <= 300; ++i) {
+    if (i == 7 || i == 11 || i == 12) continue;
+    const std::string id = absl::StrCat("id_", i);
+    const User* user = users.find_or_null(id);
+    ASSERT_NE(user, nullptr) << id;
+    EXPECT_EQ(user->id, id);
+  }
+  EXPECT_EQ(users.find_or_default("id_7").name, "name_12");
+  EXPECT_TRUE(users.erase_by_key("id_7"));
+  EXPECT_EQ(users.find_or_default("id_7").name, "duplicate_7");
+}
+
 TEST(SoiaLibTest, KeyedItemsSortByKey) {
   soia::keyed_items<User, get_id> users = {
       {
@@ -437,24 +503,54 @@ TEST(SoialibTest, ParseJsonString) {
   auto tokenizer = MakeJsonTokenizer("\"Foo\"");
   EXPECT_EQ(tokenizer->tokenizer->Next(),
             soia_internal::JsonTokenType::kString);
-  EXPECT_EQ(tokenizer->tokenizer->state().string_value, "Foo");
+  EXPECT_EQ(tokenizer->tokenizer->state().string_value(), "Foo");
 
   tokenizer = MakeJsonTokenizer(
       "\"Foo \\n\\r\\t\\f \\\\ \t \\\"\\' \\/ \\u0010 😊 \\uD801\\uDC01 \"");
   EXPECT_EQ(tokenizer->tokenizer->Next(),
             soia_internal::JsonTokenType::kString);
-  EXPECT_EQ(tokenizer->tokenizer->state().string_value,
+  EXPECT_EQ(tokenizer->tokenizer->state().string_value(),
             "Foo \n\r\t\f \\ \t \"' / \x10 \xF0\x9F\x98\x8A \xF0\x90\x90\x81 ");
 
   tokenizer = MakeJsonTokenizer("\"\\u0000\"");
   EXPECT_EQ(tokenizer->tokenizer->Next(),
             soia_internal::JsonTokenType::kString);
-  EXPECT_EQ(tokenizer->tokenizer->state().string_value, std::string({'\0'}));
+  EXPECT_EQ(tokenizer->tokenizer->state().string_value(), std::string({'\0'}));
 
   tokenizer = MakeJsonTokenizer("\"\xc3z\"");
   EXPECT_EQ(tokenizer->tokenizer->Next(),
             soia_internal::JsonTokenType::kString);
-  EXPECT_EQ(tokenizer->tokenizer->state().string_value, "�z");
+  EXPECT_EQ(tokenizer->tokenizer->state().string_value(), "�z");
+}
+
+TEST(SoialibTest, ParseLongJsonTokens) {
+  // Long enough to exercise the vectorized scanning paths.
+  const std::string long_ascii = "The quick brown fox jumps over the lazy dog.";
+  auto tokenizer = MakeJsonTokenizer(
+      absl::StrCat("  \n\t\r                    \"", long_ascii,
+                   "\"\n                                  ,"));
+  EXPECT_EQ(tokenizer->tokenizer->Next(),
+            soia_internal::JsonTokenType::kString);
+  EXPECT_EQ(tokenizer->tokenizer->state().string_value(), long_ascii);
+  EXPECT_EQ(tokenizer->tokenizer->Next(), soia_internal::JsonTokenType::kComma);
+  EXPECT_EQ(tokenizer->tokenizer->Next(),
+            soia_internal::JsonTokenType::kStrEnd);
+
+  for (int i = 0; i <= 40; i += 5) {
+    std::string with_escape = long_ascii;
+    with_escape.insert(i, "\\n\\u00e9\xc3\xa9");
+    auto tokenizer =
+        MakeJsonTokenizer(absl::StrCat("\"", with_escape, long_ascii, "\""));
+    EXPECT_EQ(tokenizer->tokenizer->Next(),
+              soia_internal::JsonTokenType::kString);
+    std::string expected = long_ascii;
+    expected.insert(i, "\n\xc3\xa9\xc3\xa9");
+    EXPECT_EQ(tokenizer->tokenizer->state().string_value(),
+              absl::StrCat(expected, long_ascii));
+  }
+
+  tokenizer = MakeJsonTokenizer(absl::StrCat("\"", long_ascii));
+  EXPECT_EQ(tokenizer->tokenizer->Next(), soia_internal::JsonTokenType::kError);
 }
 
 TEST(SoialibTest, ParseJsonNumber) {
@@ -491,6 +587,59 @@ TEST(SoialibTest, ParseJsonNumber) {
             std::numeric_limits<int64_t>::max());
 }
 
+TEST(SoialibTest, JsonObjectReader) {
+  auto tokenizer = MakeJsonTokenizer(
+      "{\"a\\u0062\": \"c\\nd\", \"ef\": \"gh\", \"i\\j\": []}");
+  soia_internal::JsonTokenizer& t = *tokenizer->tokenizer;
+  t.Next();
+  soia_internal::JsonObjectReader object_reader(&t);
+  ASSERT_TRUE(object_reader.NextEntry());
+  EXPECT_EQ(object_reader.name(), "ab");
+  EXPECT_EQ(t.state().string_value(), "c\nd");
+  EXPECT_EQ(object_reader.name(), "ab");
+  std::string value;
+  soia_internal::Parse(t, value);
+  EXPECT_EQ(value, "c\nd");
+  ASSERT_TRUE(object_reader.NextEntry());
+  EXPECT_EQ(object_reader.name(), "ef");
+  soia_internal::Parse(t, value);
+  EXPECT_EQ(value, "gh");
+  EXPECT_FALSE(object_reader.NextEntry());
+  EXPECT_EQ(t.state().token_type, soia_internal::JsonTokenType::kError);
+}
+
+TEST(SoialibTest, ParseEnumJsonObject) {
+  const auto find_kind = [](absl::string_view kind) {
+    return kind == "foo" ? 7 : 0;
+  };
+  for (const std::string json_code : {
+           "{\"kind\": \"foo\", \"value\": 3}",
+           "{\"value\": 3, \"x\": [], \"kind\": \"foo\"}",
+       }) {
+    auto tokenizer = MakeJsonTokenizer(json_code);
+    soia_internal::JsonTokenizer& t = *tokenizer->tokenizer;
+    t.Next();
+    int number = 0;
+    int32_t value = 0;
+    soia_internal::ParseEnumJsonObject(t, find_kind, [&](int n) {
+      number = n;
+      soia_internal::Parse(t, value);
+    });
+    EXPECT_TRUE(t.state().status.ok()) << json_code;
+    EXPECT_EQ(t.state().token_type, soia_internal::JsonTokenType::kStrEnd)
+        << json_code;
+    EXPECT_EQ(number, 7) << json_code;
+    EXPECT_EQ(value, 3) << json_code;
+  }
+  auto tokenizer = MakeJsonTokenizer("{\"kind\": \"bar\", \"value\": 3}");
+  tokenizer->tokenizer->Next();
+  bool called = false;
+  soia_internal::ParseEnumJsonObject(*tokenizer->tokenizer, find_kind,
+                                     [&](int) { called = true; });
+  EXPECT_TRUE(tokenizer->tokenizer->state().status.ok());
+  EXPECT_FALSE(called);
+}
+
 std::string RepeatStr(const std::string& input, int times) {
   if (times <= 0) return "";
   std::string result;
@@ -946,9 +1095,30 @@ TEST(SoialibTest, ReserializeString) {
                   .ExpectBytes("f302220a")
                   .Check(),
               IsOk());
+  EXPECT_THAT(MakeReserializer(std::string("a\0b", 3))
+                  .ExpectBytes("f303610062")
+                  .Check(),
+              IsOk());
+  // Embedded NUL characters are copied once, after multi-byte and invalid
+  // sequences too.
+  EXPECT_THAT(MakeReserializer(std::string("\xc3\xa9\0\xc3\xa9", 5))
+                  .ExpectBytes("f305c3a900c3a9")
+                  .Check(),
+              IsOk());
+  EXPECT_EQ(soia::ToBytes(std::string("\xff\0\0", 3)).as_string(),
+            HexToBytes("f305efbfbd0000").value());
+  EXPECT_EQ(soia::GetEncodedSize(std::string("\xff\0\0", 3)), 11);
   EXPECT_THAT(MakeReserializer(std::string("é")).Check(), IsOk());
   EXPECT_THAT(MakeReserializer(RepeatStr("a", 77)).Check(), IsOk());
-  EXPECT_THAT(MakeReserializer(RepeatStr("a", 78)).Check(), IsOk());
+  EXPECT_THAT(MakeReserializer(RepeatStr("a", 78))
+                  .ExpectBytes(absl::StrCat("f34e", RepeatStr("61", 78)))
+                  .Check(),
+              IsOk());
+  // The length prefix accounts for the replacement character.
+  EXPECT_EQ(
+      soia::ToBytes(absl::StrCat("\xff", RepeatStr("a", 300))).as_string(),
+      HexToBytes(absl::StrCat("f3e82f01efbfbd", RepeatStr("61", 300)))
+          .value());
   EXPECT_THAT(MakeReserializer(RepeatStr("a", 21845)).Check(), IsOk());
   EXPECT_THAT(MakeReserializer(RepeatStr("a", 21846)).Check(), IsOk());
 }
@@ -1041,6 +1211,54 @@ TEST(SoialibTest, ReserializeArray) {
               IsOk());
 }
 
+template <typename T>
+void CheckNumberArrayKernels(const std::vector<T>& numbers) {
+  // The bulk kernels must produce the same bytes as the number adapters.
+  soia_internal::ByteSink expected;
+  soia_internal::AppendArrayPrefix(numbers.size(), expected);
+  for (const T number : numbers) {
+    soia_internal::TypeAdapter<T>::Append(number, expected);
+  }
+  const soia::ByteString bytes = soia::ToBytes(numbers);
+  EXPECT_EQ(bytes.as_string().substr(4),
+            absl::string_view(reinterpret_cast<const char*>(expected.data()),
+                              expected.length()));
+  EXPECT_EQ(soia::GetEncodedSize(numbers), bytes.length());
+  EXPECT_THAT(soia::Parse<std::vector<T>>(bytes.as_string()),
+              IsOkAndHolds(numbers));
+  // Truncated input.
+  EXPECT_FALSE(soia::Parse<std::vector<T>>(
+                   bytes.as_string().substr(0, bytes.length() - 1))
+                   .ok());
+}
+
+TEST(SoialibTest, NumberArrayKernels) {
+  CheckNumberArrayKernels<int32_t>({0, 1, 231, 232, 65535, 65536, -1, -256,
+                                    -257, -65536, -65537,
+                                    std::numeric_limits<int32_t>::min(),
+                                    std::numeric_limits<int32_t>::max()});
+  CheckNumberArrayKernels<int64_t>({0, 231, 232, 4294967295, 4294967296, -256,
+                                    -65537, -2147483648, -2147483649,
+                                    std::numeric_limits<int64_t>::min(),
+                                    std::numeric_limits<int64_t>::max()});
+  CheckNumberArrayKernels<uint64_t>({0, 231, 232, 65536, 4294967296,
+                                     std::numeric_limits<uint64_t>::max()});
+  CheckNumberArrayKernels<float>({0.0f, 1.5f, -3.25f, 1e30f});
+  CheckNumberArrayKernels<double>({0.0, 1.5, -3.25, 1e300});
+  std::vector<double> many_doubles;
+  for (int i = 0; i < 1000; ++i) {
+    many_doubles.push_back(i % 3 == 0 ? 0.0 : i * 0.5);
+  }
+  CheckNumberArrayKernels(many_doubles);
+  // Numbers encoded with wires of another type.
+  EXPECT_THAT(soia::Parse<std::vector<double>>(
+                  HexToBytes("f905e8e80300").value()),
+              IsOkAndHolds(std::vector<double>{5.0, 1000.0, 0.0}));
+  EXPECT_THAT(soia::Parse<std::vector<int32_t>>(
+                  HexToBytes("f8f10000000000000840ebff").value()),
+              IsOkAndHolds(std::vector<int32_t>{3, -1}));
+}
+
 TEST(SoialibTest, ReserializeOptional) {
   EXPECT_THAT(MakeReserializer(absl::optional<bool>())
                   .IsDefault()
@@ -1070,6 +1288,60 @@ TEST(SoialibTest, ReserializeOptional) {
               IsOk());
 }
 
+TEST(SoialibTest, UnrecognizedValuesFromBytes) {
+  // A string, an array with wire 250 and an enum value.
+  const std::string bytes =
+      HexToBytes("f303666f6ffa0401020304fbf30178").value().substr(4);
+  soia_internal::ByteSource source(bytes.data(), bytes.length());
+  soia_internal::UnrecognizedValues values;
+  values.ParseFrom(source, 3);
+  ASSERT_FALSE(source.error);
+  EXPECT_EQ(source.pos, source.end);
+
+  // Copied through as they are.
+  soia_internal::ByteSink byte_sink;
+  values.AppendTo(byte_sink);
+  EXPECT_EQ(absl::string_view((const char*)byte_sink.data(),
+                              byte_sink.length()),
+            bytes);
+  soia_internal::ByteCounter byte_counter;
+  values.AppendTo(byte_counter);
+  EXPECT_EQ(byte_counter.length(), bytes.length());
+  soia_internal::DenseJson dense_json;
+  values.AppendTo(dense_json);
+  EXPECT_EQ(dense_json.out, "\"foo\",[1,2,3,4],[1,\"x\"]");
+
+  soia_internal::ByteSource truncated(bytes.data(), bytes.length() - 1);
+  soia_internal::UnrecognizedValues truncated_values;
+  truncated_values.ParseFrom(truncated, 3);
+  EXPECT_TRUE(truncated.error);
+}
+
+TEST(SoialibTest, UnrecognizedFieldsOutliveArena) {
+  // The values of the 2 fields after the only recognized field.
+  const std::string bytes =
+      HexToBytes("f303666f6ffbf30178").value().substr(4);
+  std::shared_ptr<soia_internal::UnrecognizedFieldsData> copy;
+  {
+    soia::Arena arena;
+    soia_internal::ArenaScope arena_scope(&arena);
+    soia_internal::ByteSource source(bytes.data(), bytes.length());
+    source.keep_unrecognized_fields = true;
+    std::shared_ptr<soia_internal::UnrecognizedFieldsData> parsed;
+    soia_internal::ParseUnrecognizedFields(source, 3, 1, 1, parsed);
+    ASSERT_FALSE(source.error);
+    ASSERT_NE(parsed, nullptr);
+    // Copying a struct copies the pointer to its unrecognized fields.
+    copy = parsed;
+  }
+  EXPECT_EQ(copy->array_len, 3);
+  soia_internal::ByteSink byte_sink;
+  copy->values.AppendTo(byte_sink);
+  EXPECT_EQ(absl::string_view((const char*)byte_sink.data(),
+                              byte_sink.length()),
+            bytes);
+}
+
 TEST(SoialibTest, JsonStringEscapingAndUtf8Validation) {
   EXPECT_EQ(soia::ToDenseJson("é"), "\"é\"");
   EXPECT_EQ(soia::ToDenseJson("\n\r\t\"\f'"), "\"\\n\\r\\t\\\"\\f'\"");
@@ -1090,6 +1362,10 @@ TEST(SoialibTest, JsonStringEscapingAndUtf8Validation) {
   EXPECT_EQ(soia::ToDenseJson("\xf0\x28\x8c\x28"), "\"�(�(\"");
   EXPECT_EQ(soia::ToDenseJson("\xf8\xa1\xa1\xa1\xa1"), "\"�\"");
   EXPECT_EQ(soia::ToDenseJson("\xfc\xa1\xa1\xa1\xa1\xa1"), "\"�\"");
+  // Long enough to exercise the vectorized scanning paths.
+  const std::string long_ascii = RepeatStr("abc", 15);
+  EXPECT_EQ(soia::ToDenseJson(absl::StrCat(long_ascii, "\n\xc3", long_ascii)),
+            absl::StrCat("\"", long_ascii, "\\n�", long_ascii, "\""));
 }
 
 TEST(SoialibTest, DebugStringEscapingAndUtf8Validation) {
@@ -1119,6 +1395,10 @@ TEST(SoialibTest, DebugStringEscapingAndUtf8Validation) {
             "\"\\xF8\\xA1\\xA1\\xA1\\xA1\"");
   EXPECT_EQ(soia_internal::ToDebugString("\xfc\xa1\xa1\xa1\xa1\xa1"),
             "\"\\xFC\\xA1\\xA1\\xA1\\xA1\\xA1\"");
+  const std::string long_ascii = RepeatStr("abc", 15);
+  EXPECT_EQ(soia_internal::ToDebugString(
+                absl::StrCat(long_ascii, "\"\xc3", long_ascii)),
+            absl::StrCat("\"", long_ascii, "\\\"\\xC3", long_ascii, "\""));
 }
 
 TEST(SoialibTest, ParseJsonReturnsError) {
@@ -1217,6 +1497,468 @@ TEST(SoialibTest, ParseBytesReturnsError) {
           .ok());
 }
 
+TEST(SoialibTest, StringViewValues) {
+  const soia::ByteString bytes =
+      soia::ToBytes(std::vector<std::string>{"foo", "", "bar"});
+  const absl::string_view input = bytes.as_string();
+  const absl::StatusOr<std::vector<absl::string_view>> views =
+      soia::Parse<std::vector<absl::string_view>>(input);
+  ASSERT_THAT(views, IsOk());
+  EXPECT_THAT(*views, ElementsAre("foo", "", "bar"));
+  // The non-empty views point into the input.
+  EXPECT_GE((*views)[0].data(), input.data());
+  EXPECT_LE((*views)[2].data() + 3, input.data() + input.length());
+
+  // Views are written like strings, without relying on a terminating \0.
+  const std::string strings = std::string("a\0\n\xff" "bc", 6);
+  const absl::string_view view = absl::string_view(strings).substr(0, 5);
+  EXPECT_EQ(soia::ToBytes(view).as_string(),
+            soia::ToBytes(std::string(view)).as_string());
+  EXPECT_EQ(soia_internal::ToDebugString(view),
+            soia_internal::ToDebugString(std::string(view)));
+  EXPECT_EQ(soia::ToDenseJson(view), soia::ToDenseJson(std::string(view)));
+  EXPECT_EQ(std::get<soia::reflection::PrimitiveType>(
+                soia::reflection::GetTypeDescriptor<absl::string_view>().type),
+            soia::reflection::PrimitiveType::kString);
+
+  // Bytes values are not strings.
+  EXPECT_FALSE(soia::Parse<absl::string_view>(
+                   soia::ToBytes(soia::ByteString({0x00, 0xff})).as_string())
+                   .ok());
+  EXPECT_FALSE(soia::Parse<absl::string_view>("\"foo\"").ok());
+  EXPECT_FALSE(soia::Parse<absl::string_view>(HexToBytes("f30a").value()).ok());
+}
+
+TEST(SoialibTest, BytesViewValues) {
+  const soia::ByteString bytes = soia::ToBytes(std::vector<soia::ByteString>{
+      soia::ByteString({0x00, 0xff}), soia::ByteString()});
+  const absl::string_view input = bytes.as_string();
+  const absl::StatusOr<std::vector<soia::ByteStringView>> views =
+      soia::Parse<std::vector<soia::ByteStringView>>(input);
+  ASSERT_THAT(views, IsOk());
+  ASSERT_EQ(views->size(), 2);
+  EXPECT_EQ((*views)[0].as_string(), absl::string_view("\0\xff", 2));
+  EXPECT_TRUE((*views)[1].empty());
+  // The non-empty views point into the input.
+  EXPECT_GE((*views)[0].as_string().data(), input.data());
+  EXPECT_LE((*views)[0].as_string().data() + 2, input.data() + input.length());
+
+  // Views are written like bytes.
+  const soia::ByteStringView view = (*views)[0];
+  const soia::ByteString copy = view.as_string();
+  EXPECT_EQ(soia::ToBytes(view), soia::ToBytes(copy));
+  EXPECT_EQ(soia::GetEncodedSize(view), soia::GetEncodedSize(copy));
+  EXPECT_EQ(soia_internal::ToDebugString(view),
+            soia_internal::ToDebugString(copy));
+  EXPECT_EQ(soia::ToDenseJson(view), soia::ToDenseJson(copy));
+  EXPECT_EQ(soia::ToReadableJson(view), soia::ToReadableJson(copy));
+  EXPECT_EQ(
+      std::get<soia::reflection::PrimitiveType>(
+          soia::reflection::GetTypeDescriptor<soia::ByteStringView>().type),
+      soia::reflection::PrimitiveType::kBytes);
+
+  // String values are not bytes.
+  EXPECT_FALSE(soia::Parse<soia::ByteStringView>(
+                   soia::ToBytes(std::string("foo")).as_string())
+                   .ok());
+  EXPECT_FALSE(soia::Parse<soia::ByteStringView>("\"AP8=\"").ok());
+  EXPECT_FALSE(
+      soia::Parse<soia::ByteStringView>(HexToBytes("f50a").value()).ok());
+}
+
+TEST(SoialibTest, LazyValue) {
+  using Items = std::vector<std::string>;
+  using LazyItems = soia::lazy<Items>;
+  const soia::ByteString bytes = soia::ToBytes(Items{"foo", "bar"});
+
+  absl::StatusOr<LazyItems> lazy = soia::Parse<LazyItems>(
+      bytes.as_string(), soia::UnrecognizedFieldsPolicy::kKeep);
+  ASSERT_THAT(lazy, IsOk());
+  EXPECT_TRUE(lazy->has_encoded_bytes());
+  // Unmodified: the bytes are copied through.
+  EXPECT_EQ(soia::ToBytes(*lazy), bytes);
+  EXPECT_EQ(soia::GetEncodedSize(*lazy), bytes.length());
+  const LazyItems copy = *lazy;
+  EXPECT_THAT(*copy, ElementsAre("foo", "bar"));
+  EXPECT_TRUE(copy.has_encoded_bytes());
+  EXPECT_EQ(soia::ToDenseJson(copy), "[\"foo\",\"bar\"]");
+
+  (*lazy)->push_back("zoo");
+  EXPECT_FALSE(lazy->has_encoded_bytes());
+  EXPECT_EQ(soia::ToBytes(*lazy), soia::ToBytes(Items{"foo", "bar", "zoo"}));
+  EXPECT_NE(*lazy, copy);
+
+  // Parsed from JSON.
+  lazy = soia::Parse<LazyItems>("[\"foo\", \"bar\"]");
+  ASSERT_THAT(lazy, IsOk());
+  EXPECT_TRUE(lazy->has_encoded_bytes());
+  EXPECT_EQ(*lazy, copy);
+  EXPECT_EQ(soia::ToBytes(*lazy), bytes);
+  EXPECT_THAT(
+      soia::Parse<std::vector<LazyItems>>("[[\"a\"], [], [\"b\", \"c\"]]"),
+      IsOkAndHolds(ElementsAre(Items{"a"}, Items{}, Items{"b", "c"})));
+
+  // The default value is recognized without decoding.
+  const absl::StatusOr<std::vector<LazyItems>> lazy_items =
+      soia::Parse<std::vector<LazyItems>>(
+          soia::ToBytes(std::vector<Items>{{}, {"a"}}).as_string());
+  ASSERT_THAT(lazy_items, IsOk());
+  EXPECT_TRUE(soia_internal::LazyAdapter::IsDefault((*lazy_items)[0]));
+  EXPECT_FALSE(soia_internal::LazyAdapter::IsDefault((*lazy_items)[1]));
+
+  // Not the default value even though it is encoded in one byte.
+  const absl::StatusOr<soia::lazy<absl::optional<int32_t>>> lazy_zero =
+      soia::Parse<soia::lazy<absl::optional<int32_t>>>(
+          soia::ToBytes(absl::optional<int32_t>(0)).as_string());
+  ASSERT_THAT(lazy_zero, IsOk());
+  EXPECT_FALSE(soia_internal::LazyAdapter::IsDefault(*lazy_zero));
+
+  // Errors in the structure of the value are reported.
+  EXPECT_FALSE(soia::Parse<LazyItems>(HexToBytes("f9f3").value()).ok());
+  EXPECT_FALSE(soia::Parse<LazyItems>("[\"a\",").ok());
+
+  // Other errors are reported when the value is decoded.
+  using LazyInts = soia::lazy<std::vector<int32_t>>;
+  for (const std::string& input :
+       {std::string("[\"a\"]"),
+        std::string(soia::ToBytes(Items{"a"}).as_string())}) {
+    const absl::StatusOr<LazyInts> lazy_ints = soia::Parse<LazyInts>(input);
+    ASSERT_THAT(lazy_ints, IsOk());
+    EXPECT_THAT(lazy_ints->decoded(), Not(IsOk()));
+    EXPECT_THAT(**lazy_ints, IsEmpty());
+  }
+  LazyInts lazy_ints = *soia::Parse<LazyInts>("[\"a\"]");
+  lazy_ints->push_back(1);
+  EXPECT_THAT(lazy_ints.decoded(), IsOkAndHolds(Pointee(ElementsAre(1))));
+}
+
+TEST(SoialibTest, SharedValue) {
+  using Items = std::vector<std::string>;
+  using SharedItems = soia::shared<Items>;
+
+  const SharedItems empty;
+  EXPECT_THAT(*empty, IsEmpty());
+  EXPECT_FALSE(empty.is_shared());
+  EXPECT_TRUE(soia_internal::SharedAdapter::IsDefault(empty));
+
+  SharedItems items = Items{"foo", "bar"};
+  EXPECT_FALSE(items.is_shared());
+  SharedItems copy = items;
+  EXPECT_TRUE(items.is_shared());
+  EXPECT_TRUE(copy.is_shared());
+  EXPECT_EQ(&*std::as_const(items), &*std::as_const(copy));
+  EXPECT_EQ(items, copy);
+
+  // Copy on write.
+  copy->push_back("zoo");
+  EXPECT_FALSE(items.is_shared());
+  EXPECT_FALSE(copy.is_shared());
+  EXPECT_THAT(*std::as_const(items), ElementsAre("foo", "bar"));
+  EXPECT_THAT(*std::as_const(copy), ElementsAre("foo", "bar", "zoo"));
+  EXPECT_NE(items, copy);
+
+  // The only owner modifies the value in place.
+  const Items* const value = &*std::as_const(copy);
+  copy->pop_back();
+  EXPECT_EQ(&*std::as_const(copy), value);
+  EXPECT_EQ(items, copy);
+
+  EXPECT_EQ(soia::ToDenseJson(items), "[\"foo\",\"bar\"]");
+  EXPECT_EQ(soia::ToBytes(items), soia::ToBytes(Items{"foo", "bar"}));
+  EXPECT_EQ(soia::ToDenseJson(empty), "[]");
+  EXPECT_EQ(absl::HashOf(items), absl::HashOf(Items{"foo", "bar"}));
+  EXPECT_THAT(soia::Parse<SharedItems>("[\"a\"]"),
+              IsOkAndHolds(SharedItems(Items{"a"})));
+  EXPECT_THAT(soia::Parse<SharedItems>(
+                  soia::ToBytes(Items{"a", "b"}).as_string()),
+              IsOkAndHolds(SharedItems(Items{"a", "b"})));
+}
+
+TEST(SoialibTest, FrozenValue) {
+  using Items = std::vector<std::string>;
+  using FrozenItems = soia::frozen<Items>;
+
+  const FrozenItems empty;
+  EXPECT_THAT(*empty, IsEmpty());
+  EXPECT_EQ(empty.hash(), absl::Hash<Items>()(Items{}));
+  EXPECT_EQ(empty, FrozenItems());
+  EXPECT_TRUE(soia_internal::FrozenAdapter::IsDefault(empty));
+
+  const FrozenItems items = Items{"foo", "bar"};
+  const FrozenItems copy = items;
+  EXPECT_EQ(&*copy, &*items);
+  EXPECT_EQ(copy, items);
+  EXPECT_EQ(items, FrozenItems(Items{"foo", "bar"}));
+  EXPECT_NE(items, FrozenItems(Items{"foo"}));
+  EXPECT_NE(items, empty);
+
+  // A moved-from frozen value is still valid.
+  FrozenItems moved_from = items;
+  const FrozenItems moved_to = std::move(moved_from);
+  EXPECT_EQ(moved_to, items);
+  EXPECT_THAT(*moved_from, ElementsAre("foo", "bar"));
+  FrozenItems assigned;
+  assigned = std::move(moved_from);
+  EXPECT_EQ(assigned, items);
+  EXPECT_EQ(moved_from.hash(), items.hash());
+  EXPECT_EQ(moved_from.thaw(), items.thaw());
+  std::vector<FrozenItems> frozen_items = {items};
+  for (int i = 0; i < 100; ++i) {
+    frozen_items.emplace_back(Items{"foo"});
+  }
+  EXPECT_EQ(frozen_items[0], items);
+
+  Items thawed = items.thaw();
+  thawed.push_back("zoo");
+  EXPECT_THAT(*items, ElementsAre("foo", "bar"));
+
+  const absl::flat_hash_set<FrozenItems> set = {items, FrozenItems(thawed)};
+  EXPECT_TRUE(set.contains(FrozenItems(Items{"foo", "bar"})));
+  EXPECT_TRUE(set.contains(FrozenItems(Items{"foo", "bar", "zoo"})));
+  EXPECT_FALSE(set.contains(empty));
+
+  EXPECT_EQ(soia::ToDenseJson(items), "[\"foo\",\"bar\"]");
+  EXPECT_EQ(soia::ToBytes(items), soia::ToBytes(Items{"foo", "bar"}));
+  EXPECT_THAT(soia::Parse<FrozenItems>("[\"foo\",\"bar\"]"),
+              IsOkAndHolds(items));
+  EXPECT_THAT(
+      soia::Parse<FrozenItems>(soia::ToBytes(Items{"foo"}).as_string()),
+      IsOkAndHolds(FrozenItems(Items{"foo"})));
+}
+
+TEST(SoialibTest, ToBytesWithStringRefs) {
+  using Items = std::vector<std::string>;
+  Items items;
+  for (int i = 0; i < 1000; ++i) {
+    items.push_back(i % 2 == 0 ? "some tag" : absl::StrCat("item_", i % 10));
+  }
+  items.push_back("");
+  items.push_back("ab");
+  items.push_back("ab");
+  const soia::ByteString bytes = soia::ToBytesWithStringRefs(items);
+  EXPECT_TRUE(absl::StartsWith(bytes.as_string(), "soir"));
+  EXPECT_LT(bytes.length(), soia::ToBytes(items).length() / 2);
+  EXPECT_THAT(soia::Parse<Items>(bytes.as_string()), IsOkAndHolds(items));
+  const soia::ByteString no_refs = soia::ToBytesWithStringRefs(Items{"a", "b"});
+  EXPECT_THAT(soia::Parse<Items>(no_refs.as_string()),
+              IsOkAndHolds(ElementsAre("a", "b")));
+
+  // String views of a repeated string point to the same bytes.
+  const absl::StatusOr<std::vector<absl::string_view>> views =
+      soia::Parse<std::vector<absl::string_view>>(bytes.as_string());
+  ASSERT_THAT(views, IsOk());
+  ASSERT_EQ(views->size(), items.size());
+  EXPECT_EQ((*views)[0], "some tag");
+  EXPECT_EQ((*views)[0].data(), (*views)[2].data());
+  EXPECT_EQ((*views)[1], "item_1");
+
+  // Lazy values are decoded right away, since they can contain references to
+  // strings outside of them.
+  using LazyItems = soia::lazy<Items>;
+  const soia::ByteString nested_bytes = soia::ToBytesWithStringRefs(
+      std::vector<Items>{{"foo bar", "zoo"}, {"foo bar"}});
+  EXPECT_THAT(soia::Parse<std::vector<LazyItems>>(nested_bytes.as_string()),
+              IsOkAndHolds(ElementsAre(Items{"foo bar", "zoo"},
+                                       Items{"foo bar"})));
+
+  // The bytes were not written by ToBytesWithStringRefs.
+  EXPECT_FALSE(
+      soia::Parse<std::string>(HexToBytes("736f6961f3ff04").value()).ok());
+  // References must point to a string before them.
+  EXPECT_FALSE(
+      soia::Parse<std::string>(HexToBytes("736f6972f3ff04").value()).ok());
+  EXPECT_FALSE(soia::Parse<Items>(HexToBytes("736f6972f7f3ff05").value()).ok());
+  EXPECT_FALSE(
+      soia::Parse<std::string>(HexToBytes("736f6972f3ffe9ffffff7f").value())
+          .ok());
+}
+
+TEST(SoialibTest, GetEncodedSize) {
+  const auto expect_exact_size = [](const auto& input) {
+    EXPECT_EQ(soia::GetEncodedSize(input), soia::ToBytes(input).length())
+        << soia_internal::ToDebugString(input);
+  };
+  expect_exact_size(int32_t{-300});
+  expect_exact_size(int64_t{-3000000000});
+  expect_exact_size(uint64_t{70000});
+  expect_exact_size(absl::FromUnixMillis(1));
+  expect_exact_size(std::string(100, 'a'));
+  expect_exact_size(std::string("\xc0 \xF0\x9F\x98 \0"));
+  expect_exact_size(absl::StrCat(std::string(100, 'a'), "\xc0"));
+  expect_exact_size(soia::ByteString(std::string(300, 'a')));
+  expect_exact_size(std::vector<absl::optional<std::string>>{"x", {}, "", ""});
+  expect_exact_size(std::vector<soia::rec<bool>>{true});
+}
+
+TEST(SoialibTest, AppendDenseJson) {
+  std::string out = "[";
+  soia::AppendDenseJson(std::vector<int32_t>{1, 2}, out);
+  out += ',';
+  soia::AppendDenseJson(std::string("foo"), out);
+  out += ']';
+  EXPECT_EQ(out, "[[1,2],\"foo\"]");
+}
+
+TEST(SoialibTest, ParallelEncodingAndDecoding) {
+  soia::ThreadExecutor executor(4);
+  std::vector<std::string> strings;
+  std::vector<int64_t> numbers;
+  for (int i = 0; i < 10000; ++i) {
+    strings.push_back(std::string(i % 300, 'a' + i % 26));
+    numbers.push_back(int64_t{i} * i * i * (i % 2 ? -1 : 1));
+  }
+  const soia::ByteString bytes = soia::ToBytes(strings, executor);
+  EXPECT_EQ(bytes, soia::ToBytes(strings));
+  EXPECT_EQ(soia::ToDenseJson(strings, executor), soia::ToDenseJson(strings));
+  EXPECT_EQ(soia::ToBytes(numbers, executor), soia::ToBytes(numbers));
+  EXPECT_EQ(soia::ToDenseJson(numbers, executor), soia::ToDenseJson(numbers));
+  // Small arrays and other types are encoded on the calling thread.
+  EXPECT_EQ(soia::ToBytes(std::vector<bool>{true}, executor),
+            soia::ToBytes(std::vector<bool>{true}));
+  EXPECT_EQ(soia::ToDenseJson(3, executor), "3");
+  // And so are arrays of bools, whatever their size.
+  std::vector<bool> bools(10000);
+  for (size_t i = 0; i < bools.size(); i += 3) {
+    bools[i] = true;
+  }
+  EXPECT_EQ(soia::ToBytes(bools, executor), soia::ToBytes(bools));
+  EXPECT_THAT(soia::Parse<std::vector<bool>>(soia::ToBytes(bools).as_string(),
+                                             executor),
+              IsOkAndHolds(bools));
+
+  EXPECT_THAT(
+      soia::Parse<std::vector<std::string>>(bytes.as_string(), executor),
+      IsOkAndHolds(strings));
+  EXPECT_THAT(soia::Parse<std::vector<std::string>>(
+                  soia::ToDenseJson(strings), executor),
+              IsOkAndHolds(strings));
+  const absl::string_view truncated =
+      bytes.as_string().substr(0, bytes.length() - 1);
+  EXPECT_FALSE(
+      soia::Parse<std::vector<std::string>>(truncated, executor).ok());
+  const std::string with_trailing_byte = absl::StrCat(bytes.as_string(), "0");
+  EXPECT_FALSE(
+      soia::Parse<std::vector<std::string>>(with_trailing_byte, executor).ok());
+}
+
+TEST(SoialibTest, BytesWriter) {
+  soia::BytesWriter writer;
+  const std::vector<std::string> long_value(100, "foo");
+  EXPECT_EQ(writer.Write(long_value), soia::ToBytes(long_value).as_string());
+  EXPECT_EQ(writer.Write(int32_t{3}), soia::ToBytes(int32_t{3}).as_string());
+  EXPECT_EQ(writer.Write("bar"), soia::ToBytes("bar").as_string());
+}
+
+TEST(SoialibTest, RecordStreamDecoder) {
+  soia::BytesWriter writer;
+  std::string stream;
+  absl::StrAppend(&stream, writer.WriteFrame(std::string("foo")));
+  absl::StrAppend(&stream, writer.WriteFrame(std::string(300, 'a')));
+  absl::StrAppend(&stream, writer.WriteFrame(std::string("")));
+
+  soia::RecordStreamDecoder<std::string> decoder;
+  std::vector<std::string> records;
+  // Feed the stream one byte at a time.
+  for (const char c : stream) {
+    decoder.Feed(absl::string_view(&c, 1));
+    for (;;) {
+      absl::StatusOr<absl::optional<std::string>> record = decoder.Next();
+      ASSERT_THAT(record, IsOk());
+      if (!record->has_value()) break;
+      records.push_back(**record);
+    }
+  }
+  EXPECT_THAT(records, ElementsAre("foo", std::string(300, 'a'), ""));
+  EXPECT_THAT(decoder.Finish(), IsOk());
+
+  decoder.Feed(stream.substr(0, 2));
+  EXPECT_THAT(decoder.Next(), IsOkAndHolds(absl::nullopt));
+  EXPECT_FALSE(decoder.Finish().ok());
+
+  soia::RecordStreamDecoder<int32_t> int_decoder;
+  int_decoder.Feed(std::string("\xff", 1));
+  EXPECT_FALSE(int_decoder.Next().ok());
+}
+
+TEST(SoialibTest, RecordFile) {
+  const std::string path =
+      absl::StrCat(testing::TempDir(), "/soia_record_file.bin");
+  std::vector<uint64_t> offsets;
+  {
+    absl::StatusOr<soia::RecordFileWriter<std::string>> writer =
+        soia::RecordFileWriter<std::string>::Open(path);
+    ASSERT_THAT(writer, IsOk());
+    for (const char* record : {"foo", "", "bar"}) {
+      const absl::StatusOr<uint64_t> offset = writer->Write(record);
+      ASSERT_THAT(offset, IsOk());
+      offsets.push_back(*offset);
+    }
+    ASSERT_THAT(writer->Close(), IsOk());
+  }
+  {
+    absl::StatusOr<soia::RecordFileWriter<std::string>> writer =
+        soia::RecordFileWriter<std::string>::Open(path, /*append=*/true);
+    ASSERT_THAT(writer, IsOk());
+    const absl::StatusOr<uint64_t> offset = writer->Write("zoo");
+    ASSERT_THAT(offset, IsOk());
+    offsets.push_back(*offset);
+  }
+
+  absl::StatusOr<soia::RecordFileReader<absl::string_view>> reader =
+      soia::RecordFileReader<absl::string_view>::Open(path);
+  ASSERT_THAT(reader, IsOk());
+  EXPECT_THAT(reader->BuildIndex(), IsOkAndHolds(offsets));
+  EXPECT_THAT(reader->ReadAt(offsets[2]), IsOkAndHolds("bar"));
+  EXPECT_FALSE(reader->ReadAt(offsets[2] + 1).ok());
+  std::vector<std::string> records;
+  for (;;) {
+    absl::StatusOr<absl::optional<absl::string_view>> record = reader->Next();
+    ASSERT_THAT(record, IsOk());
+    if (!record->has_value()) break;
+    records.emplace_back(**record);
+  }
+  EXPECT_THAT(records, ElementsAre("foo", "", "bar", "zoo"));
+
+  // Errors carry the cause reported by the system.
+  EXPECT_THAT(
+      soia::RecordFileReader<std::string>::Open(absl::StrCat(path, ".missing"))
+          .status()
+          .message(),
+      HasSubstr(std::strerror(ENOENT)));
+  absl::StatusOr<soia::RecordFileWriter<std::string>> full_writer =
+      soia::RecordFileWriter<std::string>::Open("/dev/full");
+  if (full_writer.ok()) {
+    ASSERT_THAT(full_writer->Write("foo"), IsOk());
+    EXPECT_THAT(full_writer->Flush().message(),
+                HasSubstr(std::strerror(ENOSPC)));
+  }
+}
+
+TEST(SoialibTest, ParseWithArena) {
+  using Strings = soia::arena_vector<soia::arena_string>;
+  const std::string long_string(100, 'a');
+  EXPECT_THAT(MakeReserializer(Strings{"foo", long_string.c_str()})
+                  .ExpectDenseJson(
+                      absl::StrCat("[\"foo\",\"", long_string, "\"]"))
+                  .Check(),
+              IsOk());
+
+  soia::Arena arena;
+  const absl::StatusOr<Strings> strings = soia::Parse<Strings>(
+      soia::ToBytes(std::vector<std::string>{"foo", long_string}).as_string(),
+      arena);
+  ASSERT_THAT(strings, IsOk());
+  EXPECT_THAT(*strings, ElementsAre("foo", long_string.c_str()));
+  EXPECT_EQ(strings->get_allocator().arena(), &arena);
+  EXPECT_EQ((*strings)[1].get_allocator().arena(), &arena);
+  EXPECT_GT(arena.bytes_reserved(), 0);
+
+  // A copy allocates from the heap.
+  const Strings copy = *strings;
+  EXPECT_EQ(copy[1].get_allocator().arena(), nullptr);
+  EXPECT_EQ(copy, *strings);
+}
+
 TEST(SoialibTest, HttpHeaders) {
   soia::service::HttpHeaders headers;
   headers.Insert("accept", "A");
@@ -1232,6 +1974,477 @@ TEST(SoialibTest, HttpHeaders) {
                                    Pair("origin", ElementsAre("C"))));
 }
 
+struct Echo {
+  using request_type = std::string;
+  using response_type = std::string;
+  static constexpr absl::string_view kMethodName = "Echo";
+  static constexpr int kNumber = 1;
+};
+
+struct Square {
+  using request_type = int32_t;
+  using response_type = int64_t;
+  static constexpr absl::string_view kMethodName = "Square";
+  static constexpr int kNumber = 200;
+};
+
+struct EchoV2 {
+  using request_type = std::string;
+  using response_type = std::string;
+  static constexpr absl::string_view kMethodName = "Echo";
+  static constexpr int kNumber = 3;
+};
+
+struct EchoService {
+  using methods = std::tuple<Echo, Square, EchoV2>;
+
+  absl::StatusOr<std::string> operator()(
+      Echo, std::string request, const soia::service::HttpHeaders&,
+      soia::service::HttpHeaders&) const {
+    return request;
+  }
+
+  absl::StatusOr<int64_t> operator()(Square, int32_t request,
+                                     const soia::service::HttpHeaders&,
+                                     soia::service::HttpHeaders&) const {
+    return int64_t{request} * request;
+  }
+
+  absl::StatusOr<std::string> operator()(
+      EchoV2, std::string request, const soia::service::HttpHeaders&,
+      soia::service::HttpHeaders&) const {
+    return absl::StrCat(request, request);
+  }
+};
+
+TEST(SoialibTest, HandleRequestDispatch) {
+  EchoService service;
+  const soia::service::HttpHeaders request_headers;
+  soia::service::HttpHeaders response_headers;
+  const auto handle = [&](absl::string_view request_body) {
+    return soia::service::HandleRequest(service, request_body,
+                                        request_headers, response_headers);
+  };
+  EXPECT_EQ(handle("Echo:1::\"foo\"").data, "\"foo\"");
+  EXPECT_EQ(handle("Echo:3::\"foo\"").data, "\"foofoo\"");
+  EXPECT_EQ(handle("Square:200::7").data, "49");
+  EXPECT_EQ(handle("{\"method\": \"Square\", \"request\": 3}").data, "9");
+  EXPECT_EQ(handle("{\"request\": 5, \"method\": \"Square\"}").data, "25");
+  EXPECT_EQ(
+      handle("{\"method\": 200, \"request\": 6, \"foo\": [1, {}]}").data,
+      "36");
+  EXPECT_EQ(handle("{\"method\": 200, \"request\": [1]}").type,
+            soia::service::ResponseType::kBadRequest);
+  EXPECT_EQ(handle("{\"method\": 200, \"request\": 6, \"foo\": [}").type,
+            soia::service::ResponseType::kBadRequest);
+  // Without a method number, the first method with the name wins.
+  EXPECT_EQ(handle("{\"method\": \"Echo\", \"request\": \"a\"}").data,
+            "\"a\"");
+  const soia::service::RawResponse not_found = handle("Echo:2::\"foo\"");
+  EXPECT_EQ(not_found.type, soia::service::ResponseType::kBadRequest);
+  EXPECT_EQ(not_found.data,
+            "bad request: method not found: Echo; number: 2");
+  const soia::service::RawResponse method_list = handle("list");
+  EXPECT_EQ(method_list.type, soia::service::ResponseType::kOkJson);
+  EXPECT_EQ(method_list.data, handle("").data);
+  EXPECT_THAT(method_list.data, HasSubstr("\"method\": \"Square\""));
+  EXPECT_THAT(method_list.data, HasSubstr("\"number\": 200"));
+}
+
+class InProcessClient : public soia::service::Client {
+ public:
+  absl::StatusOr<std::string> operator()(
+      absl::string_view request_data,
+      const soia::service::HttpHeaders& request_headers,
+      soia::service::HttpHeaders& response_headers) const override {
+    last_request_was_binary = soia_internal::IsBinaryRequest(request_data);
+    EchoService service;
+    soia::service::RawResponse raw_response = soia::service::HandleRequest(
+        service, request_data, request_headers, response_headers);
+    last_response_type = raw_response.type;
+    return std::move(raw_response).AsStatus();
+  }
+
+  mutable bool last_request_was_binary = false;
+  mutable soia::service::ResponseType last_response_type{};
+};
+
+TEST(SoialibTest, BinaryWireFormat) {
+  EchoService service;
+  const soia::service::HttpHeaders request_headers;
+  soia::service::HttpHeaders response_headers;
+  const soia::service::RawResponse raw_response =
+      soia::service::HandleRequest(
+          service,
+          absl::StrCat("Square:200:binary:", soia::ToBytes(7).as_string()),
+          request_headers, response_headers);
+  EXPECT_EQ(raw_response.type, soia::service::ResponseType::kOkBinary);
+  EXPECT_EQ(raw_response.status_code(), 200);
+  EXPECT_EQ(raw_response.content_type(), "application/octet-stream");
+  EXPECT_EQ(raw_response.data, soia::ToBytes(int64_t{49}).as_string());
+
+  InProcessClient client;
+  EXPECT_THAT(soia::service::InvokeRemote(client, Square(), 9, {}, nullptr,
+                                          soia::service::WireFormat::kBinary),
+              IsOkAndHolds(81));
+  EXPECT_TRUE(client.last_request_was_binary);
+  EXPECT_EQ(client.last_response_type, soia::service::ResponseType::kOkBinary);
+  EXPECT_THAT(soia::service::InvokeRemote(client, Echo(), "a:b", {}, nullptr,
+                                          soia::service::WireFormat::kBinary),
+              IsOkAndHolds("a:b"));
+  EXPECT_THAT(soia::service::InvokeRemote(client, Square(), 9),
+              IsOkAndHolds(81));
+  EXPECT_FALSE(client.last_request_was_binary);
+  EXPECT_EQ(client.last_response_type, soia::service::ResponseType::kOkJson);
+}
+
+// Implements Echo asynchronously and Square synchronously.
+struct AsyncEchoService {
+  using methods = std::tuple<Echo, Square>;
+
+  void operator()(Echo, std::string request,
+                  const soia::service::HttpHeaders& request_headers,
+                  soia::service::HttpHeaders& response_headers,
+                  soia::service::Responder<std::string> responder) {
+    pending.push_back([request = std::move(request), &request_headers,
+                       &response_headers,
+                       responder = std::move(responder)]() mutable {
+      response_headers.Insert("origin", request_headers.GetLast("origin"));
+      std::move(responder)(std::move(request));
+    });
+  }
+
+  absl::StatusOr<int64_t> operator()(Square, int32_t request,
+                                     const soia::service::HttpHeaders&,
+                                     soia::service::HttpHeaders&) const {
+    return int64_t{request} * request;
+  }
+
+  std::vector<absl::AnyInvocable<void() &&>> pending;
+};
+
+TEST(SoialibTest, HandleRequestAsync) {
+  AsyncEchoService service;
+  soia::service::HttpHeaders request_headers;
+  request_headers.Insert("origin", "O");
+  std::vector<std::string> responses;
+  std::vector<std::string> origins;
+  const auto handle = [&](std::string request_body) {
+    soia::service::HandleRequestAsync(
+        service, std::move(request_body), request_headers,
+        [&](soia::service::RawResponse raw_response,
+            soia::service::HttpHeaders response_headers) {
+          responses.push_back(std::move(raw_response.data));
+          origins.push_back(std::string(response_headers.GetLast("origin")));
+        });
+  };
+  handle("Square:200::3");
+  EXPECT_THAT(responses, ElementsAre("9"));
+  handle("Echo:1::\"a\"");
+  handle("Echo:1::\"b\"");
+  handle("Echo:1::[");
+  ASSERT_EQ(service.pending.size(), 2);
+  EXPECT_EQ(responses.size(), 2);
+  std::move(service.pending[1])();
+  std::move(service.pending[0])();
+  EXPECT_THAT(responses,
+              ElementsAre("9", HasSubstr("bad request"), "\"b\"", "\"a\""));
+  EXPECT_THAT(origins, ElementsAre("", "", "O", "O"));
+}
+
+TEST(SoialibTest, InvokeRemoteAsync) {
+  InProcessClient client;
+  absl::StatusOr<int64_t> response;
+  soia::service::InvokeRemoteAsync(
+      client, Square(), 5,
+      [&](absl::StatusOr<int64_t> r, soia::service::HttpHeaders) {
+        response = std::move(r);
+      });
+  EXPECT_THAT(response, IsOkAndHolds(25));
+}
+
+struct Unknown {
+  using request_type = std::string;
+  using response_type = std::string;
+  static constexpr absl::string_view kMethodName = "Unknown";
+  static constexpr int kNumber = 4;
+};
+
+TEST(SoialibTest, RpcBatch) {
+  InProcessClient client;
+  soia::service::RpcBatch batch;
+  const auto echo = batch.Add(Echo(), "a:b");
+  const auto square =
+      batch.Add(Square(), 4, soia::service::WireFormat::kBinary);
+  const auto unknown = batch.Add(Unknown(), "");
+  const auto echo_v2 = batch.Add(EchoV2(), "x");
+  ASSERT_EQ(batch.size(), 4);
+  EXPECT_EQ(square.index(), 1);
+  ASSERT_THAT(batch.Send(client), IsOk());
+  EXPECT_EQ(client.last_response_type, soia::service::ResponseType::kOkBatch);
+  EXPECT_THAT(batch.Get(echo), IsOkAndHolds("a:b"));
+  EXPECT_THAT(batch.Get(square), IsOkAndHolds(16));
+  EXPECT_THAT(batch.Get(unknown),
+              absl::UnknownError("HTTP response status 400: bad request: "
+                                 "method not found: Unknown; number: 4"));
+  EXPECT_THAT(batch.Get(echo_v2), IsOkAndHolds("xx"));
+
+  soia::service::RpcBatch empty_batch;
+  EXPECT_THAT(empty_batch.Send(client), IsOk());
+
+  EchoService service;
+  const soia::service::HttpHeaders request_headers;
+  soia::service::HttpHeaders response_headers;
+  EXPECT_EQ(soia::service::HandleRequest(service, "batch:5:", request_headers,
+                                         response_headers)
+                .type,
+            soia::service::ResponseType::kBadRequest);
+}
+
+TEST(SoialibTest, HandleRequestAsyncBatch) {
+  AsyncEchoService service;
+  soia::service::HttpHeaders request_headers;
+  request_headers.Insert("origin", "O");
+  std::string response;
+  soia::service::HandleRequestAsync(
+      service,
+      soia_internal::EncodeBatchRequest(
+          {"Echo:1::\"a\"", "Square:200::3", "Echo:1::\"b\""}),
+      request_headers,
+      [&](soia::service::RawResponse raw_response,
+          soia::service::HttpHeaders response_headers) {
+        EXPECT_EQ(raw_response.type, soia::service::ResponseType::kOkBatch);
+        EXPECT_THAT(response_headers.Get("origin"), ElementsAre("O", "O"));
+        response = std::move(raw_response.data);
+      });
+  ASSERT_EQ(service.pending.size(), 2);
+  std::move(service.pending[1])();
+  EXPECT_EQ(response, "");
+  std::move(service.pending[0])();
+  EXPECT_EQ(response, "200:3:\"a\"200:1:9200:3:\"b\"");
+}
+
+TEST(SoialibTest, WriteJsonInChunks) {
+  std::vector<std::vector<std::string>> input;
+  for (int i = 0; i < 100; ++i) {
+    input.push_back({absl::StrCat("item_", i), "foo"});
+  }
+  std::vector<std::string> chunks;
+  soia::WriteDenseJson(input, 64, [&](absl::string_view chunk) {
+    chunks.push_back(std::string(chunk));
+  });
+  EXPECT_GT(chunks.size(), 10);
+  EXPECT_EQ(absl::StrJoin(chunks, ""), soia::ToDenseJson(input));
+  chunks.clear();
+  soia::WriteReadableJson(input, 64, [&](absl::string_view chunk) {
+    chunks.push_back(std::string(chunk));
+  });
+  EXPECT_GT(chunks.size(), 10);
+  EXPECT_EQ(absl::StrJoin(chunks, ""), soia::ToReadableJson(input));
+
+  EchoService service;
+  const soia::service::HttpHeaders request_headers;
+  soia::service::HttpHeaders response_headers;
+  soia::service::RawResponse raw_response = soia::service::HandleRequest(
+      service, "Echo:1::\"foo\"", request_headers, response_headers,
+      soia::UnrecognizedFieldsPolicy::kDrop, {.chunk_size = 8});
+  EXPECT_EQ(raw_response.type, soia::service::ResponseType::kOkJson);
+  EXPECT_EQ(raw_response.data, "");
+  ASSERT_TRUE(raw_response.stream);
+  EXPECT_THAT(std::move(raw_response).AsStatus(), IsOkAndHolds("\"foo\""));
+}
+
+class RecordingObserver : public soia::service::ServiceObserver {
+ public:
+  void OnMethodCall(const soia::service::MethodCallStats& stats) override {
+    calls.push_back(stats);
+  }
+
+  std::vector<soia::service::MethodCallStats> calls;
+};
+
+TEST(SoialibTest, ServiceObserver) {
+  EchoService service;
+  RecordingObserver observer;
+  const soia::service::HttpHeaders request_headers;
+  soia::service::HttpHeaders response_headers;
+  const auto handle = [&](absl::string_view request_body,
+                          const soia::service::StreamingOptions& streaming =
+                              {}) {
+    return soia::service::HandleRequest(
+        service, request_body, request_headers, response_headers,
+        soia::UnrecognizedFieldsPolicy::kDrop, streaming, &observer);
+  };
+  handle("list");
+  EXPECT_THAT(observer.calls, IsEmpty());
+
+  handle("Square:200::3");
+  ASSERT_EQ(observer.calls.size(), 1);
+  EXPECT_EQ(observer.calls[0].method_name, "Square");
+  EXPECT_EQ(observer.calls[0].method_number, 200);
+  EXPECT_EQ(observer.calls[0].request_size, 13);
+  EXPECT_EQ(observer.calls[0].response_size, 1);
+  EXPECT_EQ(observer.calls[0].response_type,
+            soia::service::ResponseType::kOkJson);
+  EXPECT_GE(observer.calls[0].parse_time, absl::ZeroDuration());
+  EXPECT_GE(observer.calls[0].handler_time, absl::ZeroDuration());
+  EXPECT_GE(observer.calls[0].serialize_time, absl::ZeroDuration());
+
+  handle("Square:200::[1]");
+  handle("Foo:7::3");
+  handle("Foo:");
+  ASSERT_EQ(observer.calls.size(), 4);
+  EXPECT_EQ(observer.calls[1].method_name, "Square");
+  EXPECT_EQ(observer.calls[1].response_type,
+            soia::service::ResponseType::kBadRequest);
+  EXPECT_EQ(observer.calls[2].method_name, "");
+  EXPECT_EQ(observer.calls[2].response_type,
+            soia::service::ResponseType::kBadRequest);
+  EXPECT_EQ(observer.calls[3].method_name, "");
+  EXPECT_EQ(observer.calls[3].response_type,
+            soia::service::ResponseType::kBadRequest);
+
+  // A streamed response is reported once the stream is written.
+  soia::service::RawResponse raw_response =
+      handle("Echo:1::\"foo\"", {.chunk_size = 8});
+  EXPECT_EQ(observer.calls.size(), 4);
+  raw_response.MaterializeStream();
+  ASSERT_EQ(observer.calls.size(), 5);
+  EXPECT_EQ(observer.calls[4].method_name, "Echo");
+  EXPECT_EQ(observer.calls[4].response_size, 5);
+
+  handle(soia_internal::EncodeBatchRequest({"Echo:1::\"a\"", "Square:200::4"}));
+  ASSERT_EQ(observer.calls.size(), 7);
+  EXPECT_EQ(observer.calls[5].method_name, "Echo");
+  EXPECT_EQ(observer.calls[6].method_name, "Square");
+  EXPECT_EQ(observer.calls[6].response_size, 2);
+
+  AsyncEchoService async_service;
+  soia::service::HandleRequestAsync(
+      async_service, "Echo:1::\"abc\"", request_headers,
+      [](soia::service::RawResponse, soia::service::HttpHeaders) {},
+      soia::UnrecognizedFieldsPolicy::kDrop, &observer);
+  EXPECT_EQ(observer.calls.size(), 7);
+  ASSERT_EQ(async_service.pending.size(), 1);
+  std::move(async_service.pending[0])();
+  ASSERT_EQ(observer.calls.size(), 8);
+  EXPECT_EQ(observer.calls[7].method_name, "Echo");
+  EXPECT_EQ(observer.calls[7].response_size, 5);
+}
+
+TEST(SoialibTest, DynamicCodec) {
+  // struct Point {
+  //   x: int32;  // 0
+  //   removed;  // 1
+  //   label: string;  // 2
+  //   tags: [string];  // 3
+  //   color: Color;  // 4
+  //   next: Point?;  // 5
+  // }
+  // enum Color { RED = 1; custom: int32 = 2; }
+  constexpr absl::string_view kDescriptorJson = R"({
+    "type": {"kind": "array", "value": {
+      "item": {"kind": "record", "value": "point.soia:Point"}}},
+    "records": [
+      {
+        "kind": "struct",
+        "id": "point.soia:Point",
+        "fields": [
+          {"name": "x", "number": 0,
+           "type": {"kind": "primitive", "value": "int32"}},
+          {"name": "label", "number": 2,
+           "type": {"kind": "primitive", "value": "string"}},
+          {"name": "tags", "number": 3,
+           "type": {"kind": "array", "value": {
+             "item": {"kind": "primitive", "value": "string"}}}},
+          {"name": "color", "number": 4,
+           "type": {"kind": "record", "value": "point.soia:Color"}},
+          {"name": "next", "number": 5,
+           "type": {"kind": "optional", "value":
+             {"kind": "record", "value": "point.soia:Point"}}}
+        ],
+        "removed_numbers": [1]
+      },
+      {
+        "kind": "enum",
+        "id": "point.soia:Color",
+        "fields": [
+          {"name": "RED", "number": 1},
+          {"name": "custom", "number": 2,
+           "type": {"kind": "primitive", "value": "int32"}}
+        ]
+      }
+    ]
+  })";
+  const absl::StatusOr<soia::reflection::TypeDescriptor> descriptor =
+      soia::reflection::TypeDescriptor::FromJson(kDescriptorJson);
+  ASSERT_THAT(descriptor, IsOk());
+  const absl::StatusOr<soia::reflection::DynamicCodec> codec =
+      soia::reflection::DynamicCodec::Create(*descriptor);
+  ASSERT_THAT(codec, IsOk());
+
+  // [
+  //   {x: 3, label: "foo", tags: ["a", "b"], color: custom(7), next: {x: 4}},
+  //   {color: RED},
+  // ]
+  const std::string bytes =
+      HexToBytes("f8fa060300f303666f6ff8f30161f30162fc07f704fa05000000f601")
+          .value();
+  EXPECT_THAT(codec->BytesToDenseJson(bytes),
+              IsOkAndHolds("[[3,0,\"foo\",[\"a\",\"b\"],[2,7],[4]],"
+                           "[0,0,\"\",[],1]]"));
+  EXPECT_FALSE(codec->BytesToDenseJson("soia\xfa").ok());
+  EXPECT_FALSE(codec->BytesToDenseJson("[]").ok());
+
+  const absl::StatusOr<soia::reflection::DynamicValue> label =
+      codec->GetField(bytes, "0.label");
+  ASSERT_THAT(label, IsOk());
+  EXPECT_THAT(label->As<std::string>(), IsOkAndHolds("foo"));
+  EXPECT_EQ(label->ToDenseJson(), "\"foo\"");
+  EXPECT_EQ(std::get<soia::reflection::PrimitiveType>(label->type()),
+            soia::reflection::PrimitiveType::kString);
+  EXPECT_EQ(codec->GetField(bytes, "0.tags.1")->ToDenseJson(), "\"b\"");
+  EXPECT_THAT(codec->GetField(bytes, "0.color.custom")->As<int32_t>(),
+              IsOkAndHolds(7));
+  EXPECT_THAT(codec->GetField(bytes, "0.next.x")->As<int32_t>(),
+              IsOkAndHolds(4));
+  // Fields missing from the input have the default value.
+  EXPECT_THAT(codec->GetField(bytes, "0.next.label")->As<std::string>(),
+              IsOkAndHolds(""));
+  EXPECT_EQ(codec->GetField(bytes, "1")->ToDenseJson(), "[0,0,\"\",[],1]");
+  EXPECT_EQ(codec->GetField(bytes, "")->ToDenseJson(),
+            codec->BytesToDenseJson(bytes).value());
+
+  EXPECT_EQ(codec->GetField(bytes, "0.next.next.x").status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(codec->GetField(bytes, "1.color.custom").status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(codec->GetField(bytes, "0.tags.2").status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(codec->GetField(bytes, "0.foo").status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(codec->GetField(bytes, "0.x.y").status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // String references.
+  const std::vector<std::string> strings = {"foobar", "foobar", "foobar"};
+  const absl::StatusOr<soia::reflection::DynamicCodec> strings_codec =
+      soia::reflection::DynamicCodec::Create(
+          soia::reflection::GetTypeDescriptor<std::vector<std::string>>());
+  ASSERT_THAT(strings_codec, IsOk());
+  const std::string strings_bytes =
+      soia::ToBytesWithStringRefs(strings).as_string();
+  EXPECT_THAT(strings_codec->BytesToDenseJson(strings_bytes),
+              IsOkAndHolds(soia::ToDenseJson(strings)));
+  EXPECT_THAT(strings_codec->GetField(strings_bytes, "2")->As<std::string>(),
+              IsOkAndHolds("foobar"));
+
+  soia::reflection::TypeDescriptor invalid = *descriptor;
+  invalid.records = {};
+  EXPECT_EQ(soia::reflection::DynamicCodec::Create(invalid).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(Soialib, DecodeUrlQueryString) {
   EXPECT_THAT(
       soia::service::DecodeUrlQueryString("%D1%88%D0%B5%D0%BB%D0%BB%D1%8B +"),
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <future>
 #include <memory>
 #include <string>
 #include <thread>
@@ -23,6 +24,7 @@ using ::absl_testing::IsOkAndHolds;
 using ::soia::service::HttpHeaders;
 using ::soia::service::InstallServiceOnHttplibServer;
 using ::soia::service::InvokeRemote;
+using ::soia::service::InvokeRemoteAsync;
 using ::soia::service::MakeHttplibClient;
 using ::soiagen_methods::ListUsers;
 using ::soiagen_methods::ListUsersRequest;
@@ -64,6 +66,25 @@ class ServiceImpl {
   absl::flat_hash_map<std::string, std::vector<User>> country_to_users;
 };
 
+// Implements ListUsers asynchronously, from another thread.
+class AsyncServiceImpl {
+ public:
+  using methods = std::tuple<soiagen_methods::ListUsers>;
+
+  void operator()(ListUsers, ListUsersRequest request,
+                  const soia::service::HttpHeaders& request_headers,
+                  soia::service::HttpHeaders& response_headers,
+                  soia::service::Responder<ListUsersResponse> responder) {
+    std::thread([request = std::move(request), &response_headers,
+                 responder = std::move(responder)]() mutable {
+      response_headers.Insert("X-country", request.country);
+      ListUsersResponse response;
+      response.users.push_back(User{.country = request.country, .id = 1});
+      std::move(responder)(std::move(response));
+    }).detach();
+  }
+};
+
 class ServiceImplNoMethod {
  public:
   using methods = std::tuple<>;
@@ -76,6 +97,9 @@ TEST(SoiaServiceTest, TestServerAndClient) {
 
   auto service_impl = std::make_shared<ServiceImpl>();
   InstallServiceOnHttplibServer(server, "/myapi", service_impl);
+  InstallServiceOnHttplibServer(server, "/myapi_streaming", service_impl,
+                                soia::UnrecognizedFieldsPolicy::kDrop,
+                                {.chunk_size = 8});
 
   service_impl->AddUser({
       .id = 102,
@@ -108,6 +132,15 @@ TEST(SoiaServiceTest, TestServerAndClient) {
   EXPECT_THAT(response_headers.map(),
               Contains(Pair("foo", ElementsAre("bar"))));
 
+  EXPECT_THAT(
+      InvokeRemote(*soia_client, ListUsers(), ListUsersRequest{.country = "AU"},
+                   request_headers, &response_headers,
+                   soia::service::WireFormat::kBinary),
+      IsOkAndHolds(StructIs<ListUsersResponse>{
+          .users = ElementsAre(StructIs<User>{
+              .first_name = "Jane",
+          })}));
+
   EXPECT_THAT(
       InvokeRemote(*soia_client, ListUsers(), ListUsersRequest{},
                    request_headers, &response_headers)
@@ -123,6 +156,17 @@ TEST(SoiaServiceTest, TestServerAndClient) {
       absl::UnknownError("HTTP response status 400: bad request: method not "
                          "found: True; number: 2615726"));
 
+  {
+    std::unique_ptr<soia::service::Client> streaming_client =
+        MakeHttplibClient(&client, "/myapi_streaming");
+    EXPECT_THAT(InvokeRemote(*streaming_client, ListUsers(),
+                             ListUsersRequest{.country = "AU"}),
+                IsOkAndHolds(StructIs<ListUsersResponse>{
+                    .users = ElementsAre(StructIs<User>{
+                        .first_name = "Jane",
+                    })}));
+  }
+
   // Send GET requests.
 
   {
@@ -195,6 +239,47 @@ TEST(SoiaServiceTest, TestServerAndClient) {
   server_thread.join();
 }
 
+TEST(SoiaServiceTest, AsyncServerAndClient) {
+  constexpr int kPort = 8787;
+
+  httplib::Server server;
+
+  InstallServiceOnHttplibServer(server, "/myapi",
+                                std::make_shared<AsyncServiceImpl>());
+
+  std::thread server_thread([&server]() { server.listen("localhost", kPort); });
+
+  server.wait_until_ready();
+
+  httplib::Client client("localhost", kPort);
+  std::promise<absl::StatusOr<ListUsersResponse>> response;
+  std::promise<HttpHeaders> response_headers;
+  std::thread::id done_thread_id;
+  {
+    std::unique_ptr<soia::service::Client> soia_client =
+        MakeHttplibClient(&client, "/myapi");
+    InvokeRemoteAsync(
+        *soia_client, ListUsers(), ListUsersRequest{.country = "FR"},
+        [&](absl::StatusOr<ListUsersResponse> r, HttpHeaders headers) {
+          done_thread_id = std::this_thread::get_id();
+          response.set_value(std::move(r));
+          response_headers.set_value(std::move(headers));
+        });
+    // Destroying the client waits for the RPC to complete.
+  }
+  EXPECT_NE(done_thread_id, std::this_thread::get_id());
+  EXPECT_THAT(response.get_future().get(),
+              IsOkAndHolds(StructIs<ListUsersResponse>{
+                  .users = ElementsAre(StructIs<User>{
+                      .country = "FR",
+                  })}));
+  EXPECT_THAT(response_headers.get_future().get().map(),
+              Contains(Pair("x-country", ElementsAre("FR"))));
+
+  server.stop();
+  server_thread.join();
+}
+
 TEST(SoiaServiceTest, NoMethod) {
   constexpr int kPort = 8787;
 
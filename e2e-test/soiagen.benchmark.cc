@@ -0,0 +1,281 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "soia.h"
+#include "soiagen/benchmarks.h"
+#include "soiagen/schema_change.h"
+
+// Benchmarks for the serialization, parsing and service code paths exercised
+// by generated code. To compare two commits, run this binary at each commit
+// with:
+//   bazel run -c opt :soiagen.benchmark -- --benchmark_repetitions=5 \
+//       --benchmark_out_format=json --benchmark_out=/tmp/<commit>.json
+// and compare the outputs with tools/compare.py from Google Benchmark.
+
+namespace {
+using ::soiagen_benchmarks::Address;
+using ::soiagen_benchmarks::Customer;
+using ::soiagen_benchmarks::GetOrders;
+using ::soiagen_benchmarks::GetOrdersRequest;
+using ::soiagen_benchmarks::GetOrdersResponse;
+using ::soiagen_benchmarks::LineItem;
+using ::soiagen_benchmarks::Money;
+using ::soiagen_benchmarks::Order;
+using ::soiagen_benchmarks::OrderBook;
+using ::soiagen_benchmarks::OrderStatus;
+using ::soiagen_schema_change::EnumAfter;
+using ::soiagen_schema_change::FooAfter;
+using ::soiagen_schema_change::FooBefore;
+
+Order MakeOrder(int64_t id) {
+  Order order;
+  order.id = id;
+  order.customer = {
+      .id = id % 1000,
+      .email = absl::StrCat("customer_", id % 1000, "@example.com"),
+      .full_name = absl::StrCat("Customer ", id % 1000),
+      .shipping_address =
+          {
+              .street = absl::StrCat(id % 400, " Main Street"),
+              .city = "Springfield",
+              .postal_code = "12345",
+              .country_code = "US",
+          },
+      .created_at = absl::FromUnixMillis(1700000000000 + id),
+  };
+  if (id % 3 == 0) {
+    order.customer.billing_address = order.customer.shipping_address;
+  }
+  for (int i = 0; i < 1 + id % 5; ++i) {
+    LineItem item;
+    item.sku = absl::StrCat("SKU-", (id * 31 + i) % 10000);
+    item.description = "A product with a reasonably long description";
+    item.quantity = 1 + i;
+    item.unit_price = {
+        .units = 19 + i,
+        .nanos = 990000000,
+        .currency_code = "USD",
+    };
+    if (i % 2 == 1) {
+      item.discount = Money{.units = 2, .currency_code = "USD"};
+    }
+    item.tags = {"sale", "new"};
+    order.items.push_back(std::move(item));
+  }
+  switch (id % 4) {
+    case 0:
+      order.status = soiagen::kPending;
+      break;
+    case 1:
+      order.status = soiagen::kPaid;
+      break;
+    case 2:
+      order.status = soiagen::kShipped;
+      break;
+    default:
+      order.status = OrderStatus::wrap_cancelled("out of stock");
+      break;
+  }
+  order.placed_at = absl::FromUnixMillis(1710000000000 + id * 1000);
+  order.total = {.units = 100 + id % 50, .currency_code = "USD"};
+  if (id % 7 == 0) {
+    order.notes = "Please leave the package at the door.";
+  }
+  order.gift_wrapped = id % 5 == 0;
+  order.signature = soia::ByteString({0x30, 0x45, 0x02, 0x21, 0x00, 0x8f});
+  order.weights = {0.5f, 1.25f, 3.0f};
+  return order;
+}
+
+OrderBook MakeOrderBook(int64_t num_orders) {
+  OrderBook order_book;
+  order_book.orders.reserve(num_orders);
+  for (int64_t i = 0; i < num_orders; ++i) {
+    order_book.orders.push_back(MakeOrder(i));
+  }
+  return order_book;
+}
+
+void BM_ToBytes(benchmark::State& state) {
+  const OrderBook order_book = MakeOrderBook(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::ToBytes(order_book));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          soia::ToBytes(order_book).as_string().size());
+}
+BENCHMARK(BM_ToBytes)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_ToDenseJson(benchmark::State& state) {
+  const OrderBook order_book = MakeOrderBook(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::ToDenseJson(order_book));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          soia::ToDenseJson(order_book).size());
+}
+BENCHMARK(BM_ToDenseJson)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_ToReadableJson(benchmark::State& state) {
+  const OrderBook order_book = MakeOrderBook(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::ToReadableJson(order_book));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          soia::ToReadableJson(order_book).size());
+}
+BENCHMARK(BM_ToReadableJson)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_ParseBytes(benchmark::State& state) {
+  const std::string bytes =
+      soia::ToBytes(MakeOrderBook(state.range(0))).as_string();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::Parse<OrderBook>(bytes));
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_ParseBytes)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_ParseDenseJson(benchmark::State& state) {
+  const std::string json = soia::ToDenseJson(MakeOrderBook(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::Parse<OrderBook>(json));
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_ParseDenseJson)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_ParseReadableJson(benchmark::State& state) {
+  const std::string json = soia::ToReadableJson(MakeOrderBook(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(soia::Parse<OrderBook>(json));
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_ParseReadableJson)->Arg(1)->Arg(100)->Arg(10000);
+
+FooAfter MakeFooAfter(int64_t num_bars) {
+  FooAfter foo;
+  for (int64_t i = 0; i < num_bars; ++i) {
+    foo.bars.push_back({.x = i * 0.5, .s = absl::StrCat("bar_", i)});
+    foo.enums.push_back(i % 2 == 0
+                            ? EnumAfter(soiagen::kB)
+                            : EnumAfter::wrap_c(absl::StrCat("c_", i)));
+  }
+  foo.n = 3;
+  foo.bit = true;
+  return foo;
+}
+
+// Parses values written with a newer schema, keeping the unrecognized fields,
+// and serializes them back.
+void BM_UnrecognizedFieldsRoundTripBytes(benchmark::State& state) {
+  const std::string bytes =
+      soia::ToBytes(MakeFooAfter(state.range(0))).as_string();
+  for (auto _ : state) {
+    absl::StatusOr<FooBefore> foo = soia::Parse<FooBefore>(
+        bytes, soia::UnrecognizedFieldsPolicy::kKeep);
+    benchmark::DoNotOptimize(soia::ToBytes(*foo));
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_UnrecognizedFieldsRoundTripBytes)->Arg(10)->Arg(1000);
+
+void BM_UnrecognizedFieldsRoundTripDenseJson(benchmark::State& state) {
+  const std::string json = soia::ToDenseJson(MakeFooAfter(state.range(0)));
+  for (auto _ : state) {
+    absl::StatusOr<FooBefore> foo =
+        soia::Parse<FooBefore>(json, soia::UnrecognizedFieldsPolicy::kKeep);
+    benchmark::DoNotOptimize(soia::ToDenseJson(*foo));
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_UnrecognizedFieldsRoundTripDenseJson)->Arg(10)->Arg(1000);
+
+void BM_KeyedItemsInsert(benchmark::State& state) {
+  std::vector<Order> orders;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    orders.push_back(MakeOrder(i));
+  }
+  for (auto _ : state) {
+    decltype(OrderBook::orders) keyed_orders;
+    for (const Order& order : orders) {
+      keyed_orders.push_back(order);
+    }
+    benchmark::DoNotOptimize(keyed_orders);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyedItemsInsert)->Arg(100)->Arg(10000);
+
+void BM_KeyedItemsFind(benchmark::State& state) {
+  const OrderBook order_book = MakeOrderBook(state.range(0));
+  int64_t id = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(order_book.orders.find_or_null(id));
+    id = (id + 7919) % state.range(0);
+  }
+}
+BENCHMARK(BM_KeyedItemsFind)->Arg(100)->Arg(10000)->Arg(1000000);
+
+class ServiceImpl {
+ public:
+  using methods = std::tuple<GetOrders>;
+
+  absl::StatusOr<GetOrdersResponse> operator()(
+      GetOrders, GetOrdersRequest request,
+      const soia::service::HttpHeaders& request_headers,
+      soia::service::HttpHeaders& response_headers) const {
+    GetOrdersResponse response;
+    for (const Order& order : order_book.orders) {
+      if (response.orders.size() >= static_cast<size_t>(request.max_results)) {
+        break;
+      }
+      if (order.customer.id == request.customer_id) {
+        response.orders.push_back(order);
+      }
+    }
+    return response;
+  }
+
+  OrderBook order_book = MakeOrderBook(1000);
+};
+
+void BM_HandleRequest(benchmark::State& state) {
+  ServiceImpl service_impl;
+  const std::string request_body = absl::StrCat(
+      "GetOrders:", GetOrders::kNumber, "::",
+      soia::ToDenseJson(GetOrdersRequest{
+          .customer_id = 42,
+          .max_results = 10,
+      }));
+  const soia::service::HttpHeaders request_headers;
+  for (auto _ : state) {
+    soia::service::HttpHeaders response_headers;
+    benchmark::DoNotOptimize(soia::service::HandleRequest(
+        service_impl, request_body, request_headers, response_headers));
+  }
+}
+BENCHMARK(BM_HandleRequest);
+
+void BM_HandleRequestMethodList(benchmark::State& state) {
+  ServiceImpl service_impl;
+  const soia::service::HttpHeaders request_headers;
+  for (auto _ : state) {
+    soia::service::HttpHeaders response_headers;
+    benchmark::DoNotOptimize(soia::service::HandleRequest(
+        service_impl, "list", request_headers, response_headers));
+  }
+}
+BENCHMARK(BM_HandleRequestMethodList);
+
+}  // namespace
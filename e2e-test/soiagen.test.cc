@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <type_traits>
+#include <utility>
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
@@ -12,33 +13,50 @@
 #include "reserializer.testing.h"
 #include "soia.h"
 #include "soia.testing.h"
+#include "soiagen/arena.h"
 #include "soiagen/constants.h"
 #include "soiagen/enums.h"
 #include "soiagen/enums.testing.h"
 #include "soiagen/full_name.h"
+#include "soiagen/lazy.h"
+#include "soiagen/lazy.testing.h"
 #include "soiagen/methods.h"
+#include "soiagen/shared.h"
+#include "soiagen/shared.testing.h"
 #include "soiagen/simple_enum.h"
 #include "soiagen/simple_enum.testing.h"
 #include "soiagen/structs.h"
 #include "soiagen/structs.testing.h"
+#include "soiagen/views.h"
 
 namespace {
 using ::absl_testing::IsOk;
 using ::absl_testing::IsOkAndHolds;
 using ::soia_testing_internal::MakeReserializer;
+using ::soiagen_arena::ArenaPet;
+using ::soiagen_arena::ArenaUser;
 using ::soiagen_enums::EmptyEnum;
 using ::soiagen_enums::JsonValue;
 using ::soiagen_enums::Weekday;
 using ::soiagen_full_name::FullName;
+using ::soiagen_lazy::LazyPoint;
+using ::soiagen_lazy::LazyShape;
+using ::soiagen_shared::SharedNode;
+using ::soiagen_shared::SharedPoint;
 using ::soiagen_structs::Bundle;
 using ::soiagen_structs::CarOwner;
+using ::soiagen_structs::Color;
 using ::soiagen_structs::Empty;
 using ::soiagen_structs::EmptyWithRm1;
 using ::soiagen_structs::Item;
 using ::soiagen_structs::KeyedItems;
+using ::soiagen_structs::Point;
 using ::soiagen_structs::Rec;
+using ::soiagen_structs::Triangle;
 using ::soiagen_user::User;
 using ::soiagen_vehicles_car::Car;
+using ::soiagen_views::ViewPet;
+using ::soiagen_views::ViewUser;
 using ::testing::ElementsAre;
 using ::testing::Not;
 using ::testing::Pair;
@@ -209,6 +227,262 @@ TEST(SoiagenTest, ParseStructFromInvalidJson) {
   EXPECT_THAT(soia::Parse<FullName>("{ first_name: 0 "), Not(IsOk()));
 }
 
+TEST(SoiagenTest, ParseWithFieldMask) {
+  const Triangle triangle = {
+      .color = {.r = 1, .g = 2, .b = 3},
+      .points = {{.x = 4, .y = 5}, {.x = 6, .y = 7}},
+  };
+  const soia::FieldMask<Triangle> mask(
+      soiagen::get_x<soiagen::get_points<>>(),
+      soiagen::get_color<>(),
+      soiagen::get_g<soiagen::get_color<>>());
+  const Triangle expected = {
+      .color = {.r = 1, .g = 2, .b = 3},
+      .points = {{.x = 4}, {.x = 6}},
+  };
+  EXPECT_THAT(
+      soia::Parse<Triangle>(soia::ToBytes(triangle).as_string(), mask),
+      IsOkAndHolds(expected));
+  EXPECT_THAT(soia::Parse<Triangle>(soia::ToDenseJson(triangle), mask),
+              IsOkAndHolds(expected));
+  EXPECT_THAT(soia::Parse<Triangle>(soia::ToReadableJson(triangle), mask),
+              IsOkAndHolds(expected));
+
+  const soia::FieldMask<Triangle> color_mask(
+      soiagen::get_b<soiagen::get_color<>>());
+  EXPECT_THAT(
+      soia::Parse<Triangle>(soia::ToBytes(triangle).as_string(), color_mask),
+      IsOkAndHolds(Triangle{.color = {.b = 3}}));
+}
+
+TEST(SoiagenTest, Columns) {
+  const std::vector<Point> rows = {{.x = 1}, {.x = 2, .y = 3}, {}};
+  soia::columns<Point> columns(rows);
+  EXPECT_EQ(columns.size(), 3);
+  EXPECT_THAT(columns.column<soiagen::get_x<>>(), ElementsAre(1, 2, 0));
+  EXPECT_THAT(columns.column<soiagen::get_y<>>(), ElementsAre(0, 3, 0));
+  EXPECT_EQ(columns.row(1), rows[1]);
+  EXPECT_EQ(columns.ToRows(), rows);
+  EXPECT_EQ(soia::ToDenseJson(columns), "[3,[1,2,0],[0,3,0]]");
+  EXPECT_EQ(
+      soia::ToBytes(columns).as_string(),
+      absl::string_view("soia\xf9\x03\xf9\x01\x02\x00\xf9\x00\x03\x00", 14));
+  EXPECT_EQ(soia::GetEncodedSize(columns), 14);
+  EXPECT_EQ(soia::ToReadableJson(columns), soia::ToReadableJson(rows));
+  EXPECT_EQ(soia_internal::ToDebugString(columns),
+            soia_internal::ToDebugString(rows));
+  for (const std::string& input :
+       {soia::ToDenseJson(columns), soia::ToReadableJson(columns),
+        std::string(soia::ToBytes(columns).as_string())}) {
+    EXPECT_THAT(soia::Parse<soia::columns<Point>>(input),
+                IsOkAndHolds(columns));
+  }
+
+  // A column of default values is encoded as an empty array.
+  columns.column<soiagen::get_y<>>()[1] = 0;
+  EXPECT_EQ(soia::ToDenseJson(columns), "[3,[1,2,0]]");
+  EXPECT_THAT(soia::Parse<soia::columns<Point>>("[3,[1,2,0],[]]"),
+              IsOkAndHolds(columns));
+  EXPECT_THAT(soia::Parse<soia::columns<Point>>("[3,[1,2]]"), Not(IsOk()));
+
+  // If all the columns are default, the first one is written in full.
+  const soia::columns<Point> defaults(std::vector<Point>(2));
+  EXPECT_EQ(soia::ToDenseJson(defaults), "[2,[0,0]]");
+  EXPECT_THAT(
+      soia::Parse<soia::columns<Point>>(soia::ToBytes(defaults).as_string()),
+      IsOkAndHolds(defaults));
+
+  // The number of rows can't exceed the length of the input.
+  EXPECT_THAT(soia::Parse<soia::columns<Point>>("[1000000000000]"),
+              Not(IsOk()));
+  EXPECT_THAT(soia::Parse<soia::columns<Point>>(absl::string_view(
+                  "soia\xf7\xea\xff\xff\xff\xff\xff\xff\xff\x0f", 14)),
+              Not(IsOk()));
+  // A struct without fields has no column, so its number of rows is capped.
+  const soia::columns<Empty> empties(std::vector<Empty>(3));
+  EXPECT_THAT(
+      soia::Parse<soia::columns<Empty>>(soia::ToBytes(empties).as_string()),
+      IsOkAndHolds(empties));
+  EXPECT_THAT(soia::Parse<soia::columns<Empty>>(absl::string_view(
+                  "soia\xf7\xea\xff\xff\xff\xff\xff\xff\xff\x0f", 14)),
+              Not(IsOk()));
+  EXPECT_THAT(soia::Parse<soia::columns<Empty>>("[1000000000000]"),
+              Not(IsOk()));
+
+  EXPECT_EQ(
+      soia::reflection::GetTypeDescriptor<soia::columns<Point>>().AsJson(),
+      soia::reflection::GetTypeDescriptor<std::vector<Point>>().AsJson());
+}
+
+TEST(SoiagenTest, ArenaStruct) {
+  static_assert(
+      std::is_same_v<decltype(ArenaUser::name), soia::arena_string>);
+  static_assert(std::is_same_v<decltype(ArenaUser::pets),
+                               soia::arena_vector<ArenaPet>>);
+  const ArenaUser user = {
+      .name = "Osi",
+      .pets = {{.name = "Cupcake"}},
+      .tags = {"a", "b"},
+  };
+  EXPECT_THAT(MakeReserializer(user)
+                  .ExpectDenseJson("[\"Osi\",[\"a\",\"b\"],[[\"Cupcake\"]]]")
+                  .Check(),
+              IsOk());
+
+  soia::Arena arena;
+  const absl::StatusOr<ArenaUser> parsed =
+      soia::Parse<ArenaUser>(soia::ToBytes(user).as_string(), arena);
+  ASSERT_THAT(parsed, IsOk());
+  EXPECT_EQ(*parsed, user);
+  EXPECT_EQ(parsed->tags.get_allocator().arena(), &arena);
+  EXPECT_EQ(parsed->pets[0].name.get_allocator().arena(), &arena);
+}
+
+TEST(SoiagenTest, ArenaStructCopyOutlivesArena) {
+  // A pet with an unrecognized field after its name.
+  const absl::string_view bytes = "soia\xf8\xf3\x03" "foo\x05";
+  absl::optional<ArenaPet> copy;
+  {
+    soia::Arena arena;
+    const absl::StatusOr<ArenaPet> pet = soia::Parse<ArenaPet>(
+        bytes, arena, soia::UnrecognizedFieldsPolicy::kKeep);
+    ASSERT_THAT(pet, IsOk());
+    copy = *pet;
+  }
+  EXPECT_EQ(copy->name, "foo");
+  EXPECT_EQ(copy->name.get_allocator().arena(), nullptr);
+  EXPECT_EQ(soia::ToBytes(*copy).as_string(), bytes);
+}
+
+TEST(SoiagenTest, LazyFields) {
+  static_assert(std::is_same_v<decltype(LazyShape::center),
+                               soia::lazy<LazyPoint>>);
+  static_assert(std::is_same_v<decltype(LazyShape::points),
+                               soia::lazy<std::vector<LazyPoint>>>);
+  const LazyShape shape = {
+      .center = LazyPoint{.x = 1},
+      .name = "foo",
+      .points = std::vector<LazyPoint>{{.x = 2, .y = 3}},
+  };
+  EXPECT_EQ(soia::ToDenseJson(shape), "[\"foo\",[1],[[2,3]]]");
+
+  const absl::StatusOr<LazyShape> parsed = soia::Parse<LazyShape>(
+      soia::ToBytes(shape).as_string(), soia::UnrecognizedFieldsPolicy::kKeep);
+  ASSERT_THAT(parsed, IsOk());
+  EXPECT_TRUE(parsed->center.has_encoded_bytes());
+  EXPECT_EQ(soia::ToBytes(*parsed), soia::ToBytes(shape));
+  EXPECT_EQ(parsed->center->x, 1);
+  EXPECT_EQ(*parsed, shape);
+  EXPECT_THAT(*parsed, (::testing::soiagen::StructIs<LazyShape>{
+                           .center = {.x = 1},
+                           .name = "foo",
+                       }));
+
+  // A lazy field of the wrong type is only reported when decoded.
+  const absl::StatusOr<LazyShape> invalid =
+      soia::Parse<LazyShape>("[\"foo\",[\"a\"]]");
+  ASSERT_THAT(invalid, IsOk());
+  EXPECT_THAT(invalid->center.decoded(), Not(IsOk()));
+  EXPECT_EQ(*invalid->center, LazyPoint{});
+  EXPECT_THAT(invalid->points.decoded(), IsOk());
+}
+
+TEST(SoiagenTest, SharedFields) {
+  static_assert(std::is_same_v<decltype(SharedNode::next),
+                               soia::shared<SharedNode>>);
+  static_assert(std::is_same_v<decltype(SharedNode::point),
+                               soia::shared<SharedPoint>>);
+  static_assert(std::is_same_v<decltype(SharedNode::children),
+                               soia::shared<std::vector<SharedNode>>>);
+  SharedNode node = {
+      .children = std::vector<SharedNode>{{.label = "child"}},
+      .label = "root",
+      .point = SharedPoint{.x = 1},
+  };
+  node.next->next->label = "grandchild";
+  EXPECT_EQ(soia::ToDenseJson(node),
+            "[\"root\",[\"\",[\"grandchild\"]],[1],[[\"child\"]]]");
+  EXPECT_THAT(node, (::testing::soiagen::StructIs<SharedNode>{
+                        .children = ElementsAre(
+                            ::testing::soiagen::StructIs<SharedNode>{
+                                .label = "child",
+                            }),
+                        .label = "root",
+                        .next =
+                            ::testing::soiagen::StructIs<SharedNode>{
+                                .next =
+                                    ::testing::soiagen::StructIs<SharedNode>{
+                                        .label = "grandchild",
+                                    },
+                            },
+                        .point = {.x = 1},
+                    }));
+  EXPECT_THAT(node, Not(::testing::soiagen::StructIs<SharedNode>{
+                        .next =
+                            ::testing::soiagen::StructIs<SharedNode>{
+                                .label = "grandchild",
+                            },
+                    }));
+
+  // Copies share their values until modified.
+  SharedNode copy = node;
+  EXPECT_TRUE(copy.next.is_shared());
+  EXPECT_TRUE(copy.children.is_shared());
+  copy.next->next->label = "other";
+  EXPECT_FALSE(copy.next.is_shared());
+  EXPECT_TRUE(copy.children.is_shared());
+  EXPECT_EQ(std::as_const(node).next->next->label, "grandchild");
+  EXPECT_NE(copy, node);
+  copy.next->next->label = "grandchild";
+  EXPECT_EQ(copy, node);
+
+  const absl::StatusOr<SharedNode> parsed =
+      soia::Parse<SharedNode>(soia::ToBytes(node).as_string());
+  ASSERT_THAT(parsed, IsOk());
+  EXPECT_EQ(*parsed, node);
+  EXPECT_EQ(soia_internal::ToDebugString(*parsed),
+            soia_internal::ToDebugString(node));
+}
+
+TEST(SoiagenTest, ViewStruct) {
+  static_assert(std::is_same_v<decltype(ViewUser::name), absl::string_view>);
+  static_assert(std::is_same_v<decltype(ViewUser::tags),
+                               std::vector<absl::string_view>>);
+  static_assert(
+      std::is_same_v<decltype(ViewPet::picture), soia::ByteStringView>);
+  const ViewUser user = {
+      .name = "Osi",
+      .pets = {{
+          .name = "Cupcake",
+          .picture = absl::string_view("\x89PNG", 4),
+      }},
+      .tags = {"a", "b"},
+  };
+  EXPECT_EQ(soia::ToDenseJson(user),
+            "[\"Osi\",[[\"Cupcake\",\"iVBORw==\"]],[\"a\",\"b\"]]");
+
+  const soia::ByteString bytes = soia::ToBytes(user);
+  const absl::string_view input = bytes.as_string();
+  const absl::StatusOr<ViewUser> parsed = soia::Parse<ViewUser>(input);
+  ASSERT_THAT(parsed, IsOk());
+  EXPECT_EQ(*parsed, user);
+  EXPECT_EQ(soia::ToBytes(*parsed), bytes);
+  // The strings and bytes point into the input instead of owning a copy.
+  const ViewPet* pet = parsed->pets.find_or_null("Cupcake");
+  ASSERT_NE(pet, nullptr);
+  EXPECT_GE(pet->name.data(), input.data());
+  EXPECT_LE(pet->name.data() + pet->name.length(),
+            input.data() + input.length());
+  EXPECT_GE(pet->picture.as_string().data(), input.data());
+  EXPECT_LE(pet->picture.as_string().data() + pet->picture.length(),
+            input.data() + input.length());
+
+  // JSON strings are unescaped, so there is nothing in the input to point
+  // into.
+  EXPECT_THAT(soia::Parse<ViewUser>(soia::ToDenseJson(user)), Not(IsOk()));
+  EXPECT_THAT(soia::Parse<ViewUser>("[]"), IsOk());
+}
+
 TEST(SoiagenTest, StatusEnumSimpleOps) {
   StatusEnum _ = StatusEnum();
   EXPECT_EQ(StatusEnum(), StatusEnum(soiagen::kUnknown));
@@ -20,8 +20,34 @@ import {
   modulePathToNamespace,
 } from "./type_speller.js";
 
-const Config = z.object({
+// Options which can be set for the modules listed in `moduleOptions`.
+const ModuleOptions = z.object({
+  // If true, string and array fields use soia::arena_string and
+  // soia::arena_vector, which allocate from the soia::Arena passed to
+  // soia::Parse.
+  arena: z.boolean().optional(),
+  // If true, the fields of struct or array type are wrapped in soia::lazy, and
+  // decoded the first time they are accessed.
+  lazyFields: z.boolean().optional(),
+  // If true, the fields of struct or array type and the recursive fields are
+  // wrapped in soia::shared, so that copying a struct does not deep-copy them.
+  // Has no effect on the fields wrapped in soia::lazy.
+  sharedFields: z.boolean().optional(),
+  // If true, string and bytes fields use absl::string_view and
+  // soia::ByteStringView, which point into the bytes passed to soia::Parse
+  // instead of copying them. Such structs can only be parsed from the binary
+  // format, and must not outlive the bytes they were parsed from. Takes
+  // precedence over `arena` for strings. The module cannot declare constants.
+  views: z.boolean().optional(),
+});
+
+type ModuleOptions = z.infer<typeof ModuleOptions>;
+
+const Config = ModuleOptions.extend({
   writeGoogleTestHeaders: z.boolean(),
+  // Overrides the options above for some modules. Keys are the paths of the
+  // modules, relative to the source directory.
+  moduleOptions: z.record(z.string(), ModuleOptions).optional(),
 });
 
 type Config = z.infer<typeof Config>;
@@ -36,7 +62,14 @@ class CcCodeGenerator implements CodeGenerator<Config> {
     const outputFiles: CodeGenerator.OutputFile[] = [];
 
     for (const module of input.modules) {
-      const generator = new CcLibFilesGenerator(module, recordMap);
+      const generator = new CcLibFilesGenerator(
+        module,
+        recordMap,
+        getModuleOption(config, module, "arena"),
+        getModuleOption(config, module, "lazyFields"),
+        getModuleOption(config, module, "sharedFields"),
+        getModuleOption(config, module, "views"),
+      );
       outputFiles.push({
         path: module.path.replace(/\.soia$/, ".h"),
         code: generator.getCode(".h"),
@@ -57,6 +90,16 @@ class CcCodeGenerator implements CodeGenerator<Config> {
   }
 }
 
+function getModuleOption(
+  config: Config,
+  module: Module,
+  option: keyof ModuleOptions,
+): boolean {
+  return (
+    config.moduleOptions?.[module.path]?.[option] ?? config[option] ?? false
+  );
+}
+
 /**
  * Generates the code for one C++ library, made of one .h file and one .cc
  * file.
@@ -65,8 +108,19 @@ class CcLibFilesGenerator {
   constructor(
     private readonly inModule: Module,
     private readonly recordMap: ReadonlyMap<RecordKey, RecordLocation>,
+    arena: boolean,
+    private readonly lazyFields: boolean,
+    private readonly sharedFields: boolean,
+    private readonly views: boolean,
   ) {
-    this.typeSpeller = new TypeSpeller(recordMap, inModule, this.includes);
+    this.typeSpeller = new TypeSpeller(
+      recordMap,
+      inModule,
+      this.includes,
+      arena,
+      sharedFields,
+      views,
+    );
     this.recursivityResolver = RecursvityResolver.resolve(recordMap, inModule);
     this.includes.add('"soia.h"');
     this.namespace = modulePathToNamespace(inModule.path);
@@ -165,10 +219,7 @@ class CcLibFilesGenerator {
     // https://abseil.io/tips/172
     for (const field of fieldsByName) {
       const type = field.type!;
-      const fieldIsRecursive = this.recursivityResolver.isRecursive(field);
-      const ccType = typeSpeller.getCcType(type, {
-        fieldIsRecursive: fieldIsRecursive,
-      });
+      const ccType = this.getFieldCcType(field);
       const fieldName = maybeEscapeLowerCaseName(field.name.text);
       // Numeric types must be initialized.
       let assignment = "";
@@ -202,11 +253,7 @@ class CcLibFilesGenerator {
     header.mainMiddle.push("");
     header.mainMiddle.push("  struct whole {");
     for (const field of fieldsByName) {
-      const type = field.type!;
-      const fieldIsRecursive = this.recursivityResolver.isRecursive(field);
-      const ccType = typeSpeller.getCcType(type, {
-        fieldIsRecursive: fieldIsRecursive,
-      });
+      const ccType = this.getFieldCcType(field);
       const fieldName = maybeEscapeLowerCaseName(field.name.text);
       header.mainMiddle.push(`    ::soia::must_init<${ccType}> ${fieldName};`);
     }
@@ -451,10 +498,10 @@ class CcLibFilesGenerator {
       source.internalMain.push("");
     }
 
-    {
-      // Append(const T&, ByteSink&)
+    // Append(const T&, ByteCounter&) mirrors Append(const T&, ByteSink&).
+    for (const sinkType of ["ByteSink", "ByteCounter"]) {
       source.internalMain.push(
-        `void ${adapterName}::Append(const type& input, ByteSink& out) {`,
+        `void ${adapterName}::Append(const type& input, ${sinkType}& out) {`,
       );
       source.internalMain.push(
         "  const auto& unrecognized = input._unrecognized.data;",
@@ -505,6 +552,10 @@ class CcLibFilesGenerator {
       source.internalMain.push(`void ${adapterName}::Parse(`);
       source.internalMain.push("    JsonTokenizer& tokenizer,");
       source.internalMain.push("    type& out) {");
+      if (fields.length) {
+        source.internalMain.push("  const FieldMaskNode* const field_mask =");
+        source.internalMain.push("      tokenizer.state().field_mask;");
+      }
       source.internalMain.push("  switch (tokenizer.state().token_type) {");
       source.internalMain.push("    case JsonTokenType::kLeftSquareBracket: {");
       source.internalMain.push(
@@ -523,7 +574,7 @@ class CcLibFilesGenerator {
           );
         }
         source.internalMain.push(
-          `      ::soia_internal::Parse(tokenizer, out.${ccFieldName});`,
+          `      ::soia_internal::ParseField(field_mask, ${field.number}, tokenizer, out.${ccFieldName});`,
         );
         lastNumber = field.number;
       }
@@ -543,19 +594,39 @@ class CcLibFilesGenerator {
       source.internalMain.push("      break;");
       source.internalMain.push("    }");
       source.internalMain.push("    case JsonTokenType::kLeftCurlyBracket: {");
-      const parserExpr =
-        "(new StructJsonObjectParser<type>())" +
-        fields
-          .map((field) => {
+      source.internalMain.push(
+        "      JsonObjectReader object_reader(&tokenizer);",
+      );
+      source.internalMain.push("      while (object_reader.NextEntry()) {");
+      if (fields.length) {
+        // Dispatch on the length of the name first, then compare the name
+        // against the few field names with that length.
+        source.internalMain.push(
+          "        const ::absl::string_view name = object_reader.name();",
+        );
+        source.internalMain.push("        switch (name.length()) {");
+        for (const [length, group] of groupByNameLength(
+          fields,
+          (f) => f.name.text,
+        )) {
+          source.internalMain.push(`          case ${length}: {`);
+          for (const field of group) {
             const name = field.name.text;
             const ccFieldName = maybeEscapeLowerCaseName(name);
-            const indent = "              ";
-            return `\n${indent}->AddField("${name}", &type::${ccFieldName})`;
-          })
-          .join("");
-      source.internalMain.push("      static const auto* kParser =");
-      source.internalMain.push(`          ${parserExpr};`);
-      source.internalMain.push("      kParser->Parse(tokenizer, out);");
+            source.internalMain.push(`            if (name == "${name}") {`);
+            source.internalMain.push(
+              `              ::soia_internal::ParseField(field_mask, ${field.number}, tokenizer, out.${ccFieldName});`,
+            );
+            source.internalMain.push("              continue;");
+            source.internalMain.push("            }");
+          }
+          source.internalMain.push("            break;");
+          source.internalMain.push("          }");
+        }
+        source.internalMain.push("        }");
+      }
+      source.internalMain.push("        SkipValue(tokenizer);");
+      source.internalMain.push("      }");
       source.internalMain.push("      break;");
       source.internalMain.push("    }");
       source.internalMain.push("    case JsonTokenType::kZero:");
@@ -576,6 +647,11 @@ class CcLibFilesGenerator {
       source.internalMain.push(
         `void ${adapterName}::Parse(ByteSource& source, type& out) {`,
       );
+      if (fields.length) {
+        source.internalMain.push(
+          "  const FieldMaskNode* const field_mask = source.field_mask;",
+        );
+      }
       source.internalMain.push("  ::uint32_t array_len = 0;");
       source.internalMain.push("  ParseArrayPrefix(source, array_len);");
       let lastNumber = -1;
@@ -587,7 +663,7 @@ class CcLibFilesGenerator {
         }
         source.internalMain.push(`  if (array_len == ${field.number}) return;`);
         source.internalMain.push(
-          `  ::soia_internal::Parse(source, out.${ccFieldName});`,
+          `  ::soia_internal::ParseField(field_mask, ${field.number}, source, out.${ccFieldName});`,
         );
         lastNumber = field.number;
       }
@@ -1297,10 +1373,10 @@ class CcLibFilesGenerator {
       source.internalMain.push("");
     }
 
-    {
-      // Append(const T&, ByteSink&)
+    // Append(const T&, ByteCounter&) mirrors Append(const T&, ByteSink&).
+    for (const sinkType of ["ByteSink", "ByteCounter"]) {
       source.internalMain.push(
-        `void ${adapterName}::Append(const type& input, ByteSink& out) {`,
+        `void ${adapterName}::Append(const type& input, ${sinkType}& out) {`,
       );
       source.internalMain.push("  switch (input.kind_) {");
       for (const field of constFields) {
@@ -1393,7 +1469,7 @@ class CcLibFilesGenerator {
       }
       source.internalMain.push("      });");
       source.internalMain.push(
-        "      const auto it = kMap->find(tokenizer.state().string_value);",
+        "      const auto it = kMap->find(tokenizer.state().string_value());",
       );
       source.internalMain.push("      if (it == kMap->cend()) break;");
       source.internalMain.push("      out = it->second;");
@@ -1437,18 +1513,50 @@ class CcLibFilesGenerator {
       source.internalMain.push("      break;");
       source.internalMain.push("    }");
       source.internalMain.push("    case JsonTokenType::kLeftCurlyBracket: {");
-      const parserExpr =
-        "(new EnumJsonObjectParser<type>())" +
-        wrapperFields
-          .map((field) => {
-            const { fieldName, typeAlias } = field;
-            const indent = "              ";
-            return `\n${indent}->AddField<type::${typeAlias}>("${fieldName}")`;
-          })
-          .join("");
-      source.internalMain.push("      static const auto* kParser =");
-      source.internalMain.push(`          ${parserExpr};`);
-      source.internalMain.push("      kParser->Parse(tokenizer, out);");
+      source.internalMain.push("      ::soia_internal::ParseEnumJsonObject(");
+      source.internalMain.push("          tokenizer,");
+      source.internalMain.push(
+        "          [](::absl::string_view kind) -> int {",
+      );
+      if (wrapperFields.length) {
+        source.internalMain.push("            switch (kind.length()) {");
+        for (const [length, group] of groupByNameLength(
+          wrapperFields,
+          (f) => f.fieldName,
+        )) {
+          source.internalMain.push(`              case ${length}: {`);
+          for (const field of group) {
+            const { fieldName, fieldNumber } = field;
+            source.internalMain.push(
+              `                if (kind == "${fieldName}") return ${fieldNumber};`,
+            );
+          }
+          source.internalMain.push("                break;");
+          source.internalMain.push("              }");
+        }
+        source.internalMain.push("            }");
+      }
+      source.internalMain.push("            return 0;");
+      source.internalMain.push("          },");
+      if (wrapperFields.length) {
+        source.internalMain.push("          [&](int number) {");
+        source.internalMain.push("            switch (number) {");
+        for (const field of wrapperFields) {
+          const { fieldNumber, typeAlias } = field;
+          source.internalMain.push(`              case ${fieldNumber}: {`);
+          source.internalMain.push(`                type::${typeAlias} wrapper;`);
+          source.internalMain.push(
+            "                ::soia_internal::Parse(tokenizer, wrapper.value);",
+          );
+          source.internalMain.push("                out = std::move(wrapper);");
+          source.internalMain.push("                break;");
+          source.internalMain.push("              }");
+        }
+        source.internalMain.push("            }");
+        source.internalMain.push("          });");
+      } else {
+        source.internalMain.push("          [](int) {});");
+      }
       source.internalMain.push("      break;");
       source.internalMain.push("    }");
       source.internalMain.push("    default: {");
@@ -1641,6 +1749,9 @@ class CcLibFilesGenerator {
       "  static void Append(const type&, DebugString&);",
     );
     header.internalMain.push("  static void Append(const type&, ByteSink&);");
+    header.internalMain.push(
+      "  static void Append(const type&, ByteCounter&);",
+    );
     header.internalMain.push("  static void Parse(JsonTokenizer&, type&);");
     header.internalMain.push("  static void Parse(ByteSource&, type&);");
     header.internalMain.push(
@@ -1768,6 +1879,13 @@ class CcLibFilesGenerator {
 
   private writeCodeForConstant(constant: Constant): void {
     const { header, source, typeSpeller } = this;
+    if (this.views) {
+      // Constants are parsed from JSON, which views cannot point into.
+      throw new Error(
+        `${this.inModule.path}: constant ${constant.name.text} cannot be ` +
+          "declared in a module generated with the views option",
+      );
+    }
     const name = `k_${constant.name.text.toLowerCase()}`;
     const type = typeSpeller.getCcType(constant.type!);
     const ccStringLiteral = JSON.stringify(
@@ -1801,6 +1919,31 @@ class CcLibFilesGenerator {
     }
   }
 
+  /** C++ type of a struct field, as declared in the struct. */
+  private getFieldCcType(field: Field): string {
+    const type = field.type!;
+    const fieldIsRecursive = this.recursivityResolver.isRecursive(field);
+    const ccType = this.typeSpeller.getCcType(type, {
+      fieldIsRecursive: fieldIsRecursive,
+    });
+    // A recursive field is already behind a pointer, and is usually small.
+    if (fieldIsRecursive) {
+      return ccType;
+    }
+    const isArrayOrStruct =
+      type.kind === "array" ||
+      (type.kind === "record" &&
+        this.recordMap.get(type.key)!.record.recordType === "struct");
+    if (!isArrayOrStruct) {
+      return ccType;
+    } else if (this.lazyFields) {
+      return `::soia::lazy<${ccType}>`;
+    } else if (this.sharedFields) {
+      return `::soia::shared<${ccType}>`;
+    }
+    return ccType;
+  }
+
   private addSoiagenSymbol(symbol: string): boolean {
     if (this.seenSoiagenSymbols.has(symbol)) return false;
     this.seenSoiagenSymbols.add(symbol);
@@ -1934,6 +2077,25 @@ function maybeEscapeLowerCaseName(name: string): string {
   return CC_KEYWORDS.has(name) ? `${name}_` : name;
 }
 
+// Groups the given items by the length of their name, in increasing order of
+// length. Used for generating code which dispatches on a field name.
+function groupByNameLength<T>(
+  items: readonly T[],
+  getName: (item: T) => string,
+): Array<[number, T[]]> {
+  const lengthToItems = new Map<number, T[]>();
+  for (const item of items) {
+    const length = getName(item).length;
+    const group = lengthToItems.get(length);
+    if (group) {
+      group.push(item);
+    } else {
+      lengthToItems.set(length, [item]);
+    }
+  }
+  return [...lengthToItems.entries()].sort((a, b) => a[0] - b[0]);
+}
+
 function numberToCharLiterals(n: number): string {
   const decimal = `${n}`;
   let result = "";
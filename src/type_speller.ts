@@ -8,6 +8,12 @@ export class TypeSpeller {
     readonly recordMap: ReadonlyMap<RecordKey, RecordLocation>,
     private readonly origin: Module,
     private readonly includes: Set<string>,
+    /** Whether strings and arrays allocate from a soia::Arena. */
+    private readonly arena: boolean,
+    /** Whether recursive fields use soia::shared instead of soia::rec. */
+    private readonly sharedRecursiveFields: boolean = false,
+    /** Whether strings and bytes point into the input they were parsed from. */
+    private readonly views: boolean = false,
   ) {}
 
   getCcType(
@@ -31,7 +37,9 @@ export class TypeSpeller {
           qualifiedName = `::${namespace}::${qualifiedName}`;
         }
         if (opts.fieldIsRecursive) {
-          return `::soia::rec<${qualifiedName}>`;
+          return this.sharedRecursiveFields
+            ? `::soia::shared<${qualifiedName}>`
+            : `::soia::rec<${qualifiedName}>`;
         }
         return qualifiedName;
       }
@@ -51,6 +59,8 @@ export class TypeSpeller {
             }
           }
           return `::soia::keyed_items<${itemType}, ${keyType}>`;
+        } else if (this.arena) {
+          return `::soia::arena_vector<${itemType}>`;
         } else {
           return `::std::vector<${itemType}>`;
         }
@@ -77,9 +87,12 @@ export class TypeSpeller {
           case "timestamp":
             return "::absl::Time";
           case "string":
-            return "::std::string";
+            if (this.views) {
+              return "::absl::string_view";
+            }
+            return this.arena ? "::soia::arena_string" : "::std::string";
           case "bytes":
-            return "::soia::ByteString";
+            return this.views ? "::soia::ByteStringView" : "::soia::ByteString";
         }
       }
     }